@@ -0,0 +1,77 @@
+#ifndef GMOD_BENCH_HPP
+#define GMOD_BENCH_HPP
+
+#include <gmodel.hpp>
+#include <benchmark/benchmark.h>
+#include <sys/resource.h>
+
+/* Scalable models for the benchmarks. Each generator builds a model
+   whose size grows with its argument, the way the tests build their
+   small gold-file models. */
+
+/* an n x n x n array of unit cubes inserted into one box */
+static inline gmod::ObjPtr cube_array(int n)
+{
+  auto box = gmod::new_cube(gmod::Vector{0, 0, 0},
+      gmod::Vector{2.0 * n, 0, 0}, gmod::Vector{0, 2.0 * n, 0},
+      gmod::Vector{0, 0, 2.0 * n});
+  for (int i = 0; i < n; ++i)
+  for (int j = 0; j < n; ++j)
+  for (int k = 0; k < n; ++k) {
+    auto cell = gmod::new_cube(gmod::Vector{2.0 * i + .5, 2.0 * j + .5,
+        2.0 * k + .5}, gmod::Vector{1, 0, 0}, gmod::Vector{0, 1, 0},
+        gmod::Vector{0, 0, 1});
+    gmod::insert_into(box, cell);
+  }
+  return box;
+}
+
+/* a NACA 0012 section through m points per side, as two splines
+   like the ones tests/airfoil.cpp reads from e625.dat, extruded
+   into a wing */
+static inline gmod::ObjPtr airfoil_wing(int m)
+{
+  auto thickness = [](double x) {
+    return 0.6 * (0.2969 * std::sqrt(x) - 0.1260 * x - 0.3516 * x * x +
+                  0.2843 * x * x * x - 0.1015 * x * x * x * x);
+  };
+  auto leading = gmod::new_point2(gmod::Vector{0, 0, 0});
+  auto trailing = gmod::new_point2(gmod::Vector{1, 0, 0});
+  std::vector<gmod::PointPtr> top(1, leading);
+  std::vector<gmod::PointPtr> bottom(1, trailing);
+  for (int i = 1; i < m; ++i) {
+    double x = 0.5 * (1 - std::cos(gmod::PI * i / m));
+    top.push_back(gmod::new_point2(gmod::Vector{x, thickness(x), 0}));
+    double xb = 1 - x;
+    bottom.push_back(gmod::new_point2(gmod::Vector{xb, -thickness(xb), 0}));
+  }
+  top.push_back(trailing);
+  bottom.push_back(leading);
+  auto loop = gmod::new_loop();
+  gmod::add_use(loop, gmod::FORWARD, gmod::new_spline2(top));
+  gmod::add_use(loop, gmod::FORWARD, gmod::new_spline2(bottom));
+  auto section = gmod::new_plane2(loop);
+  return gmod::extrude_face(section, gmod::Vector{0, 0, 4}).middle;
+}
+
+/* a square extruded through k layers in one pass */
+static inline gmod::ObjPtr layered_slab(int k)
+{
+  auto square = gmod::new_square(gmod::Vector{0, 0, 0},
+      gmod::Vector{1, 0, 0}, gmod::Vector{0, 1, 0});
+  std::vector<gmod::Vector> offsets(std::size_t(k), gmod::Vector{0, 0, 0.1});
+  auto group = gmod::new_group();
+  gmod::extrude_layers(square, offsets, group);
+  return group;
+}
+
+/* the peak resident set size of the process so far, as a benchmark
+   counter; it only grows, so run one filter at a time to compare sizes */
+static inline void record_peak_memory(benchmark::State& state)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  state.counters["peak_rss_MiB"] = double(usage.ru_maxrss) / 1024;
+}
+
+#endif
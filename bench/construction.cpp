@@ -0,0 +1,62 @@
+#include "bench.hpp"
+
+static void BM_cube_array(benchmark::State& state)
+{
+  auto n = int(state.range(0));
+  for (auto _ : state) {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    benchmark::DoNotOptimize(cube_array(n));
+    gmod::set_current_model(nullptr);
+  }
+  state.SetItemsProcessed(state.iterations() * n * n * n);
+  record_peak_memory(state);
+}
+BENCHMARK(BM_cube_array)->RangeMultiplier(2)->Range(4, 32)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_airfoil(benchmark::State& state)
+{
+  auto m = int(state.range(0));
+  for (auto _ : state) benchmark::DoNotOptimize(airfoil_wing(m));
+  state.SetItemsProcessed(state.iterations() * m);
+  record_peak_memory(state);
+}
+BENCHMARK(BM_airfoil)->RangeMultiplier(8)->Range(64, 1 << 15)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_layers(benchmark::State& state)
+{
+  auto k = int(state.range(0));
+  for (auto _ : state) benchmark::DoNotOptimize(layered_slab(k));
+  state.SetItemsProcessed(state.iterations() * k);
+  record_peak_memory(state);
+}
+BENCHMARK(BM_layers)->RangeMultiplier(8)->Range(8, 1 << 15)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_copy_closure(benchmark::State& state)
+{
+  auto model = cube_array(int(state.range(0)));
+  for (auto _ : state) benchmark::DoNotOptimize(gmod::copy_closure(model));
+  state.SetItemsProcessed(state.iterations() *
+      std::int64_t(gmod::get_closure(model, true, true).size()));
+  record_peak_memory(state);
+}
+BENCHMARK(BM_copy_closure)->RangeMultiplier(2)->Range(4, 16)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_linear_pattern(benchmark::State& state)
+{
+  auto cube = gmod::new_cube(gmod::Vector{0, 0, 0}, gmod::Vector{1, 0, 0},
+      gmod::Vector{0, 1, 0}, gmod::Vector{0, 0, 1});
+  auto count = int(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        gmod::linear_pattern(cube, gmod::Vector{2, 0, 0}, count));
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+  record_peak_memory(state);
+}
+BENCHMARK(BM_linear_pattern)->RangeMultiplier(8)->Range(8, 1 << 15)
+    ->Unit(benchmark::kMillisecond);
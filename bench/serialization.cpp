@@ -0,0 +1,82 @@
+#include "bench.hpp"
+
+/* discards what it is given, so only formatting is measured */
+struct NullSink : public gmod::Sink {
+  void write(char const*, std::size_t size) override { bytes += size; }
+  std::size_t bytes = 0;
+};
+
+template <class Write>
+static void measure_writer(benchmark::State& state, Write write)
+{
+  auto model = cube_array(int(state.range(0)));
+  std::size_t bytes = 0;
+  for (auto _ : state) {
+    NullSink sink;
+    write(model, sink);
+    bytes = sink.bytes;
+  }
+  state.SetBytesProcessed(state.iterations() * std::int64_t(bytes));
+  record_peak_memory(state);
+}
+
+static void BM_write_geo(benchmark::State& state)
+{
+  measure_writer(state, [](gmod::ObjPtr const& model, gmod::Sink& sink) {
+    gmod::write_closure_to_geo(model, sink);
+  });
+}
+BENCHMARK(BM_write_geo)->RangeMultiplier(2)->Range(4, 32)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_write_dmg(benchmark::State& state)
+{
+  measure_writer(state, [](gmod::ObjPtr const& model, gmod::Sink& sink) {
+    gmod::write_closure_to_dmg(model, sink);
+  });
+}
+BENCHMARK(BM_write_dmg)->RangeMultiplier(2)->Range(4, 32)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_write_binary(benchmark::State& state)
+{
+  measure_writer(state, [](gmod::ObjPtr const& model, gmod::Sink& sink) {
+    gmod::write_closure_to_binary(model, sink);
+  });
+}
+BENCHMARK(BM_write_binary)->RangeMultiplier(2)->Range(4, 32)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_rewrite_geo_cached(benchmark::State& state)
+{
+  auto model = cube_array(int(state.range(0)));
+  gmod::GeoCache cache;
+  std::size_t bytes = 0;
+  for (auto _ : state) {
+    NullSink sink;
+    {
+      gmod::Writer w(sink);
+      gmod::print_closure(w, model, cache);
+    }
+    bytes = sink.bytes;
+  }
+  state.SetBytesProcessed(state.iterations() * std::int64_t(bytes));
+  record_peak_memory(state);
+}
+BENCHMARK(BM_rewrite_geo_cached)->RangeMultiplier(2)->Range(4, 32)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_read_geo(benchmark::State& state)
+{
+  gmod::BufferSink geo;
+  gmod::write_closure_to_geo(cube_array(int(state.range(0))), geo);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        gmod::read_closure_from_geo(geo.buffer.data(), geo.buffer.size()));
+  }
+  state.SetBytesProcessed(state.iterations() *
+      std::int64_t(geo.buffer.size()));
+  record_peak_memory(state);
+}
+BENCHMARK(BM_read_geo)->RangeMultiplier(2)->Range(4, 16)
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,53 @@
+#include "bench.hpp"
+
+/* get_closure traverses on every call (only the writers cache
+   closures, which the repeated writes in serialization.cpp hit) */
+static void BM_get_closure(benchmark::State& state)
+{
+  auto model = cube_array(int(state.range(0)));
+  gmod::ObjectIndex visited;
+  std::size_t size = 0;
+  for (auto _ : state) {
+    auto closure = gmod::get_closure(model, true, true, visited);
+    size = closure.size();
+    benchmark::DoNotOptimize(closure.data());
+  }
+  state.SetItemsProcessed(state.iterations() * std::int64_t(size));
+  record_peak_memory(state);
+}
+BENCHMARK(BM_get_closure)->RangeMultiplier(2)->Range(4, 32)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_frozen_closure(benchmark::State& state)
+{
+  auto frozen = gmod::freeze(cube_array(int(state.range(0))));
+  for (auto _ : state) {
+    auto closure = gmod::get_closure(frozen, frozen.root(), true, true);
+    benchmark::DoNotOptimize(closure.data());
+  }
+  state.SetItemsProcessed(state.iterations() *
+      std::int64_t(frozen.types.size()));
+  state.counters["frozen_MiB"] = double(frozen.bytes()) / (1 << 20);
+  record_peak_memory(state);
+}
+BENCHMARK(BM_frozen_closure)->RangeMultiplier(2)->Range(4, 32)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_assembly_boundary(benchmark::State& state)
+{
+  auto n = int(state.range(0));
+  auto group = gmod::new_group();
+  for (int i = 0; i < n; ++i)
+  for (int j = 0; j < n; ++j) {
+    gmod::add_to_group(group, gmod::new_square(
+        gmod::Vector{double(i), double(j), 0},
+        gmod::Vector{1, 0, 0}, gmod::Vector{0, 1, 0}));
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(gmod::collect_assembly_boundary(group));
+  }
+  state.SetItemsProcessed(state.iterations() * n * n);
+  record_peak_memory(state);
+}
+BENCHMARK(BM_assembly_boundary)->RangeMultiplier(4)->Range(16, 256)
+    ->Unit(benchmark::kMillisecond);
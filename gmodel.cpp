@@ -1,10 +1,25 @@
 #include "gmodel.hpp"
 
 #include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace gmod {
 
@@ -19,7 +34,8 @@ char const* const type_names[NTYPES] = {
     /* VOLUME  = */ "Volume",
     /* LOOP    = */ "Line Loop",
     /* SHELL   = */ "Surface Loop",
-    /* GROUP   = */ "Gmodel Group"};
+    /* GROUP   = */ "Gmodel Group",
+    /* INSTANCE= */ "Gmodel Instance"};
 
 char const* const physical_type_names[NTYPES] = {
     /* POINT   = */ "Physical Point",
@@ -32,7 +48,8 @@ char const* const physical_type_names[NTYPES] = {
     /* VOLUME  = */ "Physical Volume",
     /* LOOP    = */ nullptr,
     /* SHELL   = */ nullptr,
-    /* GROUP   = */ nullptr};
+    /* GROUP   = */ nullptr,
+    /* INSTANCE= */ nullptr};
 
 int const type_dims[NTYPES] = {
     /* POINT   = */ 0,
@@ -45,7 +62,8 @@ int const type_dims[NTYPES] = {
     /* VOLUME  = */ 3,
     /* LOOP    = */ -1,
     /* SHELL   = */ -1,
-    /* GROUP   = */ -1};
+    /* GROUP   = */ -1,
+    /* INSTANCE= */ -1};
 
 char const* const dim_names[4] = {
     "Point",
@@ -77,318 +95,1729 @@ int get_boundary_type(int cell_type) {
   }
 }
 
-static int next_id = 0;
-static int nlive_objects = 0;
+IdAllocator::IdAllocator(bool atomic_) : next(0), atomic(atomic_) {}
+
+int IdAllocator::allocate(int n) {
+  if (atomic) return next.fetch_add(n, std::memory_order_relaxed);
+  int id = next.load(std::memory_order_relaxed);
+  next.store(id + n, std::memory_order_relaxed);
+  return id;
+}
+
+int num_threads = 1;
+
+static int resolved_num_threads() {
+  if (num_threads > 0) return num_threads;
+  auto n = static_cast<int>(std::thread::hardware_concurrency());
+  return std::max(n, 1);
+}
+
+/* whether this thread is running a parallel_for body, so that
+   nested calls run serially without touching the pool's lock */
+static thread_local bool in_parallel_for = false;
+
+/* workers sleep until a batch is posted, then claim indices from
+   a shared counter until it runs out; resizing down joins the
+   workers past the new size */
+struct ThreadPool {
+  ThreadPool() : batch(0), n(0), busy(0), limit(0), stop(false) {}
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
+  void resize(std::size_t nworkers) {
+    if (nworkers < workers.size()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        limit = nworkers;
+      }
+      wake.notify_all();
+      for (auto i = nworkers; i < workers.size(); ++i) workers[i].join();
+      workers.resize(nworkers);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    limit = nworkers;
+    while (workers.size() < nworkers) {
+      auto index = workers.size();
+      auto seen = batch;
+      workers.push_back(std::thread([this, index, seen]() {
+        work(index, seen);
+      }));
+    }
+  }
+  void claim() {
+    for (auto i = next.fetch_add(1); i < n; i = next.fetch_add(1)) (*body)(i);
+  }
+  void work(std::size_t index, unsigned long seen) {
+    in_parallel_for = true;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock,
+          [&]() { return stop || index >= limit || batch != seen; });
+      if (stop || index >= limit) return;
+      seen = batch;
+      lock.unlock();
+      claim();
+      lock.lock();
+      if (--busy == 0) done.notify_all();
+    }
+  }
+  void run(std::size_t n_, std::function<void(std::size_t)> const& body_) {
+    std::unique_lock<std::mutex> lock(mutex);
+    body = &body_;
+    n = n_;
+    next = 0;
+    busy = workers.size();
+    ++batch;
+    lock.unlock();
+    wake.notify_all();
+    claim();
+    lock.lock();
+    done.wait(lock, [&]() { return busy == 0; });
+  }
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::function<void(std::size_t)> const* body;
+  unsigned long batch;
+  std::size_t n;
+  std::atomic<std::size_t> next;
+  std::size_t busy;
+  std::size_t limit;
+  bool stop;
+};
+
+static std::mutex pool_lock;
+
+void parallel_for(std::size_t n,
+    std::function<void(std::size_t)> const& body) {
+  auto nthreads = resolved_num_threads();
+  auto serial = [&]() {
+    for (std::size_t i = 0; i < n; ++i) body(i);
+  };
+  if (nthreads == 1 || n < 2 || in_parallel_for) return serial();
+  /* other threads' calls at the same time run serially too */
+  std::unique_lock<std::mutex> lock(pool_lock, std::try_to_lock);
+  if (!lock.owns_lock()) return serial();
+  static ThreadPool pool;
+  pool.resize(std::size_t(nthreads - 1));
+  in_parallel_for = true;
+  pool.run(n, body);
+  in_parallel_for = false;
+}
+
+void IdAllocator::skip_past(int id) {
+  auto current = next.load(std::memory_order_relaxed);
+  while (current <= id &&
+         !next.compare_exchange_weak(current, id + 1,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+static IdAllocator global_ids(true);
+
+char const* const stats_phase_names[NSTATS_PHASES] = {
+    "extrude", "copy", "weld", "write"};
+
+/* with GMOD_STATS undefined the counting and timing
+   macros compile to nothing and the counters stay zero */
+struct StatsCounters {
+  std::atomic<long long> live[NTYPES];
+  std::atomic<long long> uses;
+  std::atomic<long long> helpers;
+  std::atomic<long long> bytes_allocated;
+  std::atomic<long long> closure_traversals;
+  std::atomic<long long> closure_cache_hits;
+  std::atomic<long long> nanoseconds[NSTATS_PHASES];
+};
+
+static StatsCounters stats_counters;
+
+#ifdef GMOD_STATS
+bool const stats_enabled = true;
+
+#define GMOD_COUNT(counter, n)                                \
+  stats_counters.counter.fetch_add(static_cast<long long>(n), \
+                                   std::memory_order_relaxed)
+
+static thread_local int phase_depth[NSTATS_PHASES];
+
+/* only the outermost timer of a phase on each thread counts,
+   so nested and recursive calls are not counted twice */
+struct PhaseTimer {
+  PhaseTimer(int phase_) : phase(phase_) {
+    if (phase_depth[phase]++ == 0) start = std::chrono::steady_clock::now();
+  }
+  ~PhaseTimer() {
+    if (--phase_depth[phase] != 0) return;
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    GMOD_COUNT(nanoseconds[phase],
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+  int phase;
+  std::chrono::steady_clock::time_point start;
+};
+
+#define GMOD_TIME(phase) PhaseTimer phase_timer(phase)
+#else
+bool const stats_enabled = false;
+
+#define GMOD_COUNT(counter, n) ((void)0)
+#define GMOD_TIME(phase) ((void)0)
+#endif
+
+static thread_local Model* current_model = nullptr;
+
+void set_current_model(Model* model) { current_model = model; }
+
+Model* get_current_model() { return current_model; }
+
+/* while set, the heap-allocated objects this thread makes, as
+   build_parts records them without a Model to hold them */
+static thread_local std::vector<ObjPtr>* made_objects = nullptr;
+
+enum { MODEL_CHUNK_SIZE = 64 * 1024 };
+
+Model::Model(bool atomic_ids)
+    : anchor(static_cast<void*>(this), [](void*) {}),
+      chunk_pos(nullptr),
+      chunk_end(nullptr),
+      point_pos(nullptr),
+      point_end(nullptr),
+      bytes_reserved(0),
+      ids(atomic_ids) {}
+
+Model::~Model() {
+  if (current_model == this) current_model = nullptr;
+  for (auto it = objects.rbegin(); it != objects.rend(); ++it) (*it)->~Object();
+  for (auto chunk : chunks) ::operator delete(chunk);
+}
+
+static void* carve(Model& model, char*& chunk_pos, char*& chunk_end,
+    std::size_t size, std::size_t align) {
+  auto pos = reinterpret_cast<std::size_t>(chunk_pos);
+  auto aligned = (pos + align - 1) & ~(align - 1);
+  if (chunk_pos == nullptr ||
+      aligned + size > reinterpret_cast<std::size_t>(chunk_end)) {
+    std::size_t chunk_size = std::max(std::size_t(MODEL_CHUNK_SIZE),
+                                      size + align);
+    char* chunk = static_cast<char*>(::operator new(chunk_size));
+    model.chunks.push_back(chunk);
+    model.bytes_reserved += chunk_size;
+    GMOD_COUNT(bytes_allocated, chunk_size);
+    chunk_pos = chunk;
+    chunk_end = chunk + chunk_size;
+    pos = reinterpret_cast<std::size_t>(chunk_pos);
+    aligned = (pos + align - 1) & ~(align - 1);
+  }
+  chunk_pos += (aligned - pos) + size;
+  return reinterpret_cast<void*>(aligned);
+}
+
+void* Model::allocate(std::size_t size, std::size_t align) {
+  return carve(*this, chunk_pos, chunk_end, size, align);
+}
+
+void* Model::allocate_point(std::size_t size, std::size_t align) {
+  return carve(*this, point_pos, point_end, size, align);
+}
+
+/* use lists grow by doubling, so blocks are rounded up to
+   power-of-two size classes and recycled through free lists
+   rather than abandoned in the arena */
+static std::size_t block_class(std::size_t size) {
+  std::size_t c = 0;
+  while ((std::size_t(16) << c) < size) ++c;
+  return c;
+}
+
+void* Model::allocate_block(std::size_t size) {
+  auto c = block_class(size);
+  auto& free_list = free_blocks[c];
+  if (!free_list.empty()) {
+    void* p = free_list.back();
+    free_list.pop_back();
+    return p;
+  }
+  return allocate(std::size_t(16) << c, 16);
+}
+
+void Model::deallocate_block(void* p, std::size_t size) {
+  free_blocks[block_class(size)].push_back(p);
+}
+
+static int allocate_id() {
+  return current_model ? current_model->ids.allocate()
+                       : global_ids.allocate();
+}
+
+Object::Object(int type_)
+    : type(type_), id(allocate_id()), closure_cache(nullptr) {
+  GMOD_COUNT(live[type], 1);
+}
+
+template <typename T>
+static void* allocate_storage(Model* model) {
+  return model->allocate(sizeof(T), alignof(T));
+}
+
+template <>
+void* allocate_storage<Point>(Model* model) {
+  return model->allocate_point(sizeof(Point), alignof(Point));
+}
+
+template <typename T, typename... Args>
+static std::shared_ptr<T> allocate_object(Args... args) {
+  Model* model = current_model;
+  if (!model) {
+    GMOD_COUNT(bytes_allocated, sizeof(T));
+    std::shared_ptr<T> made(new T(args...));
+    if (made_objects) made_objects->push_back(made);
+    return made;
+  }
+  T* raw = new (allocate_storage<T>(model)) T(args...);
+  model->objects.push_back(raw);
+  return std::shared_ptr<T>(model->anchor, raw);
+}
+
+ObjPtr new_object(int type) { return allocate_object<Object>(type); }
+
+/* closures cached for the writers, with and without helpers.
+   Their ObjPtrs don't own the objects, so a cache never keeps
+   objects alive; it is only read while its generation is current,
+   when everything in it is still reachable from the root.
+   size_hint is the size of the last large closure of the root, which
+   sizes the index and queue of its next traversal up front. */
+struct ClosureCache {
+  std::size_t size_hint;
+  unsigned long generation[2];
+  bool valid[2];
+  std::vector<ObjPtr> closure[2];
+  unsigned long box_generation;
+  bool box_valid;
+  Box box;
+};
+
+Object::~Object() {
+  delete closure_cache;
+  GMOD_COUNT(live[type], -1);
+  GMOD_COUNT(uses, -static_cast<long long>(used.size()));
+  GMOD_COUNT(helpers, -static_cast<long long>(helpers.size()));
+}
+
+ObjectIndex::ObjectIndex() : epoch(1), count(0) {}
+
+void ObjectIndex::clear() {
+  count = 0;
+  if (++epoch == 0) {
+    for (auto& slot : slots) slot.stamp = 0;
+    epoch = 1;
+  }
+}
+
+static std::size_t hash_slot(Object const* o, std::size_t mask) {
+  auto h = std::uint64_t(reinterpret_cast<std::uintptr_t>(o) >> 4);
+  return std::size_t((h * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+/* open addressing with linear probing; a slot is live only
+   if its stamp matches the current epoch */
+void ObjectIndex::reserve(std::size_t n) {
+  std::size_t capacity = 16;
+  while (capacity < 2 * n) capacity *= 2;
+  if (capacity <= slots.size()) return;
+  std::vector<Slot> old_slots(capacity, Slot{nullptr, 0u, -1});
+  old_slots.swap(slots);
+  count = 0;
+  for (auto const& slot : old_slots) {
+    if (slot.stamp == epoch) insert(slot.key, slot.value);
+  }
+}
 
-Object::Object(int type_) : type(type_), id(next_id++), scratch(-1) {
-  ++nlive_objects;
+int ObjectIndex::find(Object const* o) const {
+  if (slots.empty()) return -1;
+  auto mask = slots.size() - 1;
+  for (auto i = hash_slot(o, mask); slots[i].stamp == epoch;
+       i = (i + 1) & mask) {
+    if (slots[i].key == o) return slots[i].value;
+  }
+  return -1;
 }
 
-ObjPtr new_object(int type) { return ObjPtr(new Object(type)); }
+bool ObjectIndex::insert(Object const* o, int value) {
+  if (2 * (count + 1) > slots.size()) reserve(count + 1);
+  auto mask = slots.size() - 1;
+  auto i = hash_slot(o, mask);
+  for (; slots[i].stamp == epoch; i = (i + 1) & mask) {
+    if (slots[i].key == o) return false;
+  }
+  slots[i] = Slot{o, epoch, value};
+  ++count;
+  return true;
+}
 
-Object::~Object() { --nlive_objects; }
+void ObjectIndex::assign(Object const* o, int value) {
+  if (insert(o, value)) return;
+  auto mask = slots.size() - 1;
+  auto i = hash_slot(o, mask);
+  while (slots[i].key != o) i = (i + 1) & mask;
+  slots[i].value = value;
+}
 
-int get_used_dir(ObjPtr user, ObjPtr used) {
+int get_used_dir(ObjPtr const& user, ObjPtr const& used) {
   auto it = std::find_if(user->used.begin(), user->used.end(),
-                         [=](Use u) { return u.obj == used; });
+                         [&](Use const& u) { return u.obj == used; });
   assert(it != user->used.end());
   return it->dir;
 }
 
-std::vector<ObjPtr> get_objs_used(ObjPtr user) {
+std::vector<ObjPtr> get_objs_used(ObjPtr const& user) {
   std::vector<ObjPtr> objs;
-  for (auto use : user->used) objs.push_back(use.obj);
+  objs.reserve(user->used.size());
+  for (auto const& use : user->used) objs.push_back(use.obj);
   return objs;
 }
 
-void print_object(FILE* f, ObjPtr obj) {
-  switch (obj->type) {
+Sink::~Sink() {}
+
+FileSink::FileSink(FILE* f) : file(f) {}
+
+void FileSink::write(char const* data, std::size_t size) {
+  fwrite(data, 1, size, file);
+}
+
+void BufferSink::write(char const* data, std::size_t size) {
+  buffer.append(data, size);
+}
+
+Writer::Writer(Sink& sink_, std::size_t capacity)
+    : sink(sink_), buffer(std::max(capacity, std::size_t(64))), size(0) {}
+
+Writer::~Writer() { flush(); }
+
+void Writer::flush() {
+  if (size) sink.write(buffer.data(), size);
+  size = 0;
+}
+
+void Writer::put(char const* s) { put(s, strlen(s)); }
+
+void Writer::put(char const* s, std::size_t n) {
+  if (size + n > buffer.size()) {
+    flush();
+    if (n > buffer.size()) {
+      sink.write(s, n);
+      return;
+    }
+  }
+  memcpy(buffer.data() + size, s, n);
+  size += n;
+}
+
+void Writer::put_int(long long i) {
+  char digits[24];
+  char* end = digits + sizeof(digits);
+  char* p = end;
+  auto u = i < 0 ? 0ull - static_cast<unsigned long long>(i)
+                 : static_cast<unsigned long long>(i);
+  do {
+    *--p = static_cast<char>('0' + u % 10);
+    u /= 10;
+  } while (u);
+  if (i < 0) *--p = '-';
+  put(p, std::size_t(end - p));
+}
+
+/* "%f" rounds the exact binary value to six decimals. Scaling by
+   1e6 is off by at most half an ulp, so the scaled value rounds
+   the same way unless it lies within an ulp of a tie, which
+   (like large or non-finite values) is left to snprintf. */
+void Writer::put_fixed(double x) {
+  double a = fabs(x);
+  if (a < 1e9) {
+    double scaled = a * 1e6;
+    double floor_scaled = floor(scaled);
+    double frac = scaled - floor_scaled;
+    if (fabs(frac - 0.5) > scaled * 1e-15) {
+      auto n = static_cast<unsigned long long>(floor_scaled) +
+               (frac > 0.5 ? 1 : 0);
+      char digits[32];
+      char* end = digits + sizeof(digits);
+      char* p = end;
+      for (int i = 0; i < 6; ++i) {
+        *--p = static_cast<char>('0' + n % 10);
+        n /= 10;
+      }
+      *--p = '.';
+      do {
+        *--p = static_cast<char>('0' + n % 10);
+        n /= 10;
+      } while (n);
+      if (std::signbit(x)) *--p = '-';
+      put(p, std::size_t(end - p));
+      return;
+    }
+  }
+  char text[512];
+  int n = snprintf(text, sizeof(text), "%f", x);
+  put(text, std::size_t(n));
+}
+
+/* The printers are templates over how ids and point positions are
+   looked up, so that the same code prints ordinary objects and the
+   copies that instances stand for. They also reach types, uses,
+   helpers and embedded objects through the numbering, whose Handle
+   is an object or a position in the tables of a FrozenModel. */
+
+struct ObjectView {
+  typedef Object const* Handle;
+  int type(Handle o) const { return o->type; }
+  double size(Handle p) const { return static_cast<Point const*>(p)->size; }
+  std::size_t use_count(Handle o) const { return o->used.size(); }
+  Handle use(Handle o, std::size_t k) const { return o->used[k].obj.get(); }
+  int use_dir(Handle o, std::size_t k) const { return o->used[k].dir; }
+  std::size_t helper_count(Handle o) const { return o->helpers.size(); }
+  Handle helper(Handle o, std::size_t k) const {
+    return o->helpers[k].get();
+  }
+  std::size_t embedded_count(Handle o) const { return o->embedded.size(); }
+  Handle embedded(Handle o, std::size_t k) const {
+    return o->embedded[k].get();
+  }
+};
+
+struct OwnNumbering : public ObjectView {
+  int id(Object const* o) const { return o->id; }
+  Vector pos(Object const* p) const {
+    return static_cast<Point const*>(p)->pos;
+  }
+};
+
+template <class Numbering>
+static void print_point_t(Writer& w, typename Numbering::Handle p,
+    Numbering const& num) {
+  auto pos = num.pos(p);
+  w.put("Point(", 6);
+  w.put_int(num.id(p));
+  w.put(") = {", 5);
+  w.put_fixed(pos.x);
+  w.put(',');
+  w.put_fixed(pos.y);
+  w.put(',');
+  w.put_fixed(pos.z);
+  w.put(',');
+  w.put_fixed(num.size(p));
+  w.put("};\n", 3);
+}
+
+template <class Numbering>
+static void print_arc_t(Writer& w, typename Numbering::Handle arc,
+    Numbering const& num) {
+  w.put(type_names[num.type(arc)]);
+  w.put('(');
+  w.put_int(num.id(arc));
+  w.put(") = {", 5);
+  w.put_int(num.id(num.use(arc, 0)));
+  w.put(',');
+  w.put_int(num.id(num.helper(arc, 0)));
+  w.put(',');
+  w.put_int(num.id(num.use(arc, 1)));
+  w.put("};\n", 3);
+}
+
+/* the helpers are the center and a point on the major axis */
+template <class Numbering>
+static void print_ellipse_t(Writer& w, typename Numbering::Handle e,
+    Numbering const& num) {
+  w.put(type_names[num.type(e)]);
+  w.put('(');
+  w.put_int(num.id(e));
+  w.put(") = {", 5);
+  w.put_int(num.id(num.use(e, 0)));
+  w.put(',');
+  w.put_int(num.id(num.helper(e, 0)));
+  w.put(',');
+  w.put_int(num.id(num.helper(e, 1)));
+  w.put(',');
+  w.put_int(num.id(num.use(e, 1)));
+  w.put("};\n", 3);
+}
+
+template <class Numbering>
+static void print_spline_t(Writer& w, typename Numbering::Handle e,
+    Numbering const& num) {
+  w.put(type_names[num.type(e)]);
+  w.put('(');
+  w.put_int(num.id(e));
+  w.put(") = {", 5);
+  w.put_int(num.id(num.use(e, 0)));
+  w.put(',');
+  for (std::size_t k = 0; k < num.helper_count(e); ++k) {
+    w.put_int(num.id(num.helper(e, k)));
+    w.put(',');
+  }
+  w.put_int(num.id(num.use(e, 1)));
+  w.put("};\n", 3);
+}
+
+template <class Numbering>
+static void print_simple_object_t(Writer& w, typename Numbering::Handle obj,
+    Numbering const& num) {
+  auto type = num.type(obj);
+  w.put(type_names[type]);
+  w.put('(');
+  w.put_int(num.id(obj));
+  w.put(") = {", 5);
+  for (std::size_t k = 0; k < num.use_count(obj); ++k) {
+    if (k) w.put(',');
+    if (is_boundary(type) && num.use_dir(obj, k) == REVERSE)
+      w.put_int(-num.id(num.use(obj, k)));
+    else
+      w.put_int(num.id(num.use(obj, k)));
+  }
+  w.put("};\n", 3);
+  for (std::size_t k = 0; k < num.embedded_count(obj); ++k) {
+    auto emb = num.embedded(obj, k);
+    w.put(dim_names[type_dims[num.type(emb)]]);
+    w.put('{');
+    w.put_int(num.id(emb));
+    w.put("} In ", 5);
+    w.put(dim_names[type_dims[type]]);
+    w.put('{');
+    w.put_int(num.id(obj));
+    w.put("};\n", 3);
+  }
+}
+
+template <class Numbering>
+static void print_object_t(Writer& w, typename Numbering::Handle obj,
+    Numbering const& num) {
+  switch (num.type(obj)) {
     case POINT:
-      print_point(f, std::dynamic_pointer_cast<Point>(obj));
+      print_point_t(w, obj, num);
       break;
     case ARC:
-      print_arc(f, obj);
+      print_arc_t(w, obj, num);
       break;
     case ELLIPSE:
-      print_ellipse(f, obj);
+      print_ellipse_t(w, obj, num);
       break;
     case SPLINE:
-      print_spline(f, obj);
+      print_spline_t(w, obj, num);
       break;
     case GROUP:
+    case INSTANCE:
       break;
     default:
-      print_simple_object(f, obj);
+      print_simple_object_t(w, obj, num);
       break;
   }
 }
 
-void print_object_physical(FILE* f, ObjPtr obj) {
-  if (!is_entity(obj->type)) return;
-  fprintf(f, "%s(%u) = {%u};\n", physical_type_names[obj->type], obj->id,
-          obj->id);
-}
-
-void print_closure(FILE* f, ObjPtr obj) {
-  auto closure = get_closure(obj, true, true);
-  for (auto co : closure) print_object(f, co);
-  closure = get_closure(obj, false, true);
-  for (auto co : closure) print_object_physical(f, co);
-}
-
-void write_closure_to_geo(ObjPtr obj, char const* filename) {
-  FILE* f = fopen(filename, "w");
-  print_closure(f, obj);
-  fclose(f);
-}
-
-void print_simple_object(FILE* f, ObjPtr obj) {
-  fprintf(f, "%s(%d) = {", type_names[obj->type], obj->id);
-  bool first = true;
-  for (auto use : obj->used) {
-    if (!first) fprintf(f, ",");
-    if (is_boundary(obj->type) && use.dir == REVERSE)
-      fprintf(f, "%d", -(int(use.obj->id)));
-    else
-      fprintf(f, "%u", use.obj->id);
-    if (first) first = false;
-  }
-  fprintf(f, "};\n");
-  for (auto emb : obj->embedded) {
-    fprintf(f, "%s{%d} In %s{%d};\n",
-        dim_names[type_dims[emb->type]], emb->id,
-        dim_names[type_dims[obj->type]], obj->id);
-  }
+template <class Numbering>
+static void print_object_physical_t(Writer& w, typename Numbering::Handle obj,
+    Numbering const& num) {
+  auto type = num.type(obj);
+  if (!is_entity(type)) return;
+  auto id = num.id(obj);
+  w.put(physical_type_names[type]);
+  w.put('(');
+  w.put_int(id);
+  w.put(") = {", 5);
+  w.put_int(id);
+  w.put("};\n", 3);
 }
 
-void print_object_dmg(FILE* f, ObjPtr obj) {
-  switch (obj->type) {
+template <class Numbering>
+static void print_object_dmg_t(Writer& w, typename Numbering::Handle obj,
+    Numbering const& num) {
+  switch (num.type(obj)) {
     case POINT: {
-      PointPtr p = std::dynamic_pointer_cast<Point>(obj);
-      fprintf(f, "%u %f %f %f\n", obj->id, p->pos.x, p->pos.y, p->pos.z);
+      auto pos = num.pos(obj);
+      w.put_int(num.id(obj));
+      w.put(' ');
+      w.put_fixed(pos.x);
+      w.put(' ');
+      w.put_fixed(pos.y);
+      w.put(' ');
+      w.put_fixed(pos.z);
+      w.put('\n');
     } break;
     case LINE:
     case ARC:
     case SPLINE:
     case ELLIPSE: {
-      fprintf(f, "%u %u %u\n", obj->id, edge_point(obj, 0)->id,
-              edge_point(obj, 1)->id);
+      w.put_int(num.id(obj));
+      w.put(' ');
+      w.put_int(num.id(num.use(obj, 0)));
+      w.put(' ');
+      w.put_int(num.id(num.use(obj, 1)));
+      w.put('\n');
     } break;
     case PLANE:
     case RULED:
     case VOLUME: {
-      fprintf(f, "%u %zu\n", obj->id, obj->used.size());
-      for (auto use : obj->used) {
-        auto bnd = use.obj;
-        fprintf(f, " %zu\n", bnd->used.size());
-        for (auto bu : bnd->used) {
-          fprintf(f, "  %u %u\n", bu.obj->id, !bu.dir);
+      w.put_int(num.id(obj));
+      w.put(' ');
+      w.put_int(static_cast<long long>(num.use_count(obj)));
+      w.put('\n');
+      for (std::size_t k = 0; k < num.use_count(obj); ++k) {
+        auto bnd = num.use(obj, k);
+        w.put(' ');
+        w.put_int(static_cast<long long>(num.use_count(bnd)));
+        w.put('\n');
+        for (std::size_t j = 0; j < num.use_count(bnd); ++j) {
+          w.put("  ", 2);
+          w.put_int(num.id(num.use(bnd, j)));
+          w.put(' ');
+          w.put(num.use_dir(bnd, j) ? '0' : '1');
+          w.put('\n');
         }
       }
     } break;
     case LOOP:
     case SHELL:
     case GROUP:
+    case INSTANCE:
       break;
   }
 }
 
-int count_of_type(std::vector<ObjPtr> const& objs, int type) {
-  int c = 0;
-  for (auto obj : objs)
-    if (obj->type == type) ++c;
-  return c;
-}
+/* bumped by a topology change if some cache may have recorded
+   the current generation since the last bump, so changes made
+   while nothing is cached only read the shared flag */
+static std::atomic<unsigned long> topology_generation(0);
+static std::atomic<bool> generation_observed(false);
+static std::mutex closure_cache_locks[64];
 
-int count_of_dim(std::vector<ObjPtr> const& objs, int dim) {
-  int c = 0;
-  for (int i = 0; i < NTYPES; ++i)
-    if (is_entity(i) && type_dims[i] == dim) c += count_of_type(objs, i);
-  return c;
+void invalidate_closures() {
+  if (generation_observed.load(std::memory_order_relaxed) &&
+      generation_observed.exchange(false))
+    topology_generation.fetch_add(1);
 }
 
-void print_closure_dmg(FILE* f, ObjPtr obj) {
-  auto closure = get_closure(obj, false, true);
-  fprintf(f, "%u %u %u %u\n", count_of_dim(closure, 3),
-          count_of_dim(closure, 2), count_of_dim(closure, 1),
-          count_of_dim(closure, 0));
-  fprintf(f, "0 0 0\n0 0 0\n");
-  for (int d = 0; d <= 3; ++d) {
-    auto d_objs = filter_by_dim(closure, d);
-    for (auto d_obj : d_objs) print_object_dmg(f, d_obj);
-  }
+/* read before whatever the cache is computed from */
+static unsigned long observe_generation() {
+  auto generation = topology_generation.load();
+  generation_observed.store(true);
+  return generation;
 }
 
-void write_closure_to_dmg(ObjPtr obj, char const* filename) {
-  FILE* f = fopen(filename, "w");
-  print_closure_dmg(f, obj);
-  fclose(f);
+static std::mutex& closure_cache_lock(Object const* o) {
+  return closure_cache_locks[(reinterpret_cast<std::uintptr_t>(o) >> 4) % 64];
 }
 
 void add_use(ObjPtr by, int dir, ObjPtr of) {
   by->used.push_back(Use{dir, of});
+  GMOD_COUNT(uses, 1);
+  invalidate_closures();
 }
 
-void add_helper(ObjPtr to, ObjPtr h) { to->helpers.push_back(h); }
+void add_helper(ObjPtr to, ObjPtr h) {
+  to->helpers.push_back(h);
+  GMOD_COUNT(helpers, 1);
+  invalidate_closures();
+}
 
 std::vector<ObjPtr> get_closure(ObjPtr obj, bool include_helpers,
     bool include_embedded) {
-  std::vector<ObjPtr> queue;
-  queue.reserve(std::size_t(nlive_objects));
+  static thread_local ObjectIndex visited;
+  return get_closure(obj, include_helpers, include_embedded, visited);
+}
+
+/* the closure with embedded objects that the writers print, cached
+   on obj so that writing it as .geo and then .dmg traverses it once.
+   The search runs outside the lock; the result must not outlive
+   obj or the next topology change. */
+static std::vector<ObjPtr> write_closure(ObjPtr const& obj,
+    bool include_helpers) {
+  auto variant = include_helpers ? 1 : 0;
+  auto generation = observe_generation();
+  {
+    std::lock_guard<std::mutex> lock(closure_cache_lock(obj.get()));
+    auto cache = obj->closure_cache;
+    if (cache && cache->valid[variant] &&
+        cache->generation[variant] == generation) {
+      GMOD_COUNT(closure_cache_hits, 1);
+      return cache->closure[variant];
+    }
+  }
+  auto closure = get_closure(obj, include_helpers, true);
+  std::vector<ObjPtr> unowned;
+  unowned.reserve(closure.size());
+  for (auto const& co : closure) unowned.push_back(ObjPtr(ObjPtr(), co.get()));
+  std::lock_guard<std::mutex> lock(closure_cache_lock(obj.get()));
+  if (!obj->closure_cache) obj->closure_cache = new ClosureCache();
+  auto cache = obj->closure_cache;
+  cache->closure[variant] = unowned;
+  cache->valid[variant] = true;
+  cache->generation[variant] = generation;
+  return unowned;
+}
+
+/* breadth-first search from the objects already in the queue,
+   which must already be marked in visited */
+static void close_queue(std::vector<ObjPtr>& queue, bool include_helpers,
+    bool include_embedded, ObjectIndex& visited) {
+  GMOD_COUNT(closure_traversals, 1);
   std::size_t first = 0;
-  queue.push_back(obj);
   while (first != queue.size()) {
-    ObjPtr current = queue[first++];
-    for (auto use : current->used) {
-      auto child = use.obj;
-      if (child->scratch == -1) {
-        child->scratch = 1;
-        queue.push_back(child);
-      }
+    /* queue owns current; growing it only moves the ObjPtr */
+    Object* current = queue[first++].get();
+    for (auto const& use : current->used) {
+      auto const& child = use.obj;
+      if (visited.insert(child.get(), 0)) queue.push_back(child);
     }
     if (include_helpers) {
-      for (auto child : current->helpers) {
-        if (child->scratch == -1) {
-          child->scratch = 1;
-          queue.push_back(child);
-        }
+      for (auto const& child : current->helpers) {
+        if (visited.insert(child.get(), 0)) queue.push_back(child);
       }
     }
     if (include_embedded) {
-      for (auto child : current->embedded) {
-        if (child->scratch == -1) {
-          child->scratch = 1;
-          queue.push_back(child);
-        }
+      for (auto const& child : current->embedded) {
+        if (visited.insert(child.get(), 0)) queue.push_back(child);
       }
     }
   }
-  for (std::size_t i = 0; i < queue.size(); ++i) queue[i]->scratch = -1;
   std::reverse(queue.begin(), queue.end());
-  return queue;
-}
-
-std::vector<ObjPtr> filter_by_dim(std::vector<ObjPtr> const& objs, int dim) {
-  std::vector<ObjPtr> out;
-  for (auto obj : objs) if (type_dims[obj->type] == dim) out.push_back(obj);
-  return out;
-}
-
-std::vector<PointPtr> filter_points(std::vector<ObjPtr> const& objs) {
-  auto point_objs = filter_by_dim(objs, 0);
-  std::vector<PointPtr> points;
-  for (auto obj : point_objs) {
-    points.push_back(std::dynamic_pointer_cast<Point>(obj));
-  }
-  return points;
 }
 
-Point::Point() : Object(POINT) {}
-
-Point::~Point() {}
-
-PointPtr new_point() { return PointPtr(new Point()); }
-
-double default_size = 0.1;
+/* closures smaller than this grow their index faster than a lock */
+static std::size_t const closure_hint_threshold = 4096;
 
-PointPtr new_point2(Vector v) {
-  PointPtr p = new_point();
-  p->pos = v;
-  p->size = default_size;
-  return p;
+static std::size_t closure_size_hint(Object* o) {
+  std::lock_guard<std::mutex> lock(closure_cache_lock(o));
+  return o->closure_cache ? o->closure_cache->size_hint : 0;
 }
 
-PointPtr new_point3(Vector v, double size) {
-  PointPtr p = new_point();
-  p->pos = v;
-  p->size = size;
-  return p;
+static void record_closure_size(Object* o, std::size_t size) {
+  std::lock_guard<std::mutex> lock(closure_cache_lock(o));
+  if (!o->closure_cache) o->closure_cache = new ClosureCache();
+  o->closure_cache->size_hint = size;
 }
 
-std::vector<PointPtr> new_points(std::vector<Vector> vs) {
-  std::vector<PointPtr> out;
-  for (auto vec : vs) out.push_back(new_point2(vec));
-  return out;
+std::vector<ObjPtr> get_closure(ObjPtr obj, bool include_helpers,
+    bool include_embedded, ObjectIndex& visited) {
+  visited.clear();
+  auto hint = closure_size_hint(obj.get());
+  visited.reserve(hint);
+  std::vector<ObjPtr> queue;
+  queue.reserve(hint);
+  queue.push_back(obj);
+  visited.insert(obj.get(), 0);
+  close_queue(queue, include_helpers, include_embedded, visited);
+  if (queue.size() >= closure_hint_threshold && queue.size() != hint)
+    record_closure_size(obj.get(), queue.size());
+  return queue;
 }
 
-void print_point(FILE* f, PointPtr p) {
-  fprintf(f, "Point(%u) = {%f,%f,%f,%f};\n", p->id, p->pos.x, p->pos.y,
-          p->pos.z, p->size);
+/* the union of the closures of several objects, each object
+   appearing once */
+static std::vector<ObjPtr> get_closure_of_all(
+    std::vector<ObjPtr> const& objs, bool include_helpers,
+    bool include_embedded, ObjectIndex& visited) {
+  visited.clear();
+  std::vector<ObjPtr> queue;
+  for (auto const& obj : objs)
+    if (visited.insert(obj.get(), 0)) queue.push_back(obj);
+  close_queue(queue, include_helpers, include_embedded, visited);
+  return queue;
 }
 
-Extruded extrude_point(PointPtr start, Vector v) {
-  return extrude_point2(start, [=](Vector a){return a + v;});
-}
+/* The prototype closure an instance copies: `objects` in the order
+   that numbers the copy, with `indices` holding each one's position,
+   and `entities` without helpers, as the physical groups and the
+   .dmg cover them. */
+struct PrototypeLayout {
+  std::vector<ObjPtr> objects;
+  std::vector<ObjPtr> entities;
+  ObjectIndex indices;
+  long long dim_counts[4];
+};
 
-Extruded extrude_point2(PointPtr start, Transform tr) {
-  PointPtr end = new_point3(tr(start->pos), start->size);
-  ObjPtr middle = new_line2(start, end);
-  return Extruded{middle, end};
+static void lay_out_prototype(ObjPtr const& prototype,
+    PrototypeLayout& layout) {
+  ObjectIndex visited;
+  layout.entities = get_closure(prototype, false, true, visited);
+  layout.objects = get_closure(prototype, true, true, layout.indices);
+  for (std::size_t i = 0; i < layout.objects.size(); ++i)
+    layout.indices.assign(layout.objects[i].get(), static_cast<int>(i));
+  for (int d = 0; d < 4; ++d)
+    layout.dim_counts[d] = count_of_dim(layout.entities, d);
 }
 
-std::vector<Extruded> extrude_points(std::vector<PointPtr> const& points,
-    Transform tr) {
-  std::vector<Extruded> extrusions;
-  int i = 0;
-  for (auto point : points) {
-    extrusions.push_back(extrude_point2(point, tr));
-    point->scratch = i++;
+static void check_layout(Instance const* instance,
+    PrototypeLayout const& layout) {
+  if (std::size_t(instance->id - instance->first_id + 1) !=
+      layout.objects.size()) {
+    fprintf(stderr, "the prototype of instance %d changed size\n",
+        instance->id);
+    abort();
   }
-  return extrusions;
 }
 
-PointPtr edge_point(ObjPtr edge, int i) {
-  auto o = edge->used[std::size_t(i)].obj;
-  return std::dynamic_pointer_cast<Point>(o);
-}
+/* layouts of the distinct prototypes of the instances in a closure */
+struct InstanceLayouts {
+  InstanceLayouts(std::vector<ObjPtr> const& closure) {
+    std::vector<ObjPtr> prototypes;
+    for (auto const& co : closure) {
+      if (co->type != INSTANCE) continue;
+      auto const& prototype = as_instance(co.get())->prototype;
+      if (which.insert(prototype.get(), int(prototypes.size())))
+        prototypes.push_back(prototype);
+    }
+    for (std::size_t i = 0; i < prototypes.size(); ++i)
+      layouts.emplace_back(new PrototypeLayout());
+    parallel_for(prototypes.size(), [&](std::size_t i) {
+      lay_out_prototype(prototypes[i], *layouts[i]);
+    });
+    for (auto const& co : closure)
+      if (co->type == INSTANCE) check_layout(as_instance(co.get()), of(co.get()));
+  }
+  PrototypeLayout const& of(Object* instance) const {
+    auto i = which.find(as_instance(instance)->prototype.get());
+    return *layouts[std::size_t(i)];
+  }
+  bool empty() const { return layouts.empty(); }
+  ObjectIndex which;
+  std::vector<std::unique_ptr<PrototypeLayout>> layouts;
+};
 
-ObjPtr new_line() { return new_object(LINE); }
+/* numbers the objects of a prototype as those of an instance's
+   copy, from first_id */
+struct InstanceNumbering : public ObjectView {
+  InstanceNumbering(Instance const* instance, PrototypeLayout const* layout,
+      int first_id)
+      : instance(instance), layout(layout), first_id(first_id) {}
+  Instance const* instance;
+  PrototypeLayout const* layout;
+  int first_id;
+  int id(Object const* o) const {
+    return first_id + layout->indices.find(o);
+  }
+  Vector pos(Object const* p) const {
+    return add_vectors(matrix_vector_product(instance->linear,
+        static_cast<Point const*>(p)->pos), instance->translation);
+  }
+};
 
-ObjPtr new_line2(PointPtr start, PointPtr end) {
-  ObjPtr l = new_line();
-  add_use(l, FORWARD, start);
-  add_use(l, FORWARD, end);
-  return l;
+static void print_instance(Writer& w, Object* instance,
+    PrototypeLayout const& layout, int first_id) {
+  InstanceNumbering num{as_instance(instance), &layout, first_id};
+  for (auto const& o : layout.objects) print_object_t(w, o.get(), num);
 }
 
-ObjPtr new_line3(Vector origin, Vector span) {
-  return extrude_point(new_point2(origin), span).middle;
+static void print_instance_physical(Writer& w, Object* instance,
+    PrototypeLayout const& layout, int first_id) {
+  InstanceNumbering num{as_instance(instance), &layout, first_id};
+  for (auto const& o : layout.entities)
+    print_object_physical_t(w, o.get(), num);
 }
 
-ObjPtr new_line4(Vector a, Vector b) {
-  return new_line3(a, b - a);
+static void print_instance_dmg(Writer& w, Object* instance,
+    PrototypeLayout const& layout, int first_id, int dim) {
+  InstanceNumbering num{as_instance(instance), &layout, first_id};
+  for (auto const& o : layout.entities)
+    if (is_entity(o->type) && type_dims[o->type] == dim)
+      print_object_dmg_t(w, o.get(), num);
 }
 
-ObjPtr new_arc() { return new_object(ARC); }
-
-ObjPtr new_arc2(PointPtr start, PointPtr center, PointPtr end) {
-  ObjPtr a = new_arc();
-  add_use(a, FORWARD, start);
-  add_helper(a, center);
-  add_use(a, FORWARD, end);
-  return a;
+void print_object(Writer& w, ObjPtr const& obj) {
+  if (obj->type == INSTANCE) {
+    InstanceLayouts layouts(std::vector<ObjPtr>(1, obj));
+    print_instance(w, obj.get(), layouts.of(obj.get()),
+        as_instance(obj)->first_id);
+    return;
+  }
+  print_object_t(w, obj.get(), OwnNumbering());
 }
 
-PointPtr arc_center(ObjPtr arc) {
-  return std::dynamic_pointer_cast<Point>(arc->helpers[0]);
+void print_object(FILE* f, ObjPtr obj) {
+  FileSink sink(f);
+  Writer w(sink, 256);
+  print_object(w, obj);
 }
 
-Vector arc_normal(ObjPtr arc) {
-  return normalize_vector(cross_product(
-      subtract_vectors(edge_point(arc, 0)->pos, arc_center(arc)->pos),
-      subtract_vectors(edge_point(arc, 1)->pos, arc_center(arc)->pos)));
+void print_object_physical(Writer& w, ObjPtr const& obj) {
+  if (obj->type == INSTANCE) {
+    InstanceLayouts layouts(std::vector<ObjPtr>(1, obj));
+    print_instance_physical(w, obj.get(), layouts.of(obj.get()),
+        as_instance(obj)->first_id);
+    return;
+  }
+  print_object_physical_t(w, obj.get(), OwnNumbering());
 }
 
-void print_arc(FILE* f, ObjPtr arc) {
-  fprintf(f, "%s(%u) = {%u,%u,%u};\n", type_names[arc->type], arc->id,
-          edge_point(arc, 0)->id, arc_center(arc)->id, edge_point(arc, 1)->id);
+void print_object_physical(FILE* f, ObjPtr obj) {
+  FileSink sink(f);
+  Writer w(sink, 256);
+  print_object_physical(w, obj);
 }
 
-ObjPtr new_ellipse() { return new_object(ELLIPSE); }
+enum { PRINT_CHUNK_SIZE = 4096 };
 
-ObjPtr new_ellipse2(PointPtr start, PointPtr center, PointPtr major_pt,
-                    PointPtr end) {
-  ObjPtr e = new_ellipse();
+/* Prints items [0, n) in order. With more than one thread, rounds
+   of fixed-size chunks are formatted into separate buffers on the
+   thread pool and then written out in chunk order, so the output
+   is the same as the serial one. */
+static void print_in_chunks(Writer& w, std::size_t n,
+    std::function<void(Writer&, std::size_t)> const& print) {
+  auto nthreads = std::size_t(resolved_num_threads());
+  if (nthreads == 1 || n <= PRINT_CHUNK_SIZE) {
+    for (std::size_t i = 0; i < n; ++i) print(w, i);
+    return;
+  }
+  auto nchunks = (n + PRINT_CHUNK_SIZE - 1) / PRINT_CHUNK_SIZE;
+  auto round_size = 4 * nthreads;
+  std::vector<BufferSink> buffers(round_size);
+  for (std::size_t first = 0; first < nchunks; first += round_size) {
+    auto nround = std::min(round_size, nchunks - first);
+    parallel_for(nround, [&](std::size_t c) {
+      auto& buffer = buffers[c].buffer;
+      buffer.clear();
+      Writer cw(buffers[c], std::size_t(64) << 10);
+      auto begin = (first + c) * PRINT_CHUNK_SIZE;
+      auto end = std::min(begin + PRINT_CHUNK_SIZE, n);
+      for (auto i = begin; i < end; ++i) print(cw, i);
+    });
+    for (std::size_t c = 0; c < nround; ++c) {
+      w.put(buffers[c].buffer.data(), buffers[c].buffer.size());
+    }
+  }
+}
+
+std::vector<SizeField> size_fields;
+
+static void print_size_fields(Writer& w) {
+  if (size_fields.empty()) return;
+  auto field_line = [&](std::size_t i) {
+    w.put("Field[");
+    w.put_int(static_cast<long long>(i + 1));
+    w.put(']');
+  };
+  for (std::size_t i = 0; i < size_fields.size(); ++i) {
+    field_line(i);
+    w.put(" = ");
+    w.put(size_fields[i].type.c_str());
+    w.put(";\n");
+    for (auto const& option : size_fields[i].options) {
+      field_line(i);
+      w.put('.');
+      w.put(option.first.c_str());
+      w.put(" = ");
+      w.put(option.second.c_str());
+      w.put(";\n");
+    }
+  }
+  auto background = size_fields.size();
+  if (size_fields.size() > 1) {
+    field_line(background);
+    w.put(" = Min;\n");
+    field_line(background);
+    w.put(".FieldsList = {");
+    for (std::size_t i = 0; i < size_fields.size(); ++i) {
+      if (i) w.put(", ");
+      w.put_int(static_cast<long long>(i + 1));
+    }
+    w.put("};\n");
+    ++background;
+  }
+  w.put("Background Field = ");
+  w.put_int(static_cast<long long>(background));
+  w.put(";\n");
+}
+
+/* numbers a closure from zero in closure order for one write,
+   an instance taking up the ids of its whole copy; the objects
+   keep their own ids */
+struct CompactNumbering : public ObjectView {
+  CompactNumbering(std::vector<ObjPtr> const& closure) {
+    ids.reserve(closure.size());
+    int next = 0;
+    for (auto const& co : closure) {
+      if (co->type == INSTANCE) {
+        auto instance = as_instance(co);
+        next += instance->id - instance->first_id + 1;
+      } else {
+        ++next;
+      }
+      ids.insert(co.get(), next - 1);
+    }
+  }
+  int id(Object const* o) const { return ids.find(o); }
+  Vector pos(Object const* p) const {
+    return static_cast<Point const*>(p)->pos;
+  }
+  int first_id(Object* o) const {
+    auto instance = as_instance(o);
+    return id(o) - (instance->id - instance->first_id);
+  }
+  ObjectIndex ids;
+};
+
+struct OwnInstanceNumbering : public OwnNumbering {
+  int first_id(Object* o) const { return as_instance(o)->first_id; }
+};
+
+template <class Numbering>
+static void print_closure_t(Writer& w, std::vector<ObjPtr> const& closure,
+    std::vector<ObjPtr> const& entities, InstanceLayouts const& layouts,
+    Numbering const& num) {
+  print_in_chunks(w, closure.size(), [&](Writer& cw, std::size_t i) {
+    auto co = closure[i].get();
+    if (co->type == INSTANCE)
+      print_instance(cw, co, layouts.of(co), num.first_id(co));
+    else
+      print_object_t(cw, co, num);
+  });
+  print_in_chunks(w, entities.size(), [&](Writer& cw, std::size_t i) {
+    auto co = entities[i].get();
+    if (co->type == INSTANCE)
+      print_instance_physical(cw, co, layouts.of(co), num.first_id(co));
+    else
+      print_object_physical_t(cw, co, num);
+  });
+}
+
+void print_closure(Writer& w, ObjPtr obj, bool compact_ids) {
+  GMOD_TIME(STATS_WRITE);
+  auto closure = write_closure(obj, true);
+  auto entities = write_closure(obj, false);
+  InstanceLayouts layouts(closure);
+  if (compact_ids)
+    print_closure_t(w, closure, entities, layouts, CompactNumbering(closure));
+  else
+    print_closure_t(w, closure, entities, layouts, OwnInstanceNumbering());
+  print_size_fields(w);
+}
+
+void print_closure(FILE* f, ObjPtr obj) {
+  FileSink sink(f);
+  Writer w(sink);
+  print_closure(w, obj);
+}
+
+/* feeds what o's .geo record is made from to put, one value at
+   a time */
+template <class Put>
+static void geo_signature(Object const* o, Put& put) {
+  put(o->type);
+  put(o->id);
+  if (o->type == POINT) {
+    auto p = static_cast<Point const*>(o);
+    double const values[4] = {p->pos.x, p->pos.y, p->pos.z, p->size};
+    for (auto x : values) {
+      long long bits;
+      std::memcpy(&bits, &x, sizeof(bits));
+      put(bits);
+    }
+    return;
+  }
+  put(static_cast<long long>(o->used.size()));
+  for (auto const& use : o->used) {
+    put(use.dir);
+    put(use.obj->id);
+  }
+  put(static_cast<long long>(o->helpers.size()));
+  for (auto const& h : o->helpers) put(h->id);
+  for (auto const& e : o->embedded) {
+    put(e->type);
+    put(e->id);
+  }
+}
+
+/* compares a signature with a stored one as it is fed in */
+struct SignatureMatch {
+  long long const* next;
+  long long const* end;
+  bool same;
+  void operator()(long long value) {
+    same = same && next != end && *next++ == value;
+  }
+};
+
+static bool same_signature(GeoCache const& cache,
+    GeoCache::Entry const& entry, Object const* o) {
+  auto first = cache.signatures.data() + entry.signature;
+  SignatureMatch match{first, first + entry.signature_size, true};
+  geo_signature(o, match);
+  return match.same && match.next == match.end;
+}
+
+/* keeps only the records of the objects in closure, in closure
+   order, once stale text outweighs the live text */
+static void compact_geo_cache(GeoCache& cache,
+    std::vector<ObjPtr> const& closure, std::size_t live) {
+  if (cache.text.size() <= 2 * live + 4096 &&
+      cache.entries.size() <= 2 * closure.size() + 64)
+    return;
+  GeoCache next;
+  next.index.reserve(closure.size());
+  next.entries.reserve(closure.size());
+  next.text.reserve(live);
+  auto copy = [&](std::size_t& first, std::size_t size) {
+    if (first == std::string::npos) return;
+    auto from = first;
+    first = next.text.size();
+    next.text.append(cache.text, from, size);
+  };
+  for (auto const& co : closure) {
+    auto i = cache.index.find(co.get());
+    if (i < 0) continue;
+    auto entry = cache.entries[std::size_t(i)];
+    copy(entry.text, entry.text_size);
+    copy(entry.physical, entry.physical_size);
+    auto sig = cache.signatures.begin() + std::ptrdiff_t(entry.signature);
+    entry.signature = next.signatures.size();
+    next.signatures.insert(next.signatures.end(), sig,
+        sig + std::ptrdiff_t(entry.signature_size));
+    next.index.insert(co.get(), static_cast<int>(next.entries.size()));
+    next.entries.push_back(entry);
+  }
+  next.reused = cache.reused;
+  next.formatted = cache.formatted;
+  cache = std::move(next);
+}
+
+/* Records are kept in place from one print to the next: a record
+   whose inputs changed is formatted again and appended, and the
+   cache is compacted once stale records pile up. An unchanged
+   record costs a lookup, a comparison and a copy. */
+void print_closure(Writer& w, ObjPtr obj, GeoCache& cache) {
+  GMOD_TIME(STATS_WRITE);
+  auto closure = write_closure(obj, true);
+  InstanceLayouts layouts(closure);
+  cache.reused = 0;
+  cache.formatted = 0;
+  BufferSink scratch;
+  Writer sw(scratch, 4096);
+  std::size_t live = 0;
+  /* appends the text print formats to the cache, returning where */
+  auto format = [&](std::function<void(Writer&)> const& print) {
+    scratch.buffer.clear();
+    print(sw);
+    sw.flush();
+    auto first = cache.text.size();
+    cache.text += scratch.buffer;
+    ++cache.formatted;
+    return first;
+  };
+  auto put = [&](std::size_t first, std::size_t size) {
+    w.put(cache.text.data() + first, size);
+    live += size;
+  };
+  std::vector<long long> sig;
+  auto push = [&](long long value) { sig.push_back(value); };
+  /* the entries of an unchanged closure come in closure order */
+  std::size_t k = 0;
+  for (auto const& co : closure) {
+    if (co->type == INSTANCE) {
+      print_instance(w, co.get(), layouts.of(co.get()),
+          as_instance(co)->first_id);
+      continue;
+    }
+    int i = -1;
+    if (k < cache.entries.size() && cache.entries[k].object == co.get())
+      i = static_cast<int>(k);
+    else
+      i = cache.index.find(co.get());
+    ++k;
+    if (i >= 0 && same_signature(cache, cache.entries[std::size_t(i)],
+                                 co.get())) {
+      auto const& entry = cache.entries[std::size_t(i)];
+      ++cache.reused;
+      put(entry.text, entry.text_size);
+      continue;
+    }
+    if (i < 0) {
+      i = static_cast<int>(cache.entries.size());
+      cache.index.insert(co.get(), i);
+      cache.entries.push_back(GeoCache::Entry{co.get(), 0, 0,
+          std::string::npos, 0, 0, 0});
+    }
+    sig.clear();
+    geo_signature(co.get(), push);
+    auto first = format([&](Writer& cw) {
+      print_object_t(cw, co.get(), OwnNumbering());
+    });
+    auto& entry = cache.entries[std::size_t(i)];
+    entry.text = first;
+    entry.text_size = cache.text.size() - first;
+    /* the physical record depends only on the type and id */
+    if (entry.signature_size < 2 ||
+        cache.signatures[entry.signature] != sig[0] ||
+        cache.signatures[entry.signature + 1] != sig[1])
+      entry.physical = std::string::npos;
+    if (entry.signature_size < sig.size())
+      entry.signature = cache.signatures.size();
+    if (entry.signature == cache.signatures.size())
+      cache.signatures.insert(cache.signatures.end(), sig.begin(), sig.end());
+    else
+      std::copy(sig.begin(), sig.end(),
+          cache.signatures.begin() + std::ptrdiff_t(entry.signature));
+    entry.signature_size = sig.size();
+    put(entry.text, entry.text_size);
+  }
+  /* the entities are the closure without helpers, so their entries
+     are usually a few apart */
+  k = 0;
+  for (auto const& co : write_closure(obj, false)) {
+    if (co->type == INSTANCE) {
+      print_instance_physical(w, co.get(), layouts.of(co.get()),
+          as_instance(co)->first_id);
+      continue;
+    }
+    auto j = k;
+    while (j < cache.entries.size() && j < k + 4 &&
+           cache.entries[j].object != co.get())
+      ++j;
+    if (j < cache.entries.size() && cache.entries[j].object == co.get())
+      k = j + 1;
+    else
+      j = std::size_t(cache.index.find(co.get()));
+    auto& entry = cache.entries[j];
+    if (entry.physical == std::string::npos) {
+      entry.physical = format([&](Writer& cw) {
+        print_object_physical_t(cw, co.get(), OwnNumbering());
+      });
+      entry.physical_size = cache.text.size() - entry.physical;
+    } else {
+      ++cache.reused;
+    }
+    put(entry.physical, entry.physical_size);
+  }
+  print_size_fields(w);
+  compact_geo_cache(cache, closure, live);
+}
+
+void write_closure_to_geo(ObjPtr obj, Sink& sink, bool compact_ids) {
+  GMOD_TIME(STATS_WRITE);
+  Writer w(sink);
+  print_closure(w, obj, compact_ids);
+}
+
+void write_closure_to_geo(ObjPtr obj, char const* filename,
+    bool compact_ids) {
+  FILE* f = fopen(filename, "w");
+  FileSink sink(f);
+  write_closure_to_geo(obj, sink, compact_ids);
+  fclose(f);
+}
+
+void write_closure_to_geo(ObjPtr obj, char const* filename, GeoCache& cache) {
+  GMOD_TIME(STATS_WRITE);
+  FILE* f = fopen(filename, "w");
+  FileSink sink(f);
+  {
+    Writer w(sink);
+    print_closure(w, obj, cache);
+  }
+  fclose(f);
+}
+
+void print_simple_object(Writer& w, ObjPtr const& obj) {
+  print_simple_object_t(w, obj.get(), OwnNumbering());
+}
+
+void print_simple_object(FILE* f, ObjPtr obj) {
+  FileSink sink(f);
+  Writer w(sink, 256);
+  print_simple_object(w, obj);
+}
+
+void print_object_dmg(Writer& w, ObjPtr const& obj) {
+  if (obj->type == INSTANCE) {
+    InstanceLayouts layouts(std::vector<ObjPtr>(1, obj));
+    for (int d = 0; d <= 3; ++d)
+      print_instance_dmg(w, obj.get(), layouts.of(obj.get()),
+          as_instance(obj)->first_id, d);
+    return;
+  }
+  print_object_dmg_t(w, obj.get(), OwnNumbering());
+}
+
+void print_object_dmg(FILE* f, ObjPtr obj) {
+  FileSink sink(f);
+  Writer w(sink, 256);
+  print_object_dmg(w, obj);
+}
+
+int count_of_type(std::vector<ObjPtr> const& objs, int type) {
+  int c = 0;
+  for (auto const& obj : objs)
+    if (obj->type == type) ++c;
+  return c;
+}
+
+int count_of_dim(std::vector<ObjPtr> const& objs, int dim) {
+  int c = 0;
+  for (auto const& obj : objs)
+    if (is_entity(obj->type) && type_dims[obj->type] == dim) ++c;
+  return c;
+}
+
+/* positions of the entities of each dimension, in closure order */
+static void bucket_by_dim(std::vector<ObjPtr> const& closure,
+    std::vector<std::size_t> (&buckets)[4]) {
+  for (std::size_t i = 0; i < closure.size(); ++i) {
+    auto dim = type_dims[closure[i]->type];
+    if (dim >= 0) buckets[dim].push_back(i);
+  }
+}
+
+/* each dimension lists the closure's own entities, then those of
+   the instances' copies */
+template <class Numbering>
+static void print_closure_dmg_t(Writer& w,
+    std::vector<ObjPtr> const& closure, Numbering const& num) {
+  std::vector<std::size_t> buckets[4];
+  bucket_by_dim(closure, buckets);
+  InstanceLayouts layouts(closure);
+  std::vector<Object*> instances;
+  for (auto const& co : closure)
+    if (co->type == INSTANCE) instances.push_back(co.get());
+  for (int d = 3; d >= 0; --d) {
+    auto count = static_cast<long long>(buckets[d].size());
+    for (auto instance : instances) count += layouts.of(instance).dim_counts[d];
+    w.put_int(count);
+    w.put(d ? ' ' : '\n');
+  }
+  w.put("0 0 0\n0 0 0\n", 12);
+  for (int d = 0; d <= 3; ++d) {
+    auto const& bucket = buckets[d];
+    print_in_chunks(w, bucket.size() + instances.size(),
+        [&](Writer& cw, std::size_t i) {
+      if (i < bucket.size()) {
+        print_object_dmg_t(cw, closure[bucket[i]].get(), num);
+      } else {
+        auto instance = instances[i - bucket.size()];
+        print_instance_dmg(cw, instance, layouts.of(instance),
+            num.first_id(instance), d);
+      }
+    });
+  }
+}
+
+/* compact ids come from the closure with helpers, as in the .geo */
+void print_closure_dmg(Writer& w, ObjPtr obj, bool compact_ids) {
+  GMOD_TIME(STATS_WRITE);
+  auto closure = write_closure(obj, false);
+  if (compact_ids)
+    print_closure_dmg_t(w, closure, CompactNumbering(write_closure(obj, true)));
+  else
+    print_closure_dmg_t(w, closure, OwnInstanceNumbering());
+}
+
+void print_closure_dmg(FILE* f, ObjPtr obj) {
+  FileSink sink(f);
+  Writer w(sink);
+  print_closure_dmg(w, obj);
+}
+
+void write_closure_to_dmg(ObjPtr obj, Sink& sink, bool compact_ids) {
+  GMOD_TIME(STATS_WRITE);
+  Writer w(sink);
+  print_closure_dmg(w, obj, compact_ids);
+}
+
+void write_closure_to_dmg(ObjPtr obj, char const* filename,
+    bool compact_ids) {
+  FILE* f = fopen(filename, "w");
+  FileSink sink(f);
+  write_closure_to_dmg(obj, sink, compact_ids);
+  fclose(f);
+}
+
+std::vector<ObjPtr> filter_by_dim(std::vector<ObjPtr> const& objs, int dim) {
+  std::vector<ObjPtr> out;
+  for (auto const& obj : objs)
+    if (type_dims[obj->type] == dim) out.push_back(obj);
+  return out;
+}
+
+std::vector<PointPtr> filter_points(std::vector<ObjPtr> const& objs) {
+  std::vector<PointPtr> points;
+  for (auto const& obj : objs)
+    if (obj->type == POINT) points.push_back(to_point(obj));
+  return points;
+}
+
+Point::Point() : Object(POINT) {}
+
+Point::~Point() {}
+
+PointPtr new_point() { return allocate_object<Point>(); }
+
+double default_size = 0.1;
+
+PointPtr new_point2(Vector v) {
+  PointPtr p = new_point();
+  p->pos = v;
+  p->size = default_size;
+  return p;
+}
+
+PointPtr new_point3(Vector v, double size) {
+  PointPtr p = new_point();
+  p->pos = v;
+  p->size = size;
+  return p;
+}
+
+double sample_size_grid(SizeGrid const& grid, Vector at) {
+  double const coords[3] = {(at.x - grid.origin.x) / grid.spacing.x,
+                            (at.y - grid.origin.y) / grid.spacing.y,
+                            (at.z - grid.origin.z) / grid.spacing.z};
+  int base[3];
+  double weight[3];
+  for (int d = 0; d < 3; ++d) {
+    auto top = grid.counts[d] - 1;
+    auto c = std::min(std::max(coords[d], 0.0), double(top));
+    base[d] = std::min(static_cast<int>(c), std::max(top - 1, 0));
+    weight[d] = top ? c - base[d] : 0;
+  }
+  auto at_node = [&](int i, int j, int k) {
+    i = std::min(i, grid.counts[0] - 1);
+    j = std::min(j, grid.counts[1] - 1);
+    k = std::min(k, grid.counts[2] - 1);
+    return grid.sizes[std::size_t(
+        (k * grid.counts[1] + j) * grid.counts[0] + i)];
+  };
+  double size = 0;
+  for (int corner = 0; corner < 8; ++corner) {
+    double w = 1;
+    int node[3];
+    for (int d = 0; d < 3; ++d) {
+      auto high = (corner >> d) & 1;
+      node[d] = base[d] + high;
+      w *= high ? weight[d] : 1 - weight[d];
+    }
+    if (w != 0) size += w * at_node(node[0], node[1], node[2]);
+  }
+  return size;
+}
+
+void set_sizes(ObjPtr root, SizeFunction const& size_of) {
+  for (auto const& co : get_closure(root, true, true)) {
+    if (co->type != POINT) continue;
+    auto p = as_point(co);
+    p->size = size_of(p->pos);
+  }
+}
+
+enum { SIZE_BLOCK = 1024 };
+
+void set_sizes_batch(ObjPtr root, BatchSizeFunction const& sizes_of) {
+  std::vector<Point*> points;
+  for (auto const& co : get_closure(root, true, true))
+    if (co->type == POINT) points.push_back(as_point(co));
+  auto nblocks = (points.size() + SIZE_BLOCK - 1) / SIZE_BLOCK;
+  parallel_for(nblocks, [&](std::size_t b) {
+    double x[SIZE_BLOCK], y[SIZE_BLOCK], z[SIZE_BLOCK], sizes[SIZE_BLOCK];
+    auto first = b * SIZE_BLOCK;
+    auto n = std::min(std::size_t(SIZE_BLOCK), points.size() - first);
+    auto block = points.data() + first;
+    for (std::size_t i = 0; i < n; ++i) {
+      x[i] = block[i]->pos.x;
+      y[i] = block[i]->pos.y;
+      z[i] = block[i]->pos.z;
+    }
+    sizes_of(x, y, z, n, sizes);
+    for (std::size_t i = 0; i < n; ++i) block[i]->size = sizes[i];
+  });
+}
+
+void set_sizes(ObjPtr root, SizeGrid const& grid) {
+  assert(grid.counts[0] > 0 && grid.counts[1] > 0 && grid.counts[2] > 0);
+  assert(grid.sizes.size() ==
+         std::size_t(grid.counts[0]) * std::size_t(grid.counts[1]) *
+         std::size_t(grid.counts[2]));
+  set_sizes_batch(root, [&](double const* x, double const* y,
+      double const* z, std::size_t n, double* sizes) {
+    for (std::size_t i = 0; i < n; ++i)
+      sizes[i] = sample_size_grid(grid, Vector{x[i], y[i], z[i]});
+  });
+}
+
+std::vector<PointPtr> new_points(std::vector<Vector> vs) {
+  std::vector<PointPtr> out;
+  for (auto vec : vs) out.push_back(new_point2(vec));
+  return out;
+}
+
+void print_point(Writer& w, PointPtr const& p) {
+  print_point_t(w, p.get(), OwnNumbering());
+}
+
+void print_point(FILE* f, PointPtr p) {
+  FileSink sink(f);
+  Writer w(sink, 256);
+  print_point(w, p);
+}
+
+Rotation::Rotation(Vector center_in, Vector axis, double angle)
+    : center(center_in), linear(rotation_matrix(axis, angle)) {}
+
+/* The extrusions are written once as templates over the transform,
+   and the public overloads below instantiate them for a Transform
+   and for each of the compile-time transforms. */
+
+template <class T>
+static Extruded extrude_point_t(PointPtr const& start, T const& tr) {
+  GMOD_TIME(STATS_EXTRUDE);
+  PointPtr end = new_point3(tr(start->pos), start->size);
+  ObjPtr middle = new_line2(start, end);
+  return Extruded{middle, end};
+}
+
+/* The typed transforms as x -> linear (x + shift) + translation,
+   for the batch kernel; the shift is applied first only for
+   rotations, so that each coordinate is rounded as by the
+   transform's own operator(). A Transform is opaque. */
+struct BatchAffine {
+  bool shifted;
+  Vector shift;
+  Matrix linear;
+  Vector translation;
+};
+
+static bool as_batch_affine(Translation const& tr, BatchAffine& a) {
+  a = BatchAffine{false, Vector{0, 0, 0},
+      Matrix{Vector{1, 0, 0}, Vector{0, 1, 0}, Vector{0, 0, 1}}, tr.v};
+  return true;
+}
+
+static bool as_batch_affine(Affine const& tr, BatchAffine& a) {
+  a = BatchAffine{false, Vector{0, 0, 0}, tr.linear, tr.translation};
+  return true;
+}
+
+static bool as_batch_affine(Rotation const& tr, BatchAffine& a) {
+  a = BatchAffine{true, scale_vector(-1, tr.center), tr.linear, tr.center};
+  return true;
+}
+
+static bool as_batch_affine(Transform const&, BatchAffine&) { return false; }
+
+/* the end points start as copies of the start points and are then
+   moved together by the batch kernel, unless tr is a Transform */
+template <class T>
+static std::vector<Extruded> extrude_points_t(
+    std::vector<PointPtr> const& points, T const& tr, ObjectIndex& indices) {
+  GMOD_TIME(STATS_EXTRUDE);
+  auto n = points.size();
+  BatchAffine affine;
+  auto batched = as_batch_affine(tr, affine);
+  std::vector<Point*> ends;
+  ends.reserve(n);
+  std::vector<Extruded> extrusions;
+  extrusions.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    auto pos = points[i]->pos;
+    if (!batched) pos = tr(pos);
+    else if (affine.shifted) pos = add_vectors(pos, affine.shift);
+    PointPtr end = new_point3(pos, points[i]->size);
+    ends.push_back(end.get());
+    ObjPtr middle = new_line2(points[i], end);
+    extrusions.push_back(Extruded{middle, end});
+    indices.assign(points[i].get(), static_cast<int>(i));
+  }
+  if (batched)
+    transform_points(ends.data(), n, affine.linear, affine.translation);
+  return extrusions;
+}
+
+Extruded extrude_point(PointPtr start, Vector v) {
+  GMOD_TIME(STATS_EXTRUDE);
+  return extrude_point_t(start, Translation{v});
+}
+
+Extruded extrude_point2(PointPtr start, Transform tr) {
+  return extrude_point_t(start, tr);
+}
+
+Extruded extrude_point2(PointPtr start, Translation tr) {
+  return extrude_point_t(start, tr);
+}
+
+Extruded extrude_point2(PointPtr start, Affine tr) {
+  return extrude_point_t(start, tr);
+}
+
+Extruded extrude_point2(PointPtr start, Rotation tr) {
+  return extrude_point_t(start, tr);
+}
+
+std::vector<Extruded> extrude_points(std::vector<PointPtr> const& points,
+    Transform tr, ObjectIndex& indices) {
+  return extrude_points_t(points, tr, indices);
+}
+
+PointPtr edge_point(ObjPtr const& edge, int i) {
+  return to_point(edge->used[std::size_t(i)].obj);
+}
+
+ObjPtr new_line() { return new_object(LINE); }
+
+ObjPtr new_line2(PointPtr start, PointPtr end) {
+  ObjPtr l = new_line();
+  add_use(l, FORWARD, start);
+  add_use(l, FORWARD, end);
+  return l;
+}
+
+ObjPtr new_line3(Vector origin, Vector span) {
+  return extrude_point(new_point2(origin), span).middle;
+}
+
+ObjPtr new_line4(Vector a, Vector b) {
+  return new_line3(a, b - a);
+}
+
+ObjPtr new_arc() { return new_object(ARC); }
+
+ObjPtr new_arc2(PointPtr start, PointPtr center, PointPtr end) {
+  ObjPtr a = new_arc();
+  add_use(a, FORWARD, start);
+  add_helper(a, center);
+  add_use(a, FORWARD, end);
+  return a;
+}
+
+PointPtr arc_center(ObjPtr const& arc) {
+  assert(arc->type == ARC);
+  return to_point(arc->helpers[0]);
+}
+
+static Vector arc_normal_view(Object const* arc) {
+  auto c = arc_center_view(arc)->pos;
+  return normalize_vector(cross_product(
+      subtract_vectors(edge_point_view(arc, 0)->pos, c),
+      subtract_vectors(edge_point_view(arc, 1)->pos, c)));
+}
+
+Vector arc_normal(ObjPtr const& arc) { return arc_normal_view(arc.get()); }
+
+void print_arc(Writer& w, ObjPtr const& arc) {
+  print_arc_t(w, arc.get(), OwnNumbering());
+}
+
+void print_arc(FILE* f, ObjPtr arc) {
+  FileSink sink(f);
+  Writer w(sink, 256);
+  print_arc(w, arc);
+}
+
+ObjPtr new_ellipse() { return new_object(ELLIPSE); }
+
+ObjPtr new_ellipse2(PointPtr start, PointPtr center, PointPtr major_pt,
+                    PointPtr end) {
+  ObjPtr e = new_ellipse();
   add_use(e, FORWARD, start);
   add_helper(e, center);
   add_helper(e, major_pt);
@@ -396,18 +1825,24 @@ ObjPtr new_ellipse2(PointPtr start, PointPtr center, PointPtr major_pt,
   return e;
 }
 
-PointPtr ellipse_center(ObjPtr e) {
-  return std::dynamic_pointer_cast<Point>(e->helpers[0]);
+PointPtr ellipse_center(ObjPtr const& e) {
+  assert(e->type == ELLIPSE);
+  return to_point(e->helpers[0]);
+}
+
+PointPtr ellipse_major_pt(ObjPtr const& e) {
+  assert(e->type == ELLIPSE);
+  return to_point(e->helpers[1]);
 }
 
-PointPtr ellipse_major_pt(ObjPtr e) {
-  return std::dynamic_pointer_cast<Point>(e->helpers[1]);
+void print_ellipse(Writer& w, ObjPtr const& e) {
+  print_ellipse_t(w, e.get(), OwnNumbering());
 }
 
 void print_ellipse(FILE* f, ObjPtr e) {
-  fprintf(f, "%s(%u) = {%u,%u,%u,%u};\n", type_names[e->type], e->id,
-          edge_point(e, 0)->id, ellipse_center(e)->id, ellipse_major_pt(e)->id,
-          edge_point(e, 1)->id);
+  FileSink sink(f);
+  Writer w(sink, 256);
+  print_ellipse(w, e);
 }
 
 ObjPtr new_spline() { return new_object(SPLINE); }
@@ -427,62 +1862,63 @@ ObjPtr new_spline3(std::vector<Vector> const& pts) {
   return new_spline2(pts2);
 }
 
+void print_spline(Writer& w, ObjPtr const& e) {
+  print_spline_t(w, e.get(), OwnNumbering());
+}
+
 void print_spline(FILE* f, ObjPtr e) {
-  fprintf(f, "%s(%u) = {%u,", type_names[e->type], e->id, edge_point(e, 0)->id);
-  for (auto h : e->helpers) fprintf(f, "%u,", h->id);
-  fprintf(f, "%u};\n", edge_point(e, 1)->id);
+  FileSink sink(f);
+  Writer w(sink, 256);
+  print_spline(w, e);
 }
 
 Extruded extrude_edge(ObjPtr start, Vector v) {
+  GMOD_TIME(STATS_EXTRUDE);
   Extruded left = extrude_point(edge_point(start, 0), v);
   Extruded right = extrude_point(edge_point(start, 1), v);
   return extrude_edge2(start, v, left, right);
 }
 
-Extruded extrude_edge2(ObjPtr start, Vector v, Extruded left, Extruded right) {
-  return extrude_edge3(start, [=](Vector a){return a + v;}, left, right);
-}
-
-Extruded extrude_edge3(ObjPtr start, Transform tr, Extruded left, Extruded right) {
+template <class T>
+static Extruded extrude_edge_t(ObjPtr const& start, T const& tr,
+    Extruded const& left, Extruded const& right) {
+  GMOD_TIME(STATS_EXTRUDE);
   auto loop = new_loop();
   add_use(loop, FORWARD, start);
   add_use(loop, FORWARD, right.middle);
   ObjPtr end = nullptr;
   switch (start->type) {
     case LINE: {
-      end = new_line2(std::dynamic_pointer_cast<Point>(left.end),
-                      std::dynamic_pointer_cast<Point>(right.end));
+      end = new_line2(to_point(left.end), to_point(right.end));
       break;
     }
     case ARC: {
-      PointPtr start_center = arc_center(start);
+      auto start_center = arc_center_view(start.get());
       PointPtr end_center =
           new_point3(tr(start_center->pos), start_center->size);
-      end = new_arc2(std::dynamic_pointer_cast<Point>(left.end), end_center,
-                     std::dynamic_pointer_cast<Point>(right.end));
+      end = new_arc2(to_point(left.end), end_center, to_point(right.end));
       break;
     }
     case ELLIPSE: {
-      PointPtr start_center = ellipse_center(start);
+      auto start_center = ellipse_center_view(start.get());
       PointPtr end_center =
           new_point3(tr(start_center->pos), start_center->size);
-      PointPtr start_major_pt = ellipse_major_pt(start);
+      auto start_major_pt = ellipse_major_pt_view(start.get());
       PointPtr end_major_pt =
           new_point3(tr(start_major_pt->pos), start_major_pt->size);
-      end = new_ellipse2(std::dynamic_pointer_cast<Point>(left.end), end_center,
-                         end_major_pt,
-                         std::dynamic_pointer_cast<Point>(right.end));
+      end = new_ellipse2(to_point(left.end), end_center, end_major_pt,
+                         to_point(right.end));
       break;
     }
     case SPLINE: {
       std::vector<PointPtr> end_pts;
-      end_pts.push_back(std::dynamic_pointer_cast<Point>(left.end));
-      for (auto h : start->helpers) {
-        auto start_h = std::dynamic_pointer_cast<Point>(h);
-        auto end_h = new_point3(tr(start_h->pos), start_h->size);
-        end_pts.push_back(end_h);
+      end_pts.reserve(start->helpers.size() + 2);
+      end_pts.push_back(to_point(left.end));
+      for (auto const& h : start->helpers) {
+        auto start_h = as_point(h);
+        end_pts.push_back(new_point3(tr(start_h->pos), start_h->size));
       }
-      end_pts.push_back(std::dynamic_pointer_cast<Point>(right.end));
+      end_pts.push_back(to_point(right.end));
       end = new_spline2(end_pts);
       break;
     }
@@ -509,58 +1945,116 @@ Extruded extrude_edge3(ObjPtr start, Transform tr, Extruded left, Extruded right
   return Extruded{middle, end};
 }
 
-std::vector<Extruded> extrude_edges(std::vector<ObjPtr> const& edges,
-    Transform tr, std::vector<Extruded> const& point_extrusions) {
-  std::vector<Extruded> edge_extrusions;
-  int i = 0;
-  for (auto edge : edges) {
-    edge_extrusions.push_back(
-        extrude_edge3(edge, tr,
-          at(point_extrusions, edge_point(edge, 0)->scratch),
-          at(point_extrusions, edge_point(edge, 1)->scratch)));
-    edge->scratch = i++;
-  }
-  return edge_extrusions;
+Extruded extrude_edge2(ObjPtr start, Vector v, Extruded left, Extruded right) {
+  GMOD_TIME(STATS_EXTRUDE);
+  return extrude_edge_t(start, Translation{v}, left, right);
+}
+
+Extruded extrude_edge3(ObjPtr start, Transform tr, Extruded const& left,
+    Extruded const& right) {
+  return extrude_edge_t(start, tr, left, right);
+}
+
+Extruded extrude_edge3(ObjPtr start, Translation tr, Extruded const& left,
+    Extruded const& right) {
+  return extrude_edge_t(start, tr, left, right);
+}
+
+Extruded extrude_edge3(ObjPtr start, Affine tr, Extruded const& left,
+    Extruded const& right) {
+  return extrude_edge_t(start, tr, left, right);
+}
+
+Extruded extrude_edge3(ObjPtr start, Rotation tr, Extruded const& left,
+    Extruded const& right) {
+  return extrude_edge_t(start, tr, left, right);
+}
+
+template <class T>
+static std::vector<Extruded> extrude_edges_t(std::vector<ObjPtr> const& edges,
+    T const& tr, std::vector<Extruded> const& point_extrusions,
+    ObjectIndex& indices) {
+  GMOD_TIME(STATS_EXTRUDE);
+  std::vector<Extruded> edge_extrusions;
+  int i = 0;
+  edge_extrusions.reserve(edges.size());
+  for (auto const& edge : edges) {
+    edge_extrusions.push_back(
+        extrude_edge_t(edge, tr,
+          at(point_extrusions, indices.find(edge_point_view(edge.get(), 0))),
+          at(point_extrusions, indices.find(edge_point_view(edge.get(), 1)))));
+    indices.assign(edge.get(), i++);
+  }
+  return edge_extrusions;
+}
+
+std::vector<Extruded> extrude_edges(std::vector<ObjPtr> const& edges,
+    Transform tr, std::vector<Extruded> const& point_extrusions,
+    ObjectIndex& indices) {
+  return extrude_edges_t(edges, tr, point_extrusions, indices);
 }
 
 ObjPtr new_loop() { return new_object(LOOP); }
 
-std::vector<PointPtr> loop_points(ObjPtr loop) {
+std::vector<PointPtr> loop_points(ObjPtr const& loop) {
   std::vector<PointPtr> points;
-  for (auto use : loop->used) points.push_back(edge_point(use.obj, use.dir));
+  points.reserve(loop->used.size());
+  for (auto const& use : loop->used)
+    points.push_back(edge_point(use.obj, use.dir));
   return points;
 }
 
 Extruded extrude_loop(ObjPtr start, Vector v) {
+  GMOD_TIME(STATS_EXTRUDE);
   ObjPtr shell = new_shell();
   return extrude_loop2(start, v, shell, FORWARD);
 }
 
+template <class T>
+static Extruded extrude_loop_t(ObjPtr const& start, T const& tr,
+    ObjPtr const& shell, int shell_dir) {
+  GMOD_TIME(STATS_EXTRUDE);
+  auto start_points = loop_points(start);
+  auto start_edges = get_objs_used(start);
+  ObjectIndex indices;
+  auto point_extrusions = extrude_points_t(start_points, tr, indices);
+  auto edge_extrusions =
+      extrude_edges_t(start_edges, tr, point_extrusions, indices);
+  return extrude_loop4(start, shell, shell_dir, edge_extrusions, indices);
+}
+
 Extruded extrude_loop2(ObjPtr start, Vector v, ObjPtr shell, int shell_dir) {
-  return extrude_loop3(start, [=](Vector a){return a + v;}, shell, shell_dir);
+  return extrude_loop_t(start, Translation{v}, shell, shell_dir);
 }
 
 Extruded extrude_loop3(ObjPtr start, Transform tr, ObjPtr shell, int shell_dir) {
-  ObjPtr end = new_loop();
-  auto start_points = loop_points(start);
-  auto start_edges = get_objs_used(start);
-  auto point_extrusions = extrude_points(start_points, tr);
-  auto edge_extrusions = extrude_edges(start_edges, tr, point_extrusions);
-  auto result = extrude_loop4(start, shell, shell_dir, edge_extrusions);
-  for (auto obj : start_points) obj->scratch = -1;
-  for (auto obj : start_edges) obj->scratch = -1;
-  return result;
+  return extrude_loop_t(start, tr, shell, shell_dir);
+}
+
+Extruded extrude_loop3(ObjPtr start, Translation tr, ObjPtr shell,
+    int shell_dir) {
+  return extrude_loop_t(start, tr, shell, shell_dir);
+}
+
+Extruded extrude_loop3(ObjPtr start, Affine tr, ObjPtr shell, int shell_dir) {
+  return extrude_loop_t(start, tr, shell, shell_dir);
+}
+
+Extruded extrude_loop3(ObjPtr start, Rotation tr, ObjPtr shell, int shell_dir) {
+  return extrude_loop_t(start, tr, shell, shell_dir);
 }
 
 Extruded extrude_loop4(ObjPtr start, ObjPtr shell, int shell_dir,
-    std::vector<Extruded> const& edge_extrusions) {
+    std::vector<Extruded> const& edge_extrusions,
+    ObjectIndex const& indices) {
   ObjPtr end = new_loop();
-  for (auto use : start->used) {
-    add_use(end, use.dir, at(edge_extrusions, use.obj->scratch).end);
+  for (auto const& use : start->used) {
+    add_use(end, use.dir,
+        at(edge_extrusions, indices.find(use.obj.get())).end);
   }
-  for (auto use : start->used) {
+  for (auto const& use : start->used) {
     add_use(shell, use.dir ^ shell_dir,
-        at(edge_extrusions, use.obj->scratch).middle);
+        at(edge_extrusions, indices.find(use.obj.get())).middle);
   }
   return Extruded{shell, end};
 }
@@ -622,7 +2116,7 @@ ObjPtr new_plane2(ObjPtr loop) {
 Vector plane_normal(ObjPtr plane, double epsilon) {
   auto loop = face_loop(plane);
   auto pts = loop_points(loop);
-  Vector vectors[2];
+  Vector vectors[2] = {};
   size_t i;
   for (i = 1; i < pts.size(); ++i) {
     vectors[0] = pts[i]->pos - pts[0]->pos;
@@ -670,23 +2164,42 @@ void add_hole_to_face(ObjPtr face, ObjPtr loop) {
   add_use(face, REVERSE, loop);
 }
 
+template <class T>
+static Extruded extrude_face_t(ObjPtr const& face, T const& tr) {
+  GMOD_TIME(STATS_EXTRUDE);
+  auto closure = get_closure(face, false, true);
+  auto start_points = filter_points(closure);
+  auto start_edges = filter_by_dim(closure, 1);
+  ObjectIndex indices;
+  auto point_extrusions = extrude_points_t(start_points, tr, indices);
+  auto edge_extrusions =
+      extrude_edges_t(start_edges, tr, point_extrusions, indices);
+  return extrude_face3(face, edge_extrusions, indices);
+}
+
 Extruded extrude_face(ObjPtr face, Vector v) {
-  return extrude_face2(face, [=](Vector a){return a + v;});
+  return extrude_face_t(face, Translation{v});
 }
 
 Extruded extrude_face2(ObjPtr face, Transform tr) {
-  auto closure = get_closure(face, false, true);
-  auto start_points = filter_points(closure);
-  auto start_edges = filter_by_dim(closure, 1);
-  auto point_extrusions = extrude_points(start_points, tr);
-  auto edge_extrusions = extrude_edges(start_edges, tr, point_extrusions);
-  auto result = extrude_face3(face, edge_extrusions);
-  for (auto obj : start_points) obj->scratch = -1;
-  for (auto obj : start_edges) obj->scratch = -1;
-  return result;
+  return extrude_face_t(face, tr);
+}
+
+Extruded extrude_face2(ObjPtr face, Translation tr) {
+  return extrude_face_t(face, tr);
+}
+
+Extruded extrude_face2(ObjPtr face, Affine tr) {
+  return extrude_face_t(face, tr);
+}
+
+Extruded extrude_face2(ObjPtr face, Rotation tr) {
+  return extrude_face_t(face, tr);
 }
 
-Extruded extrude_face3(ObjPtr face, std::vector<Extruded> const& edge_extrusions) {
+Extruded extrude_face3(ObjPtr face,
+    std::vector<Extruded> const& edge_extrusions,
+    ObjectIndex const& indices) {
   assert(type_dims[face->type] == 2);
   ObjPtr end;
   switch (face->type) {
@@ -703,36 +2216,250 @@ Extruded extrude_face3(ObjPtr face, std::vector<Extruded> const& edge_extrusions
   auto shell = new_shell();
   add_use(shell, REVERSE, face);
   add_use(shell, FORWARD, end);
-  for (auto use : face->used) {
+  for (auto const& use : face->used) {
     auto end_loop =
-      extrude_loop4(use.obj, shell, use.dir, edge_extrusions).end;
+      extrude_loop4(use.obj, shell, use.dir, edge_extrusions, indices).end;
     add_use(end, use.dir, end_loop);
   }
   auto middle = new_volume2(shell);
   return Extruded{middle, end};
 }
 
-Extruded extrude_face_group(ObjPtr face_group, Transform tr) {
-  auto closure = get_closure(face_group, false, true);
+/* makes room in the current Model for the objects that extruding
+   this closure will create, so the object list grows only once */
+static void reserve_extrusion(std::vector<ObjPtr> const& closure,
+    std::size_t copies = 1) {
+  auto model = get_current_model();
+  if (!model) return;
+  std::size_t n = 0;
+  for (auto const& obj : closure) {
+    switch (type_dims[obj->type]) {
+      case 0: n += 2; break;
+      case 1: n += 4 + obj->helpers.size(); break;
+      case 2: n += 3 + obj->used.size(); break;
+      default: break;
+    }
+  }
+  model->objects.reserve(model->objects.size() + n * copies);
+}
+
+/* The closure of all the inputs is gathered in one search, so a
+   point or edge shared by several of them is extruded once. The
+   search's index then doubles as the map from each extruded point
+   and edge to its extrusion. */
+template <class T>
+static std::vector<Extruded> extrude_faces_t(std::vector<ObjPtr> const& faces,
+    T const& tr) {
+  GMOD_TIME(STATS_EXTRUDE);
+  ObjectIndex indices;
+  auto closure = get_closure_of_all(faces, false, true, indices);
+  reserve_extrusion(closure);
   auto start_points = filter_points(closure);
   auto start_edges = filter_by_dim(closure, 1);
-  auto point_extrusions = extrude_points(start_points, tr);
-  auto edge_extrusions = extrude_edges(start_edges, tr, point_extrusions);
+  auto point_extrusions = extrude_points_t(start_points, tr, indices);
+  auto edge_extrusions =
+      extrude_edges_t(start_edges, tr, point_extrusions, indices);
   std::vector<Extruded> face_extrusions;
-  for (auto use : face_group->used) {
-    face_extrusions.push_back(extrude_face3(use.obj, edge_extrusions));
+  face_extrusions.reserve(faces.size());
+  for (auto const& face : faces) {
+    face_extrusions.push_back(extrude_face3(face, edge_extrusions, indices));
+  }
+  return face_extrusions;
+}
+
+std::vector<Extruded> extrude_faces(std::vector<ObjPtr> const& faces,
+    Transform tr) {
+  return extrude_faces_t(faces, tr);
+}
+
+std::vector<Extruded> extrude_faces(std::vector<ObjPtr> const& faces,
+    Translation tr) {
+  return extrude_faces_t(faces, tr);
+}
+
+std::vector<Extruded> extrude_faces(std::vector<ObjPtr> const& faces,
+    Affine tr) {
+  return extrude_faces_t(faces, tr);
+}
+
+std::vector<Extruded> extrude_faces(std::vector<ObjPtr> const& faces,
+    Rotation tr) {
+  return extrude_faces_t(faces, tr);
+}
+
+template <class T>
+static std::vector<Extruded> extrude_loops_t(std::vector<ObjPtr> const& loops,
+    T const& tr) {
+  GMOD_TIME(STATS_EXTRUDE);
+  ObjectIndex indices;
+  auto closure = get_closure_of_all(loops, false, false, indices);
+  reserve_extrusion(closure);
+  auto start_points = filter_points(closure);
+  auto start_edges = filter_by_dim(closure, 1);
+  auto point_extrusions = extrude_points_t(start_points, tr, indices);
+  auto edge_extrusions =
+      extrude_edges_t(start_edges, tr, point_extrusions, indices);
+  std::vector<Extruded> loop_extrusions;
+  loop_extrusions.reserve(loops.size());
+  for (auto const& loop : loops) {
+    loop_extrusions.push_back(extrude_loop4(loop, new_shell(), FORWARD,
+          edge_extrusions, indices));
+  }
+  return loop_extrusions;
+}
+
+std::vector<Extruded> extrude_loops(std::vector<ObjPtr> const& loops,
+    Transform tr) {
+  return extrude_loops_t(loops, tr);
+}
+
+std::vector<Extruded> extrude_loops(std::vector<ObjPtr> const& loops,
+    Translation tr) {
+  return extrude_loops_t(loops, tr);
+}
+
+std::vector<Extruded> extrude_loops(std::vector<ObjPtr> const& loops,
+    Affine tr) {
+  return extrude_loops_t(loops, tr);
+}
+
+std::vector<Extruded> extrude_loops(std::vector<ObjPtr> const& loops,
+    Rotation tr) {
+  return extrude_loops_t(loops, tr);
+}
+
+/* The base face's closure is searched once and its topology recorded
+   as positions in the point and edge lists. Every layer then reuses
+   those positions on the previous layer's end entities, which
+   correspond one to one with the base ones, without searching or
+   hashing again. */
+template <class T>
+static std::vector<Extruded> extrude_layers_t(ObjPtr const& face,
+    T const* steps, std::size_t nlayers, ObjPtr const& group) {
+  GMOD_TIME(STATS_EXTRUDE);
+  assert(type_dims[face->type] == 2);
+  ObjectIndex indices;
+  auto closure = get_closure(face, false, true, indices);
+  reserve_extrusion(closure, nlayers);
+  auto points = filter_points(closure);
+  auto edges = filter_by_dim(closure, 1);
+  auto np = points.size();
+  auto ne = edges.size();
+  for (std::size_t i = 0; i < np; ++i)
+    indices.assign(points[i].get(), static_cast<int>(i));
+  for (std::size_t i = 0; i < ne; ++i)
+    indices.assign(edges[i].get(), static_cast<int>(i));
+  std::vector<int> edge_ends(2 * ne);
+  for (std::size_t i = 0; i < ne; ++i) {
+    edge_ends[2 * i + 0] = indices.find(edge_point_view(edges[i].get(), 0));
+    edge_ends[2 * i + 1] = indices.find(edge_point_view(edges[i].get(), 1));
+  }
+  /* loop l of the face uses the edges loop_uses[loop_first[l]...] */
+  std::vector<std::size_t> loop_first;
+  std::vector<std::pair<int, int>> loop_uses;
+  for (auto const& loop_use : face->used) {
+    loop_first.push_back(loop_uses.size());
+    for (auto const& use : loop_use.obj->used)
+      loop_uses.push_back(std::make_pair(use.dir, indices.find(use.obj.get())));
   }
-  for (auto obj : start_points) obj->scratch = -1;
-  for (auto obj : start_edges) obj->scratch = -1;
+  loop_first.push_back(loop_uses.size());
+  auto cur_points = points;
+  auto cur_edges = edges;
+  auto cur_face = face;
+  std::vector<Vector> ends(np);
+  std::vector<Extruded> point_extrusions(np);
+  std::vector<Extruded> edge_extrusions(ne);
+  std::vector<Extruded> layers;
+  layers.reserve(nlayers);
+  for (std::size_t layer = 0; layer < nlayers; ++layer) {
+    auto const& tr = steps[layer];
+    for (std::size_t i = 0; i < np; ++i) ends[i] = tr(cur_points[i]->pos);
+    for (std::size_t i = 0; i < np; ++i) {
+      PointPtr end = new_point3(ends[i], cur_points[i]->size);
+      ObjPtr middle = new_line2(cur_points[i], end);
+      point_extrusions[i] = Extruded{middle, end};
+    }
+    for (std::size_t i = 0; i < ne; ++i) {
+      edge_extrusions[i] = extrude_edge_t(cur_edges[i], tr,
+          at(point_extrusions, edge_ends[2 * i + 0]),
+          at(point_extrusions, edge_ends[2 * i + 1]));
+    }
+    auto end = new_object(face->type);
+    auto shell = new_shell();
+    add_use(shell, REVERSE, cur_face);
+    add_use(shell, FORWARD, end);
+    for (std::size_t l = 0; l + 1 < loop_first.size(); ++l) {
+      auto loop_dir = face->used[l].dir;
+      auto end_loop = new_loop();
+      for (auto u = loop_first[l]; u < loop_first[l + 1]; ++u) {
+        add_use(end_loop, loop_uses[u].first,
+            at(edge_extrusions, loop_uses[u].second).end);
+      }
+      for (auto u = loop_first[l]; u < loop_first[l + 1]; ++u) {
+        add_use(shell, loop_uses[u].first ^ loop_dir,
+            at(edge_extrusions, loop_uses[u].second).middle);
+      }
+      add_use(end, loop_dir, end_loop);
+    }
+    auto volume = new_volume2(shell);
+    layers.push_back(Extruded{volume, end});
+    if (group) add_to_group(group, volume);
+    for (std::size_t i = 0; i < np; ++i)
+      cur_points[i] = to_point(point_extrusions[i].end);
+    for (std::size_t i = 0; i < ne; ++i) cur_edges[i] = edge_extrusions[i].end;
+    cur_face = end;
+  }
+  return layers;
+}
+
+std::vector<Extruded> extrude_layers(ObjPtr face,
+    std::vector<Vector> const& offsets, ObjPtr group) {
+  std::vector<Translation> steps;
+  steps.reserve(offsets.size());
+  for (auto const& offset : offsets) steps.push_back(Translation{offset});
+  return extrude_layers_t(face, steps.data(), steps.size(), group);
+}
+
+std::vector<Extruded> extrude_layers(ObjPtr face,
+    std::vector<Transform> const& steps, ObjPtr group) {
+  return extrude_layers_t(face, steps.data(), steps.size(), group);
+}
+
+std::vector<Extruded> extrude_layers(ObjPtr face,
+    std::vector<Affine> const& steps, ObjPtr group) {
+  return extrude_layers_t(face, steps.data(), steps.size(), group);
+}
+
+template <class T>
+static Extruded extrude_face_group_t(ObjPtr const& face_group, T const& tr) {
+  GMOD_TIME(STATS_EXTRUDE);
+  auto face_extrusions =
+      extrude_faces_t(get_objs_used(face_group), tr);
   auto volume_group = new_group();
   auto end_face_group = new_group();
-  for (auto ext : face_extrusions) {
+  for (auto const& ext : face_extrusions) {
     add_to_group(volume_group, ext.middle);
     add_to_group(end_face_group, ext.end);
   }
   return Extruded{volume_group, end_face_group};
 }
 
+Extruded extrude_face_group(ObjPtr face_group, Transform tr) {
+  return extrude_face_group_t(face_group, tr);
+}
+
+Extruded extrude_face_group(ObjPtr face_group, Translation tr) {
+  return extrude_face_group_t(face_group, tr);
+}
+
+Extruded extrude_face_group(ObjPtr face_group, Affine tr) {
+  return extrude_face_group_t(face_group, tr);
+}
+
+Extruded extrude_face_group(ObjPtr face_group, Rotation tr) {
+  return extrude_face_group_t(face_group, tr);
+}
+
 ObjPtr face_loop(ObjPtr face) { return face->used[0].obj; }
 
 ObjPtr new_shell() { return new_object(SHELL); }
@@ -789,6 +2516,8 @@ ObjPtr new_ball(Vector center, Vector normal, Vector x) {
   return new_volume2(new_sphere(center, normal, x));
 }
 
+static void materialize_cells(Object* assembly);
+
 void insert_into(ObjPtr into, ObjPtr o) {
   if (is_face(o->type)) {
     assert(is_face(into->type));
@@ -797,6 +2526,8 @@ void insert_into(ObjPtr into, ObjPtr o) {
     assert(into->type == VOLUME);
     add_use(into, REVERSE, volume_shell(o));
   } else if (o->type == GROUP) {
+    /* the hole must share its sides with the cells sealed in it */
+    materialize_cells(o.get());
     auto boundary = collect_assembly_boundary(o);
     assert(boundary->type == get_boundary_type(into->type));
     add_use(into, REVERSE, boundary);
@@ -813,6 +2544,7 @@ void add_to_group(ObjPtr group, ObjPtr o) { add_use(group, FORWARD, o); }
 
 void weld_volume_face_into(ObjPtr big_volume, ObjPtr small_volume,
                            ObjPtr big_volume_face, ObjPtr small_volume_face) {
+  GMOD_TIME(STATS_WELD);
   insert_into(big_volume_face, small_volume_face);
   add_use(volume_shell(big_volume),
           !(get_used_dir(volume_shell(small_volume), small_volume_face)),
@@ -821,6 +2553,7 @@ void weld_volume_face_into(ObjPtr big_volume, ObjPtr small_volume,
 
 void weld_plane_with_holes_into(ObjPtr big_volume, ObjPtr small_volume,
                            ObjPtr big_volume_face, ObjPtr small_volume_face) {
+  GMOD_TIME(STATS_WELD);
   weld_volume_face_into(big_volume, small_volume, big_volume_face, small_volume_face);
   for (size_t i = 1; i < small_volume_face->used.size(); ++i) {
     auto hole_loop = small_volume_face->used[i].obj;
@@ -837,170 +2570,3330 @@ static int are_parallel(Vector a, Vector b) {
 }
 
 static int are_perpendicular(Vector a, Vector b) {
-  return 1e-6 >
-         (0.0 - fabs(dot_product(normalize_vector(a), normalize_vector(b))));
+  return 1e-6 > fabs(dot_product(normalize_vector(a), normalize_vector(b)));
 }
 
-Vector eval(ObjPtr o, double const* param) {
-  switch (o->type) {
-    case POINT: {
-      auto p = std::dynamic_pointer_cast<Point>(o);
-      return p->pos;
-    }
-    case LINE: {
-      double u = param[0];
-      PointPtr a = edge_point(o, 0);
-      PointPtr b = edge_point(o, 1);
-      return add_vectors(scale_vector(1.0 - u, a->pos),
-                         scale_vector(u, b->pos));
-    }
-    case ARC: {
-      double u = param[0];
-      PointPtr a = edge_point(o, 0);
-      PointPtr c = arc_center(o);
-      PointPtr b = edge_point(o, 1);
-      Vector n = arc_normal(o);
-      Vector ca = subtract_vectors(a->pos, c->pos);
-      Vector cb = subtract_vectors(b->pos, c->pos);
-      double full_ang =
-          acos(dot_product(ca, cb) / (vector_norm(ca) * vector_norm(cb)));
-      double ang = full_ang * u;
-      return rotate_vector(n, ang, ca);
+/* Curves other than splines are origin + f(u) * a + g(u) * b,
+   where f and g are the cosine and sine of u * angle for arcs and
+   quarter ellipses. Lines weigh their end points a and b by 1 - u
+   and u from a zero origin, so their ends come out exactly. */
+struct CurveFrame {
+  bool trig;
+  double angle;
+  Vector origin, a, b;
+};
+
+static CurveFrame line_frame(Object const* o) {
+  auto a = edge_point_view(o, 0)->pos;
+  auto b = edge_point_view(o, 1)->pos;
+  return CurveFrame{false, 0, Vector{0, 0, 0}, a, b};
+}
+
+static CurveFrame arc_frame(Object const* o) {
+  auto c = arc_center_view(o)->pos;
+  auto ca = subtract_vectors(edge_point_view(o, 0)->pos, c);
+  auto cb = subtract_vectors(edge_point_view(o, 1)->pos, c);
+  auto angle =
+      acos(dot_product(ca, cb) / (vector_norm(ca) * vector_norm(cb)));
+  auto n = arc_normal_view(o);
+  return CurveFrame{true, angle, c, ca, cross_product(n, ca)};
+}
+
+/* a quarter ellipse runs from one semi-axis to the other, and
+   its major point tells which is which */
+static CurveFrame ellipse_frame(Object const* o) {
+  auto c = ellipse_center_view(o)->pos;
+  auto ca = subtract_vectors(edge_point_view(o, 0)->pos, c);
+  auto cb = subtract_vectors(edge_point_view(o, 1)->pos, c);
+  auto cm = subtract_vectors(ellipse_major_pt_view(o)->pos, c);
+  auto major = ca;
+  auto minor = cb;
+  if (!are_parallel(major, cm)) std::swap(major, minor);
+  if (!are_parallel(major, cm)) {
+    fprintf(stderr, "gmodel only understands quarter ellipses,\n");
+    fprintf(stderr, "and this one has no endpoint on the major axis\n");
+    abort();
+  }
+  if (!are_perpendicular(minor, cm)) {
+    fprintf(stderr, "gmodel only understands quarter ellipses,\n");
+    fprintf(stderr, "and this one has no endpoint on the minor axis\n");
+    abort();
+  }
+  return CurveFrame{true, PI / 2.0, c, ca, cb};
+}
+
+enum { EVAL_BLOCK = 64 };
+
+static void eval_frame(CurveFrame const& frame, double const* params,
+    std::size_t n, Vector* out) {
+  double f[EVAL_BLOCK];
+  double g[EVAL_BLOCK];
+  for (std::size_t first = 0; first < n; first += EVAL_BLOCK) {
+    auto m = std::min(std::size_t(EVAL_BLOCK), n - first);
+    auto u = params + first;
+    if (frame.trig) {
+      for (std::size_t i = 0; i < m; ++i) f[i] = cos(u[i] * frame.angle);
+      for (std::size_t i = 0; i < m; ++i) g[i] = sin(u[i] * frame.angle);
+    } else {
+      for (std::size_t i = 0; i < m; ++i) f[i] = 1.0 - u[i];
+      for (std::size_t i = 0; i < m; ++i) g[i] = u[i];
     }
-    case ELLIPSE: {
-      double u = param[0];
-      PointPtr a = edge_point(o, 0);
-      PointPtr c = ellipse_center(o);
-      PointPtr m = ellipse_major_pt(o);
-      PointPtr b = edge_point(o, 1);
-      Vector ca = subtract_vectors(a->pos, c->pos);
-      Vector cb = subtract_vectors(b->pos, c->pos);
-      Vector cm = subtract_vectors(m->pos, c->pos);
-      if (!are_parallel(cb, cm)) {
-        PointPtr tmp = a;
-        a = b;
-        b = tmp;
-        u = 1.0 - u;
-        if (!are_parallel(cb, cm)) {
-          fprintf(stderr, "gmodel only understands quarter ellipses,\n");
-          fprintf(stderr, "and this one has no endpoint on the major axis\n");
-          abort();
-        }
-        if (!are_perpendicular(ca, cm)) {
-          fprintf(stderr, "gmodel only understands quarter ellipses,\n");
-          fprintf(stderr, "and this one has no endpoint on the minor axis\n");
-          abort();
-        }
-      }
-      double full_ang = PI / 2.0;
-      double ang = full_ang * u;
-      return add_vectors(c->pos, add_vectors(scale_vector(cos(ang), ca),
-                                             scale_vector(sin(ang), cb)));
+    auto o = frame.origin;
+    auto a = frame.a;
+    auto b = frame.b;
+    auto p = out + first;
+    for (std::size_t i = 0; i < m; ++i) {
+      p[i].x = o.x + f[i] * a.x + g[i] * b.x;
+      p[i].y = o.y + f[i] * a.y + g[i] * b.y;
+      p[i].z = o.z + f[i] * a.z + g[i] * b.z;
     }
+  }
+}
+
+/* Gmsh's Spline: a uniform Catmull-Rom curve through the start
+   point, the helpers and the end point, spending an equal share
+   of the parameter on each span. Open splines reflect their end
+   points to make up the missing neighbours of the end spans, and
+   closed ones wrap around. */
+static void eval_spline(Object const* o, double const* params,
+    std::size_t n, Vector* out) {
+  std::vector<Vector> pts;
+  pts.reserve(o->helpers.size() + 4);
+  pts.push_back(Vector{0, 0, 0});
+  pts.push_back(edge_point_view(o, 0)->pos);
+  for (auto const& h : o->helpers) pts.push_back(as_point(h)->pos);
+  pts.push_back(edge_point_view(o, 1)->pos);
+  auto npts = pts.size() - 1;
+  auto closed = (o->used[0].obj == o->used[1].obj) && npts > 2;
+  if (closed) {
+    pts[0] = pts[npts - 1];
+    pts.push_back(pts[2]);
+  } else {
+    pts[0] = 2.0 * pts[1] - pts[2];
+    pts.push_back(2.0 * pts[npts] - pts[npts - 1]);
+  }
+  auto nspans = static_cast<double>(npts - 1);
+  auto last = static_cast<long>(npts) - 2;
+  for (std::size_t j = 0; j < n; ++j) {
+    auto s = params[j] * nspans;
+    auto i = std::min(std::max(static_cast<long>(s), 0L), last);
+    auto t = s - static_cast<double>(i);
+    auto t2 = t * t;
+    auto t3 = t2 * t;
+    double w0 = 0.5 * (-t3 + 2.0 * t2 - t);
+    double w1 = 0.5 * (3.0 * t3 - 5.0 * t2 + 2.0);
+    double w2 = 0.5 * (-3.0 * t3 + 4.0 * t2 + t);
+    double w3 = 0.5 * (t3 - t2);
+    auto p = pts.data() + i;
+    out[j] = w0 * p[0] + w1 * p[1] + w2 * p[2] + w3 * p[3];
+  }
+}
+
+void eval_many(ObjPtr const& o, double const* params, std::size_t n,
+    Vector* out) {
+  switch (o->type) {
+    case POINT:
+      std::fill(out, out + n, as_point(o)->pos);
+      return;
+    case LINE:
+      eval_frame(line_frame(o.get()), params, n, out);
+      return;
+    case ARC:
+      eval_frame(arc_frame(o.get()), params, n, out);
+      return;
+    case ELLIPSE:
+      eval_frame(ellipse_frame(o.get()), params, n, out);
+      return;
+    case SPLINE:
+      eval_spline(o.get(), params, n, out);
+      return;
     default:
-      return Vector{-42, -42, -42};
+      std::fill(out, out + n, Vector{-42, -42, -42});
+  }
+}
+
+Vector eval(ObjPtr const& o, double const* param) {
+  Vector result;
+  eval_many(o, param, 1, &result);
+  return result;
+}
+
+enum { TRANSFORM_BLOCK = 64 };
+
+template <std::size_t N>
+static void transform_block(double* __restrict x, double* __restrict y,
+    double* __restrict z, Matrix const& a, Vector const& b) {
+  for (std::size_t i = 0; i < N; ++i) {
+    double xi = x[i], yi = y[i], zi = z[i];
+    x[i] = a.x.x * xi + (a.y.x * yi + a.z.x * zi) + b.x;
+    y[i] = a.x.y * xi + (a.y.y * yi + a.z.y * zi) + b.y;
+    z[i] = a.x.z * xi + (a.y.z * yi + a.z.z * zi) + b.z;
+  }
+}
+
+void transform_coordinates(double* x, double* y, double* z, std::size_t n,
+    Matrix linear, Vector translation) {
+  std::size_t i = 0;
+  for (; i + TRANSFORM_BLOCK <= n; i += TRANSFORM_BLOCK) {
+    transform_block<TRANSFORM_BLOCK>(x + i, y + i, z + i, linear,
+                                     translation);
+  }
+  for (; i < n; ++i) {
+    transform_block<1>(x + i, y + i, z + i, linear, translation);
   }
 }
 
+/* points are gathered a block at a time into coordinate arrays,
+   transformed there, and scattered back */
+static void transform_point_range(Point* const* points, std::size_t n,
+    Matrix const& linear, Vector const& translation) {
+  double x[TRANSFORM_BLOCK], y[TRANSFORM_BLOCK], z[TRANSFORM_BLOCK];
+  for (std::size_t first = 0; first < n; first += TRANSFORM_BLOCK) {
+    auto m = std::min(std::size_t(TRANSFORM_BLOCK), n - first);
+    auto block = points + first;
+    for (std::size_t i = 0; i < m; ++i) {
+      x[i] = block[i]->pos.x;
+      y[i] = block[i]->pos.y;
+      z[i] = block[i]->pos.z;
+    }
+    transform_coordinates(x, y, z, m, linear, translation);
+    for (std::size_t i = 0; i < m; ++i) block[i]->pos = Vector{x[i], y[i], z[i]};
+  }
+}
+
+enum { TRANSFORM_CHUNK = 16 * 1024 };
+
+void transform_points(Point* const* points, std::size_t n, Matrix linear,
+    Vector translation) {
+  invalidate_closures();
+  auto nchunks = (n + TRANSFORM_CHUNK - 1) / TRANSFORM_CHUNK;
+  parallel_for(nchunks, [&](std::size_t c) {
+    auto first = c * TRANSFORM_CHUNK;
+    transform_point_range(points + first,
+        std::min(std::size_t(TRANSFORM_CHUNK), n - first), linear,
+        translation);
+  });
+}
+
+/* instances are moved by composing their transforms */
 void transform_closure(ObjPtr object, Matrix linear, Vector translation) {
   auto closure = get_closure(object, true, true);
-  for (auto co : closure) {
+  std::vector<Point*> points;
+  for (auto const& co : closure) {
     if (co->type == POINT) {
-      auto pt = std::dynamic_pointer_cast<Point>(co);
-      pt->pos = (linear * (pt->pos)) + translation;
+      points.push_back(static_cast<Point*>(co.get()));
+    } else if (co->type == INSTANCE) {
+      auto instance = as_instance(co);
+      auto a = instance->linear;
+      instance->linear = Matrix{matrix_vector_product(linear, a.x),
+          matrix_vector_product(linear, a.y),
+          matrix_vector_product(linear, a.z)};
+      instance->translation = add_vectors(
+          matrix_vector_product(linear, instance->translation), translation);
     }
   }
+  transform_points(points.data(), points.size(), linear, translation);
 }
 
-static ObjPtr copy_object(ObjPtr object) {
+static ObjPtr copy_object(ObjPtr const& object) {
   ObjPtr out;
   if (object->type == POINT) {
-    auto point = std::dynamic_pointer_cast<Point>(object);
+    auto point = as_point(object);
     out = new_point3(point->pos, point->size);
+  } else if (object->type == INSTANCE) {
+    auto instance = as_instance(object);
+    out = new_instance(instance->prototype, instance->linear,
+        instance->translation);
   } else {
     out = new_object(object->type);
   }
   return out;
 }
 
-ObjPtr copy_closure(ObjPtr object) {
-  auto closure = get_closure(object, true, true);
-  for (size_t i = 0; i < closure.size(); ++i) closure[i]->scratch =
-    static_cast<int>(i);
-  decltype(closure) out_closure;
-  for (auto co : closure) {
+/* copies of a closure's objects, in closure order, given each
+   object's position in `indices`; if `move` is given, the copied
+   points are then moved by it through the batch kernel */
+static std::vector<ObjPtr> copy_objects(std::vector<ObjPtr> const& closure,
+    ObjectIndex const& indices, Affine const* move = nullptr) {
+  GMOD_TIME(STATS_COPY);
+  std::vector<ObjPtr> out_closure;
+  out_closure.reserve(closure.size());
+  std::vector<Point*> points;
+  for (auto const& co : closure) {
     auto oco = copy_object(co);
-    for (auto coh : co->helpers) {
-      auto idx = coh->scratch;
-      assert(idx < co->scratch);
-      oco->helpers.push_back(at(out_closure, idx));
-    }
-    for (auto cou : co->used) {
-      auto idx = cou.obj->scratch;
-      assert(idx < co->scratch);
+    if (move && oco->type == POINT) points.push_back(as_point(oco));
+    for (auto const& coh : co->helpers) {
+      auto idx = indices.find(coh.get());
+      assert(idx < indices.find(co.get()));
+      add_helper(oco, at(out_closure, idx));
+    }
+    for (auto const& cou : co->used) {
+      auto idx = indices.find(cou.obj.get());
+      assert(idx < indices.find(co.get()));
       add_use(oco, cou.dir, at(out_closure, idx));
     }
+    for (auto const& coe : co->embedded) {
+      auto idx = indices.find(coe.get());
+      assert(idx < indices.find(co.get()));
+      oco->embedded.push_back(at(out_closure, idx));
+    }
     out_closure.push_back(oco);
   }
-  for (auto co : closure) co->scratch = -1;
-  return out_closure.back();
+  if (move)
+    transform_points(points.data(), points.size(), move->linear,
+        move->translation);
+  invalidate_closures();
+  return out_closure;
 }
 
-ObjPtr collect_assembly_boundary(ObjPtr assembly) {
+ObjPtr copy_closure(ObjPtr object) {
+  GMOD_TIME(STATS_COPY);
+  ObjectIndex indices;
+  auto closure = get_closure(object, true, true, indices);
+  for (size_t i = 0; i < closure.size(); ++i)
+    indices.assign(closure[i].get(), static_cast<int>(i));
+  return copy_objects(closure, indices).back();
+}
+
+Instance::Instance() : Object(INSTANCE), first_id(0) {}
+
+Instance::~Instance() {}
+
+ObjPtr new_instance(ObjPtr prototype, Matrix linear, Vector translation) {
+  auto closure = get_closure(prototype, true, true);
+  for (auto const& co : closure) {
+    if (co->type == INSTANCE) {
+      fprintf(stderr, "gmodel can't instance a closure with instances in it\n");
+      abort();
+    }
+  }
+  auto instance = allocate_object<Instance>();
+  instance->prototype = prototype;
+  instance->linear = linear;
+  instance->translation = translation;
+  auto n = static_cast<int>(closure.size());
+  instance->first_id =
+      (current_model ? current_model->ids : global_ids).allocate(n);
+  instance->id = instance->first_id + n - 1;
+  return instance;
+}
+
+static ObjPtr materialize(Object* instance, PrototypeLayout const& layout) {
+  auto inst = as_instance(instance);
+  Affine move{inst->linear, inst->translation};
+  auto copies = copy_objects(layout.objects, layout.indices, &move);
+  for (std::size_t i = 0; i < copies.size(); ++i)
+    copies[i]->id = inst->first_id + static_cast<int>(i);
+  return copies.back();
+}
+
+ObjPtr materialize_instance(ObjPtr instance) {
+  InstanceLayouts layouts(std::vector<ObjPtr>(1, instance));
+  return materialize(instance.get(), layouts.of(instance.get()));
+}
+
+void materialize_instances(ObjPtr root) {
+  auto closure = get_closure(root, true, true);
+  InstanceLayouts layouts(closure);
+  if (layouts.empty()) return;
+  ObjectIndex which;
+  std::vector<ObjPtr> copies;
+  for (auto const& co : closure) {
+    if (co->type != INSTANCE) continue;
+    which.assign(co.get(), static_cast<int>(copies.size()));
+    copies.push_back(materialize(co.get(), layouts.of(co.get())));
+  }
+  auto replace = [&](ObjPtr& o) {
+    auto i = which.find(o.get());
+    if (i >= 0) o = at(copies, i);
+  };
+  for (auto const& co : closure) {
+    for (auto& use : co->used) replace(use.obj);
+    for (auto& h : co->helpers) replace(h);
+    for (auto& e : co->embedded) replace(e);
+  }
+  invalidate_closures();
+}
+
+/* the cells of an assembly, looking through nested groups */
+static void gather_cells(Object const* assembly, std::vector<ObjPtr>& cells) {
+  for (auto const& use : assembly->used) {
+    if (use.obj->type == GROUP) gather_cells(use.obj.get(), cells);
+    else cells.push_back(use.obj);
+  }
+}
+
+static void gather_instance_uses(Object* assembly, std::vector<Use*>& uses) {
+  for (auto& use : assembly->used) {
+    if (use.obj->type == GROUP) gather_instance_uses(use.obj.get(), uses);
+    else if (use.obj->type == INSTANCE) uses.push_back(&use);
+  }
+}
+
+/* an instance has no sides of its own to share with the other
+   cells, so the welds replace instance cells in their groups by
+   their materialized copies */
+static void materialize_cells(Object* assembly) {
+  std::vector<Use*> uses;
+  gather_instance_uses(assembly, uses);
+  if (uses.empty()) return;
+  ObjectIndex which;
+  std::vector<ObjPtr> instances;
+  for (auto use : uses)
+    if (which.insert(use->obj.get(), int(instances.size())))
+      instances.push_back(use->obj);
+  InstanceLayouts layouts(instances);
+  std::vector<ObjPtr> copies;
+  for (auto const& instance : instances)
+    copies.push_back(materialize(instance.get(), layouts.of(instance.get())));
+  for (auto use : uses) use->obj = at(copies, which.find(use->obj.get()));
+  invalidate_closures();
+}
+
+/* the sides used by exactly one of some cells of an assembly,
+   oriented as that cell uses them */
+static std::vector<Use> lone_sides(Object const* assembly,
+    std::vector<ObjPtr> const& cells, int& cell_type) {
   std::vector<Use> uses;
-  int cell_type = -1;
-  for (auto cell_use : assembly->used) {
-    auto cell = cell_use.obj;
+  for (auto const& cell : cells) {
     if (cell_type == -1)
       cell_type = cell->type;
-    assert(cell_type == cell->type);
-    auto boundary = cell->used[0].obj;
-    for (auto side_use : boundary->used) {
-      uses.push_back(side_use);
+    if (type_dims[cell->type] != type_dims[cell_type]) {
+      fprintf(stderr, "gmodel: assembly %d mixes %s %d with %s cells\n",
+          assembly->id, type_names[cell->type], cell->id,
+          type_names[cell_type]);
+      abort();
+    }
+    for (auto const& boundary_use : cell->used) {
+      for (auto const& side_use : boundary_use.obj->used)
+        uses.push_back(Use{side_use.dir ^ boundary_use.dir, side_use.obj});
     }
   }
-  for (auto use : uses)
-    use.obj->scratch = 0;
-  for (auto use : uses)
-    ++(use.obj->scratch);
+  ObjectIndex counts;
+  counts.reserve(uses.size());
+  for (auto const& use : uses)
+    counts.assign(use.obj.get(), std::max(counts.find(use.obj.get()), 0) + 1);
+  std::vector<Use> sides;
+  for (auto const& use : uses)
+    if (counts.find(use.obj.get()) == 1) sides.push_back(use);
+  return sides;
+}
+
+/* The sides of an instance cell are those of its prototype's cells,
+   moved and numbered as the instance prints them. Only the closure
+   of those sides is copied, and the instance is left in place. */
+static void instance_sides(Object const* assembly, Object* instance,
+    PrototypeLayout const& layout, int& cell_type, std::vector<Use>& sides) {
+  auto inst = as_instance(instance);
+  std::vector<ObjPtr> cells;
+  if (inst->prototype->type == GROUP) gather_cells(inst->prototype.get(), cells);
+  else cells.push_back(inst->prototype);
+  auto own = lone_sides(assembly, cells, cell_type);
+  auto n = layout.objects.size();
+  std::vector<bool> needed(n, false);
+  for (auto const& use : own)
+    needed[std::size_t(layout.indices.find(use.obj.get()))] = true;
+  auto need = [&](Object const* o) {
+    needed[std::size_t(layout.indices.find(o))] = true;
+  };
+  for (std::size_t i = n; i-- > 0;) {
+    if (!needed[i]) continue;
+    auto const& o = layout.objects[i];
+    for (auto const& use : o->used) need(use.obj.get());
+    for (auto const& h : o->helpers) need(h.get());
+    for (auto const& e : o->embedded) need(e.get());
+  }
+  std::vector<ObjPtr> subset;
+  std::vector<int> positions;
+  ObjectIndex indices;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (!needed[i]) continue;
+    indices.assign(layout.objects[i].get(), int(subset.size()));
+    subset.push_back(layout.objects[i]);
+    positions.push_back(int(i));
+  }
+  Affine move{inst->linear, inst->translation};
+  auto copies = copy_objects(subset, indices, &move);
+  for (std::size_t k = 0; k < copies.size(); ++k)
+    copies[k]->id = inst->first_id + positions[k];
+  for (auto const& use : own)
+    sides.push_back(Use{use.dir, at(copies, indices.find(use.obj.get()))});
+}
+
+/* the sides used by exactly one cell, oriented as that cell uses
+   them; sides of instance cells are never shared with other cells */
+static UseList assembly_boundary_uses(Object const* assembly, int& cell_type) {
+  std::vector<ObjPtr> cells;
+  gather_cells(assembly, cells);
+  std::vector<ObjPtr> plain;
+  std::vector<ObjPtr> instances;
+  /* an instance used twice shares all of its sides with itself */
+  ObjectIndex uses_of;
+  for (auto const& cell : cells) {
+    if (cell->type != INSTANCE) plain.push_back(cell);
+    else if (uses_of.insert(cell.get(), 1)) instances.push_back(cell);
+    else uses_of.assign(cell.get(), uses_of.find(cell.get()) + 1);
+  }
+  cell_type = -1;
+  auto found = lone_sides(assembly, plain, cell_type);
+  UseList sides(found.begin(), found.end());
+  if (instances.empty()) return sides;
+  InstanceLayouts layouts(instances);
+  std::vector<Use> copied;
+  for (auto const& instance : instances) {
+    if (uses_of.find(instance.get()) != 1) continue;
+    instance_sides(assembly, instance.get(), layouts.of(instance.get()),
+        cell_type, copied);
+  }
+  sides.insert(sides.end(), copied.begin(), copied.end());
+  return sides;
+}
+
+ObjPtr collect_assembly_boundary(ObjPtr assembly) {
+  int cell_type;
+  auto sides = assembly_boundary_uses(assembly.get(), cell_type);
   auto boundary = new_object(get_boundary_type(cell_type));
-  for (auto use : uses)
-    if (use.obj->scratch == 1)
-      boundary->used.push_back(use);
-  for (auto use : uses)
-    use.obj->scratch = -1;
+  boundary->used = sides;
+  GMOD_COUNT(uses, sides.size());
+  invalidate_closures();
   return boundary;
 }
 
+/* Splits edge uses into closed chains, each in walking order. The
+   point at each end of each edge is given a dense number, and each
+   point must be shared by exactly two edge ends, so the walk from
+   any edge finds its successor in constant time. */
+static std::vector<UseList> chain_edge_uses(UseList const& uses) {
+  auto n = uses.size();
+  ObjectIndex point_numbers;
+  point_numbers.reserve(2 * n);
+  /* incidences[2 * p + k] is the k'th edge end at point p, encoded
+     as 2 * (use index) + (end of the edge) */
+  std::vector<int> incidences;
+  std::vector<int> ends(2 * n);
+  for (std::size_t i = 0; i < n; ++i) {
+    for (int end = 0; end < 2; ++end) {
+      auto point = edge_point_view(uses[i].obj.get(), end);
+      auto next = static_cast<int>(point_numbers.size());
+      if (point_numbers.insert(point, next)) {
+        incidences.push_back(-1);
+        incidences.push_back(-1);
+      }
+      auto p = point_numbers.find(point);
+      auto slot = std::size_t(2 * p);
+      if (incidences[slot] != -1) ++slot;
+      if (incidences[slot] != -1) {
+        fprintf(stderr, "gmodel: point %d is on more than two boundary edges\n",
+            point->id);
+        abort();
+      }
+      incidences[slot] = static_cast<int>(2 * i) + end;
+      ends[2 * i + std::size_t(end)] = p;
+    }
+  }
+  std::vector<bool> done(n, false);
+  std::vector<UseList> chains;
+  for (std::size_t first = 0; first < n; ++first) {
+    if (done[first]) continue;
+    UseList chain;
+    auto i = first;
+    int dir = uses[first].dir;
+    while (!done[i]) {
+      done[i] = true;
+      chain.push_back(Use{dir, uses[i].obj});
+      /* leave through the end a use in direction dir finishes at */
+      auto out = 2 * i + std::size_t(1 - dir);
+      auto p = std::size_t(ends[out]);
+      auto a = incidences[2 * p];
+      auto b = incidences[2 * p + 1];
+      if (b == -1) {
+        fprintf(stderr, "gmodel: boundary is open at point %d\n",
+            edge_point_view(uses[i].obj.get(), 1 - dir)->id);
+        abort();
+      }
+      auto next = (std::size_t(a) == out) ? b : a;
+      i = std::size_t(next / 2);
+      /* entering through an edge's first point walks it forward */
+      dir = (next % 2 == 0) ? FORWARD : REVERSE;
+    }
+    chains.push_back(chain);
+  }
+  return chains;
+}
+
 void unscramble_loop(ObjPtr loop) {
-  std::multimap<ObjPtr, Use> lookup;
-  for (auto use : loop->used) {
-    lookup.insert(std::make_pair(edge_point(use.obj, 0), Use{FORWARD, use.obj}));
-    lookup.insert(std::make_pair(edge_point(use.obj, 1), Use{REVERSE, use.obj}));
+  auto chains = chain_edge_uses(loop->used);
+  if (chains.size() != 1) {
+    fprintf(stderr, "gmodel: loop %d falls into %zu separate loops\n",
+        loop->id, chains.size());
+    abort();
   }
-  std::vector<Use> new_uses;
-  new_uses.push_back(loop->used[0]);
-  while (new_uses.size() < loop->used.size()) {
-    auto use = new_uses.back();
-    auto point = edge_point(use.obj, 1 - use.dir);
-    for (auto it = lookup.lower_bound(point); it != lookup.upper_bound(point); ++it) {
-      if (it->second.obj != use.obj) new_uses.push_back(it->second);
+  loop->used = chains[0];
+  invalidate_closures();
+}
+
+std::vector<ObjPtr> collect_assembly_boundaries(ObjPtr assembly) {
+  int cell_type;
+  auto sides = assembly_boundary_uses(assembly.get(), cell_type);
+  std::vector<ObjPtr> boundaries;
+  if (get_boundary_type(cell_type) != LOOP) {
+    auto boundary = new_object(get_boundary_type(cell_type));
+    boundary->used = sides;
+    GMOD_COUNT(uses, sides.size());
+    boundaries.push_back(boundary);
+  } else {
+    for (auto const& chain : chain_edge_uses(sides)) {
+      auto loop = new_loop();
+      loop->used = chain;
+      GMOD_COUNT(uses, chain.size());
+      boundaries.push_back(loop);
     }
   }
-  loop->used = new_uses;
+  invalidate_closures();
+  return boundaries;
 }
 
 void weld_half_shell_onto(ObjPtr volume, ObjPtr big_face,
     ObjPtr half_shell, int dir) {
-  auto loop = collect_assembly_boundary(half_shell);
-  unscramble_loop(loop);
-  add_use(big_face, REVERSE, loop);
+  GMOD_TIME(STATS_WELD);
+  materialize_cells(half_shell.get());
+  for (auto const& loop : collect_assembly_boundaries(half_shell))
+    add_use(big_face, REVERSE, loop);
   auto vshell = volume_shell(volume);
-  for (auto use : half_shell->used) add_use(vshell, use.dir ^ dir, use.obj);
+  for (auto const& use : half_shell->used)
+    add_use(vshell, use.dir ^ dir, use.obj);
 }
 
 void embed(ObjPtr into, ObjPtr embedded) {
   into->embedded.push_back(embedded);
+  invalidate_closures();
+}
+
+/* Which objects of a closure are being replaced, by what, and
+   whether uses of them have to flip direction to match. */
+struct Merges {
+  ObjectIndex which;
+  std::vector<ObjPtr> by;
+  std::vector<int> flips;
+  void add(Object const* duplicate, ObjPtr const& original, int flip) {
+    which.assign(duplicate, static_cast<int>(by.size()));
+    by.push_back(original);
+    flips.push_back(flip);
+  }
+  bool merged(Object const* o) const { return which.find(o) >= 0; }
+  /* points every reference in the closure at the originals */
+  void redirect(std::vector<ObjPtr> const& closure) const {
+    for (auto const& co : closure) {
+      if (merged(co.get())) continue;
+      for (auto& use : co->used) {
+        auto i = which.find(use.obj.get());
+        if (i < 0) continue;
+        use.dir ^= at(flips, i);
+        use.obj = at(by, i);
+      }
+      for (auto& h : co->helpers) {
+        auto i = which.find(h.get());
+        if (i >= 0) h = at(by, i);
+      }
+      for (auto& e : co->embedded) {
+        auto i = which.find(e.get());
+        if (i >= 0) e = at(by, i);
+      }
+      if (co->embedded.size() > 1) {
+        ObjectIndex seen;
+        ObjList unique;
+        for (auto const& e : co->embedded)
+          if (seen.insert(e.get(), 0)) unique.push_back(e);
+        co->embedded = unique;
+      }
+    }
+  }
+};
+
+struct CellKey {
+  long long x, y, z;
+  bool operator==(CellKey const& o) const {
+    return x == o.x && y == o.y && z == o.z;
+  }
+};
+
+struct CellHash {
+  std::size_t operator()(CellKey const& k) const {
+    auto h = std::uint64_t(k.x) * 0x9e3779b97f4a7c15ULL;
+    h ^= std::uint64_t(k.y) * 0xc2b2ae3d27d4eb4fULL;
+    h ^= std::uint64_t(k.z) * 0x165667b19e3779f9ULL;
+    return std::size_t(h ^ (h >> 29));
+  }
+};
+
+/* Points closer than the tolerance are merged into the first of
+   them in closure order. Points are hashed into cubic cells as
+   wide as the tolerance, so only the 27 cells around a point
+   can hold a match. */
+static void merge_points(std::vector<ObjPtr> const& closure,
+    double tolerance, Merges& merges) {
+  std::unordered_map<CellKey, std::vector<std::size_t>, CellHash> cells;
+  auto cell_of = [=](double x) {
+    return static_cast<long long>(std::floor(x / tolerance));
+  };
+  for (std::size_t i = 0; i < closure.size(); ++i) {
+    if (closure[i]->type != POINT) continue;
+    auto p = as_point(closure[i]);
+    CellKey c{cell_of(p->pos.x), cell_of(p->pos.y), cell_of(p->pos.z)};
+    /* cells list their points in closure order, so the first match
+       in each cell is the only candidate there */
+    auto original_index = closure.size();
+    for (long long dx = -1; dx <= 1; ++dx)
+    for (long long dy = -1; dy <= 1; ++dy)
+    for (long long dz = -1; dz <= 1; ++dz) {
+      auto it = cells.find(CellKey{c.x + dx, c.y + dy, c.z + dz});
+      if (it == cells.end()) continue;
+      for (auto j : it->second) {
+        if (j >= original_index) break;
+        auto q = as_point(closure[j]);
+        if (vector_norm(subtract_vectors(p->pos, q->pos)) <= tolerance) {
+          original_index = j;
+          break;
+        }
+      }
+    }
+    if (original_index != closure.size()) {
+      auto original = as_point(closure[original_index]);
+      original->size = std::min(original->size, p->size);
+      merges.add(p, closure[original_index], 0);
+    } else {
+      cells[c].push_back(i);
+    }
+  }
+}
+
+typedef std::vector<std::uintptr_t> MergeKey;
+
+struct MergeKeyHash {
+  std::size_t operator()(MergeKey const& k) const {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto x : k) h = (h ^ std::uint64_t(x)) * 0x100000001b3ULL;
+    return std::size_t(h);
+  }
+};
+
+static std::uintptr_t key_of(Object const* o) {
+  return reinterpret_cast<std::uintptr_t>(o);
+}
+
+/* Edges of the same type between the same points with the same
+   helpers are merged; one running the other way is merged with
+   its uses flipped. Spline helpers are listed in walking order,
+   so they reverse with the edge. */
+static void merge_edges(std::vector<ObjPtr> const& closure,
+    Merges& merges) {
+  std::unordered_map<MergeKey, std::size_t, MergeKeyHash> seen;
+  for (std::size_t i = 0; i < closure.size(); ++i) {
+    auto e = closure[i].get();
+    if (type_dims[e->type] != 1 || e->used.size() != 2) continue;
+    MergeKey key{std::uintptr_t(e->type), key_of(e->used[0].obj.get()),
+        key_of(e->used[1].obj.get())};
+    for (auto const& h : e->helpers) key.push_back(key_of(h.get()));
+    auto it = seen.find(key);
+    if (it != seen.end()) {
+      merges.add(e, closure[it->second], 0);
+      continue;
+    }
+    std::swap(key[1], key[2]);
+    if (e->type == SPLINE) std::reverse(key.begin() + 3, key.end());
+    it = seen.find(key);
+    if (it != seen.end()) {
+      merges.add(e, closure[it->second], 1);
+      continue;
+    }
+    std::swap(key[1], key[2]);
+    if (e->type == SPLINE) std::reverse(key.begin() + 3, key.end());
+    seen[key] = i;
+  }
+}
+
+/* the direction in which a face walks one of its edges */
+static int face_edge_dir(Object const* face, Object const* edge) {
+  for (auto const& loop_use : face->used) {
+    for (auto const& edge_use : loop_use.obj->used) {
+      if (edge_use.obj.get() == edge) return loop_use.dir ^ edge_use.dir;
+    }
+  }
+  return -1;
+}
+
+/* Faces of the same type bounded by the same set of edges are
+   merged, flipping uses of the duplicate if it walks its outer
+   loop the other way around. */
+static void merge_faces(std::vector<ObjPtr> const& closure,
+    Merges& merges) {
+  std::unordered_map<MergeKey, std::size_t, MergeKeyHash> seen;
+  for (std::size_t i = 0; i < closure.size(); ++i) {
+    auto f = closure[i].get();
+    if (type_dims[f->type] != 2 || f->used.empty()) continue;
+    MergeKey key;
+    for (auto const& loop_use : f->used) {
+      for (auto const& edge_use : loop_use.obj->used) {
+        key.push_back(key_of(edge_use.obj.get()));
+      }
+    }
+    if (key.empty()) continue;
+    std::sort(key.begin(), key.end());
+    key.push_back(std::uintptr_t(f->type));
+    auto it = seen.find(key);
+    if (it == seen.end()) {
+      seen[key] = i;
+      continue;
+    }
+    auto original = closure[it->second].get();
+    auto edge = f->used[0].obj->used[0].obj.get();
+    auto flip = face_edge_dir(f, edge) ^ face_edge_dir(original, edge);
+    merges.add(f, closure[it->second], flip);
+  }
+}
+
+int merge_coincident(ObjPtr root, double tolerance) {
+  GMOD_TIME(STATS_WELD);
+  assert(tolerance > 0);
+  Merges merges;
+  auto closure = get_closure(root, true, true);
+  merge_points(closure, tolerance, merges);
+  merges.redirect(closure);
+  merge_edges(closure, merges);
+  merges.redirect(closure);
+  merge_faces(closure, merges);
+  merges.redirect(closure);
+  auto count = static_cast<int>(merges.by.size());
+  if (count) invalidate_closures();
+  return count;
+}
+
+Box empty_box() {
+  auto inf = std::numeric_limits<double>::infinity();
+  return Box{Vector{inf, inf, inf}, Vector{-inf, -inf, -inf}};
+}
+
+static Box point_box(Vector p) { return Box{p, p}; }
+
+SizeField box_size_field(Box box, double size_in, double size_out) {
+  auto number = [](double x) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.17g", x);
+    return std::string(text);
+  };
+  SizeField field;
+  field.type = "Box";
+  field.options = {{"VIn", number(size_in)}, {"VOut", number(size_out)},
+      {"XMin", number(box.lo.x)}, {"XMax", number(box.hi.x)},
+      {"YMin", number(box.lo.y)}, {"YMax", number(box.hi.y)},
+      {"ZMin", number(box.lo.z)}, {"ZMax", number(box.hi.z)}};
+  return field;
+}
+
+Box unite_boxes(Box a, Box b) {
+  return Box{Vector{std::min(a.lo.x, b.lo.x), std::min(a.lo.y, b.lo.y),
+                    std::min(a.lo.z, b.lo.z)},
+             Vector{std::max(a.hi.x, b.hi.x), std::max(a.hi.y, b.hi.y),
+                    std::max(a.hi.z, b.hi.z)}};
+}
+
+bool box_contains(Box outer, Box inner, double tolerance) {
+  return inner.lo.x >= outer.lo.x - tolerance &&
+         inner.lo.y >= outer.lo.y - tolerance &&
+         inner.lo.z >= outer.lo.z - tolerance &&
+         inner.hi.x <= outer.hi.x + tolerance &&
+         inner.hi.y <= outer.hi.y + tolerance &&
+         inner.hi.z <= outer.hi.z + tolerance;
+}
+
+bool boxes_overlap(Box a, Box b, double tolerance) {
+  return a.lo.x < b.hi.x - tolerance && b.lo.x < a.hi.x - tolerance &&
+         a.lo.y < b.hi.y - tolerance && b.lo.y < a.hi.y - tolerance &&
+         a.lo.z < b.hi.z - tolerance && b.lo.z < a.hi.z - tolerance;
+}
+
+/* the endpoints, plus the points of the circle furthest along
+   each axis that fall between them (arcs span less than pi) */
+static Box arc_box(Object const* arc) {
+  auto c = arc_center_view(arc)->pos;
+  auto ca = subtract_vectors(edge_point_view(arc, 0)->pos, c);
+  auto cb = subtract_vectors(edge_point_view(arc, 1)->pos, c);
+  auto box = unite_boxes(point_box(c + ca), point_box(c + cb));
+  auto n = cross_product(ca, cb);
+  if (vector_norm(n) == 0) return box;
+  n = normalize_vector(n);
+  auto r = vector_norm(ca);
+  Vector const axes[3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  for (auto axis : axes) {
+    auto in_plane = subtract_vectors(axis,
+        scale_vector(dot_product(axis, n), n));
+    if (vector_norm(in_plane) == 0) continue;
+    in_plane = scale_vector(r, normalize_vector(in_plane));
+    for (int sign = -1; sign <= 1; sign += 2) {
+      auto cq = scale_vector(sign, in_plane);
+      if (dot_product(cross_product(ca, cq), n) >= 0 &&
+          dot_product(cross_product(cq, cb), n) >= 0)
+        box = unite_boxes(box, point_box(c + cq));
+    }
+  }
+  return box;
+}
+
+/* a quarter ellipse lies in the parallelogram its center and
+   endpoints span */
+static Box ellipse_box(Object const* e) {
+  auto c = ellipse_center_view(e)->pos;
+  auto a = edge_point_view(e, 0)->pos;
+  auto b = edge_point_view(e, 1)->pos;
+  auto box = unite_boxes(point_box(c), point_box(a));
+  box = unite_boxes(box, point_box(b));
+  return unite_boxes(box, point_box(a + (b - c)));
+}
+
+static Box compute_box(Object const* o) {
+  switch (o->type) {
+    case POINT:
+      return point_box(static_cast<Point const*>(o)->pos);
+    case ARC:
+      return arc_box(o);
+    case ELLIPSE:
+      return ellipse_box(o);
+    case INSTANCE: {
+      auto instance = static_cast<Instance const*>(o);
+      auto inner = get_box(instance->prototype);
+      auto box = empty_box();
+      for (int i = 0; i < 8; ++i) {
+        Vector corner{(i & 1) ? inner.hi.x : inner.lo.x,
+                      (i & 2) ? inner.hi.y : inner.lo.y,
+                      (i & 4) ? inner.hi.z : inner.lo.z};
+        box = unite_boxes(box, point_box(add_vectors(
+            matrix_vector_product(instance->linear, corner),
+            instance->translation)));
+      }
+      return box;
+    }
+    default: {
+      auto box = empty_box();
+      for (auto const& use : o->used) box = unite_boxes(box, get_box(use.obj));
+      if (o->type == SPLINE) {
+        for (auto const& h : o->helpers) box = unite_boxes(box, get_box(h));
+      }
+      return box;
+    }
+  }
+}
+
+/* the box is computed outside the lock, which the boxes of the
+   children take in turn */
+Box get_box(ObjPtr const& o) {
+  if (o->type == POINT) return compute_box(o.get());
+  auto generation = observe_generation();
+  {
+    std::lock_guard<std::mutex> lock(closure_cache_lock(o.get()));
+    auto cache = o->closure_cache;
+    if (cache && cache->box_valid && cache->box_generation == generation)
+      return cache->box;
+  }
+  auto box = compute_box(o.get());
+  std::lock_guard<std::mutex> lock(closure_cache_lock(o.get()));
+  if (!o->closure_cache) o->closure_cache = new ClosureCache();
+  auto cache = o->closure_cache;
+  cache->box = box;
+  cache->box_valid = true;
+  cache->box_generation = generation;
+  return box;
+}
+
+enum { BOX_TREE_LEAF = 4 };
+
+static int build_box_node(BoxTree& tree, std::vector<Vector> const& centers,
+    std::size_t first, std::size_t end) {
+  auto node = static_cast<int>(tree.nodes.size());
+  tree.nodes.push_back(BoxTree::Node{empty_box(), first, end, -1, -1});
+  auto box = empty_box();
+  auto spread = empty_box();
+  for (auto i = first; i < end; ++i) {
+    box = unite_boxes(box, tree.boxes[i]);
+    spread = unite_boxes(spread, point_box(centers[tree.order[i]]));
+  }
+  tree.nodes[std::size_t(node)].box = box;
+  if (end - first <= BOX_TREE_LEAF) return node;
+  auto extent = spread.hi - spread.lo;
+  int axis = 0;
+  if (extent.y > extent.x) axis = 1;
+  if (extent.z > (axis ? extent.y : extent.x)) axis = 2;
+  auto coord = [&](std::size_t i) {
+    auto c = centers[i];
+    return axis == 0 ? c.x : (axis == 1 ? c.y : c.z);
+  };
+  auto middle = first + (end - first) / 2;
+  /* order is permuted and boxes follow it after the split */
+  std::nth_element(tree.order.begin() + std::ptrdiff_t(first),
+      tree.order.begin() + std::ptrdiff_t(middle),
+      tree.order.begin() + std::ptrdiff_t(end),
+      [&](std::size_t a, std::size_t b) { return coord(a) < coord(b); });
+  for (auto i = first; i < end; ++i)
+    tree.boxes[i] = get_box(tree.objects[tree.order[i]]);
+  auto left = build_box_node(tree, centers, first, middle);
+  auto right = build_box_node(tree, centers, middle, end);
+  tree.nodes[std::size_t(node)].left = left;
+  tree.nodes[std::size_t(node)].right = right;
+  return node;
+}
+
+BoxTree build_box_tree(std::vector<ObjPtr> const& objects) {
+  BoxTree tree;
+  tree.objects = objects;
+  tree.boxes.reserve(objects.size());
+  std::vector<Vector> centers;
+  centers.reserve(objects.size());
+  for (std::size_t i = 0; i < objects.size(); ++i) {
+    tree.order.push_back(i);
+    tree.boxes.push_back(get_box(objects[i]));
+    auto const& b = tree.boxes.back();
+    centers.push_back((b.lo + b.hi) / 2);
+  }
+  if (!objects.empty()) build_box_node(tree, centers, 0, objects.size());
+  return tree;
+}
+
+std::vector<std::size_t> find_overlapping(BoxTree const& tree, Box box,
+    double tolerance) {
+  std::vector<std::size_t> found;
+  if (tree.nodes.empty()) return found;
+  std::vector<int> stack(1, 0);
+  while (!stack.empty()) {
+    auto const& node = tree.nodes[std::size_t(stack.back())];
+    stack.pop_back();
+    if (!boxes_overlap(node.box, box, tolerance)) continue;
+    if (node.left < 0) {
+      for (auto i = node.first; i < node.end; ++i) {
+        if (boxes_overlap(tree.boxes[i], box, tolerance))
+          found.push_back(tree.order[i]);
+      }
+    } else {
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+    }
+  }
+  return found;
+}
+
+static void report_inclusion(Object const* host, Object const* o,
+    char const* problem) {
+  fprintf(stderr, "%s %d %s %s %d\n", type_names[o->type], o->id, problem,
+      type_names[host->type], host->id);
+}
+
+/* What the exact overlap test knows of a hole. ROUND holes are
+   balls or disks, every edge an arc about one center; CONVEX holes
+   have straight edges and every corner on one side of each plane
+   through a face (of a shell) or through an edge along the normal
+   (of a loop). Any other hole only has its box. */
+struct HoleShape {
+  enum { UNKNOWN, OTHER, ROUND, CONVEX } kind;
+  bool flat;
+  Vector center;
+  double radius;
+  std::vector<Vector> corners;
+  std::vector<Vector> normals;
+  std::vector<Vector> edges;
+};
+
+static bool one_side(std::vector<Vector> const& corners, Vector p, Vector n,
+    double tolerance) {
+  bool below = false, above = false;
+  for (auto c : corners) {
+    auto d = dot_product(subtract_vectors(c, p), n);
+    if (d < -tolerance) below = true;
+    if (d > tolerance) above = true;
+  }
+  return !(below && above);
+}
+
+static Vector loop_start(Object const* loop, std::size_t k) {
+  auto const& use = loop->used[k];
+  return edge_point_view(use.obj.get(), use.dir == REVERSE ? 1 : 0)->pos;
+}
+
+/* Newell's normal */
+static Vector loop_normal(Object const* loop) {
+  Vector n{0, 0, 0};
+  auto count = loop->used.size();
+  for (std::size_t k = 0; k < count; ++k) {
+    auto a = loop_start(loop, k);
+    auto b = loop_start(loop, (k + 1) % count);
+    n = add_vectors(n, cross_product(a, b));
+  }
+  return vector_norm(n) == 0 ? n : normalize_vector(n);
+}
+
+static HoleShape hole_shape(Object const* hole, double tolerance) {
+  HoleShape shape;
+  shape.kind = HoleShape::OTHER;
+  shape.flat = (hole->type == LOOP);
+  std::vector<Object const*> loops;
+  bool straight = true;
+  if (shape.flat) {
+    loops.push_back(hole);
+  } else {
+    for (auto const& face : hole->used) {
+      auto const& face_loops = face.obj->used;
+      straight = straight && face.obj->type == PLANE && face_loops.size() == 1;
+      for (auto const& loop : face_loops) loops.push_back(loop.obj.get());
+    }
+  }
+  if (loops.empty() || loops[0]->used.empty()) return shape;
+  bool round = true;
+  for (auto loop : loops) {
+    for (auto const& use : loop->used) {
+      auto edge = use.obj.get();
+      round = round && edge->type == ARC;
+      straight = straight && edge->type == LINE;
+    }
+  }
+  if (round) {
+    auto first = loops[0]->used[0].obj.get();
+    shape.center = arc_center_view(first)->pos;
+    shape.radius = vector_norm(edge_point_view(first, 0)->pos - shape.center);
+    for (auto loop : loops) {
+      for (auto const& use : loop->used) {
+        auto edge = use.obj.get();
+        if (vector_norm(arc_center_view(edge)->pos - shape.center) >
+            tolerance)
+          return shape;
+        for (int i = 0; i < 2; ++i) {
+          auto r = vector_norm(edge_point_view(edge, i)->pos - shape.center);
+          if (fabs(r - shape.radius) > tolerance) return shape;
+        }
+      }
+    }
+    shape.kind = HoleShape::ROUND;
+    return shape;
+  }
+  if (!straight) return shape;
+  for (auto loop : loops) {
+    for (std::size_t k = 0; k < loop->used.size(); ++k) {
+      auto edge = loop->used[k].obj.get();
+      shape.corners.push_back(loop_start(loop, k));
+      shape.edges.push_back(
+          edge_point_view(edge, 1)->pos - edge_point_view(edge, 0)->pos);
+    }
+  }
+  for (auto loop : loops) {
+    auto n = loop_normal(loop);
+    if (vector_norm(n) == 0) return shape;
+    if (!shape.flat) {
+      if (!one_side(shape.corners, loop_start(loop, 0), n, tolerance))
+        return shape;
+      shape.normals.push_back(n);
+      continue;
+    }
+    for (std::size_t k = 0; k < loop->used.size(); ++k) {
+      auto in_plane = cross_product(n, shape.edges[k]);
+      if (vector_norm(in_plane) == 0) continue;
+      in_plane = normalize_vector(in_plane);
+      if (!one_side(shape.corners, shape.corners[k], in_plane, tolerance))
+        return shape;
+      shape.normals.push_back(in_plane);
+    }
+  }
+  shape.kind = HoleShape::CONVEX;
+  return shape;
+}
+
+/* whether the projections onto axis overlap by more than the
+   tolerance */
+static bool overlap_along(HoleShape const& a, HoleShape const& b,
+    Vector axis, double tolerance) {
+  auto n = vector_norm(axis);
+  if (n < 1e-12) return true;
+  axis = scale_vector(1.0 / n, axis);
+  double lo[2] = {HUGE_VAL, HUGE_VAL}, hi[2] = {-HUGE_VAL, -HUGE_VAL};
+  HoleShape const* shapes[2] = {&a, &b};
+  for (int s = 0; s < 2; ++s) {
+    for (auto c : shapes[s]->corners) {
+      auto d = dot_product(c, axis);
+      lo[s] = std::min(lo[s], d);
+      hi[s] = std::max(hi[s], d);
+    }
+  }
+  return lo[0] < hi[1] - tolerance && lo[1] < hi[0] - tolerance;
+}
+
+/* 1 if the interiors overlap, 0 if they don't and -1 if only the
+   boxes tell. Convex holes are separated along one of the
+   separating axes: a face normal of either, or the cross product
+   of an edge of each (holes of a face share its plane, so flat
+   holes need only the normals within it). */
+static int holes_overlap(HoleShape const& a, HoleShape const& b,
+    double tolerance) {
+  if (a.kind == HoleShape::ROUND && b.kind == HoleShape::ROUND)
+    return vector_norm(a.center - b.center) <
+           a.radius + b.radius - tolerance;
+  if (a.kind != HoleShape::CONVEX || b.kind != HoleShape::CONVEX ||
+      a.flat != b.flat)
+    return -1;
+  for (auto const* shape : {&a, &b}) {
+    for (auto n : shape->normals)
+      if (!overlap_along(a, b, n, tolerance)) return 0;
+  }
+  if (!a.flat) {
+    for (auto ea : a.edges) {
+      for (auto eb : b.edges) {
+        auto axis = cross_product(ea, eb);
+        if (vector_norm(axis) < 1e-12 * vector_norm(ea) * vector_norm(eb))
+          continue;
+        if (!overlap_along(a, b, axis, tolerance)) return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+int check_inclusions(ObjPtr root, double tolerance) {
+  int problems = 0;
+  for (auto const& host : get_closure(root, false, true)) {
+    auto is_host = (is_face(host->type) || host->type == VOLUME);
+    if (!host->embedded.empty()) {
+      auto box = get_box(host);
+      for (auto const& e : host->embedded) {
+        if (!box_contains(box, get_box(e), tolerance)) {
+          report_inclusion(host.get(), e.get(), "is embedded outside");
+          ++problems;
+        }
+      }
+    }
+    if (!is_host || host->used.size() < 2) continue;
+    auto outer = get_box(host->used[0].obj);
+    std::vector<ObjPtr> holes;
+    for (std::size_t i = 1; i < host->used.size(); ++i) {
+      auto const& hole = host->used[i].obj;
+      holes.push_back(hole);
+      if (!box_contains(outer, get_box(hole), tolerance)) {
+        report_inclusion(host.get(), hole.get(), "sticks out of");
+        ++problems;
+      }
+    }
+    auto tree = build_box_tree(holes);
+    std::vector<HoleShape> shapes(holes.size());
+    auto shape_of = [&](std::size_t i) -> HoleShape const& {
+      if (shapes[i].kind == HoleShape::UNKNOWN)
+        shapes[i] = hole_shape(holes[i].get(), tolerance);
+      return shapes[i];
+    };
+    /* the holes of a face parallel to an axis have boxes flat along
+       it, which only overlap a query that spans their thickness */
+    auto across = [&](Box b) {
+      auto grow = 2 * tolerance;
+      if (outer.hi.x - outer.lo.x <= tolerance) {
+        b.lo.x -= grow;
+        b.hi.x += grow;
+      }
+      if (outer.hi.y - outer.lo.y <= tolerance) {
+        b.lo.y -= grow;
+        b.hi.y += grow;
+      }
+      if (outer.hi.z - outer.lo.z <= tolerance) {
+        b.lo.z -= grow;
+        b.hi.z += grow;
+      }
+      return b;
+    };
+    for (std::size_t i = 0; i < holes.size(); ++i) {
+      auto query = across(get_box(holes[i]));
+      for (auto j : find_overlapping(tree, query, tolerance)) {
+        if (j <= i) continue;
+        auto overlap = holes_overlap(shape_of(i), shape_of(j), tolerance);
+        if (overlap == 0) continue;
+        fprintf(stderr, "%s %d and %s %d %s inside %s %d\n",
+            type_names[holes[i]->type], holes[i]->id,
+            type_names[holes[j]->type], holes[j]->id,
+            overlap > 0 ? "overlap" : "may overlap",
+            type_names[host->type], host->id);
+        if (overlap > 0) ++problems;
+      }
+    }
+  }
+  return problems;
+}
+
+struct BinaryHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t nobjects;
+  std::uint32_t npoints;
+  std::uint32_t nuses;
+  std::uint32_t nhelpers;
+  std::uint32_t nembedded;
+};
+
+static char const binary_magic[8] = {'G', 'M', 'O', 'D', 'B', 'I', 'N', '\0'};
+
+enum { BINARY_VERSION = 1 };
+
+static std::size_t padded(std::size_t nbytes) { return (nbytes + 7) & ~std::size_t(7); }
+
+template <typename T>
+static void write_section(Sink& sink, std::vector<T> const& v) {
+  static char const zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+  auto nbytes = v.size() * sizeof(T);
+  if (nbytes) sink.write(reinterpret_cast<char const*>(v.data()), nbytes);
+  sink.write(zeros, padded(nbytes) - nbytes);
+}
+
+/* where the objects of the closure being written are stored */
+struct ClosurePositions {
+  ObjectIndex const* indices;
+  std::uint32_t of(Object const* o) const {
+    return std::uint32_t(indices->find(o));
+  }
+};
+
+/* where the objects of an instance's copy are stored */
+struct InstancePositions {
+  PrototypeLayout const* layout;
+  std::uint32_t first;
+  std::uint32_t of(Object const* o) const {
+    return first + std::uint32_t(layout->indices.find(o));
+  }
+};
+
+static std::uint32_t const no_point = ~std::uint32_t(0);
+
+template <class Numbering, class Positions>
+static void append_binary_object(FrozenModel& t, Object const* co,
+    Numbering const& num, Positions const& positions) {
+  t.types.push_back(static_cast<std::int8_t>(co->type));
+  t.ids.push_back(num.id(co));
+  if (co->type == POINT) {
+    auto p = static_cast<Point const*>(co);
+    auto pos = num.pos(p);
+    t.point_of.push_back(std::uint32_t(t.coords[0].size()));
+    t.coords[0].push_back(pos.x);
+    t.coords[1].push_back(pos.y);
+    t.coords[2].push_back(pos.z);
+    t.coords[3].push_back(p->size);
+  } else {
+    t.point_of.push_back(no_point);
+  }
+  for (auto const& use : co->used) {
+    auto idx = positions.of(use.obj.get());
+    t.entries[0].push_back((idx << 1) | std::uint32_t(use.dir));
+  }
+  for (auto const& h : co->helpers)
+    t.entries[1].push_back(positions.of(h.get()));
+  for (auto const& e : co->embedded)
+    t.entries[2].push_back(positions.of(e.get()));
+  for (int l = 0; l < 3; ++l)
+    t.offsets[l].push_back(std::uint32_t(t.entries[l].size()));
+}
+
+/* Lays a closure out as flat tables: objects appear children-first,
+   so each use, helper and embedded entry refers to an earlier object;
+   uses hold the object index shifted left once, with the direction
+   in bit 0. Instances are laid out as the copies they stand for,
+   which take up the positions up to the one of the instance itself. */
+static void tabulate_closure(ObjPtr const& obj, FrozenModel& t) {
+  ObjectIndex indices;
+  auto closure = get_closure(obj, true, true, indices);
+  InstanceLayouts layouts(closure);
+  int next = 0;
+  for (auto const& co : closure) {
+    if (co->type == INSTANCE)
+      next += static_cast<int>(layouts.of(co.get()).objects.size());
+    else
+      ++next;
+    indices.assign(co.get(), next - 1);
+  }
+  for (auto& o : t.offsets) o.push_back(0);
+  for (auto const& co : closure) {
+    if (co->type == INSTANCE) {
+      auto const& layout = layouts.of(co.get());
+      InstanceNumbering num{as_instance(co), &layout,
+          as_instance(co)->first_id};
+      auto first = std::uint32_t(t.types.size());
+      for (auto const& o : layout.objects) {
+        append_binary_object(t, o.get(), num,
+            InstancePositions{&layout, first});
+      }
+    } else {
+      append_binary_object(t, co.get(), OwnNumbering(),
+          ClosurePositions{&indices});
+    }
+  }
+}
+
+void write_closure_to_binary(FrozenModel const& t, Sink& sink) {
+  GMOD_TIME(STATS_WRITE);
+  auto const& types = t.types;
+  auto const& ids = t.ids;
+  auto const& coords = t.coords;
+  auto const& offsets = t.offsets;
+  auto const& entries = t.entries;
+  BinaryHeader header;
+  memcpy(header.magic, binary_magic, sizeof(binary_magic));
+  header.version = BINARY_VERSION;
+  header.nobjects = std::uint32_t(types.size());
+  header.npoints = std::uint32_t(coords[0].size());
+  header.nuses = std::uint32_t(entries[0].size());
+  header.nhelpers = std::uint32_t(entries[1].size());
+  header.nembedded = std::uint32_t(entries[2].size());
+  sink.write(reinterpret_cast<char const*>(&header), sizeof(header));
+  write_section(sink, types);
+  write_section(sink, ids);
+  for (auto const& c : coords) write_section(sink, c);
+  for (int l = 0; l < 3; ++l) {
+    write_section(sink, offsets[l]);
+    write_section(sink, entries[l]);
+  }
+}
+
+void write_closure_to_binary(ObjPtr obj, Sink& sink) {
+  GMOD_TIME(STATS_WRITE);
+  write_closure_to_binary(freeze(obj), sink);
+}
+
+void write_closure_to_binary(ObjPtr obj, char const* filename) {
+  FILE* f = fopen(filename, "wb");
+  FileSink sink(f);
+  write_closure_to_binary(obj, sink);
+  fclose(f);
+}
+
+static void bad_binary(char const* why) {
+  fprintf(stderr, "bad binary gmodel file: %s\n", why);
+  abort();
+}
+
+/* The checks of a binary model return why it is malformed, or
+   nullptr if it is not, so that callers like the memo cache can
+   treat a bad file as missing instead of aborting. */
+
+template <typename T>
+static char const* read_section(char const*& pos, char const* end,
+    std::size_t n, T const*& section) {
+  auto nbytes = padded(n * sizeof(T));
+  if (std::size_t(end - pos) < nbytes) return "truncated";
+  section = reinterpret_cast<T const*>(pos);
+  pos += nbytes;
+  return nullptr;
+}
+
+static char const* check_list(std::uint32_t const* offsets,
+    std::uint32_t const* entries, std::uint32_t n, std::uint32_t nentries,
+    int shift) {
+  if (offsets[0] != 0 || offsets[n] != nentries) return "bad offsets";
+  for (std::uint32_t i = 0; i < n; ++i) {
+    if (offsets[i] > offsets[i + 1]) return "bad offsets";
+    for (auto j = offsets[i]; j < offsets[i + 1]; ++j) {
+      if ((entries[j] >> shift) >= i) return "forward reference";
+    }
+  }
+  return nullptr;
+}
+
+/* whether the uses and helpers of object i, which refer to earlier
+   objects, are the ones its type needs, as the .geo reader demands */
+static char const* check_object(std::uint32_t i, int type,
+    std::int8_t const* types, std::uint32_t const* const* offsets,
+    std::uint32_t const* const* entries) {
+  auto nuses = offsets[0][i + 1] - offsets[0][i];
+  auto nhelpers = offsets[1][i + 1] - offsets[1][i];
+  auto used = [&](std::uint32_t k) {
+    return int(types[entries[0][offsets[0][i] + k] >> 1]);
+  };
+  int kind = -1;
+  switch (type) {
+    case POINT:
+      if (nuses || nhelpers) return "a point uses other objects";
+      break;
+    case LINE:
+      if (nuses != 2 || nhelpers) return "a line needs two points";
+      kind = POINT;
+      break;
+    case ARC:
+      if (nuses != 2 || nhelpers != 1)
+        return "an arc needs two points and a center";
+      kind = POINT;
+      break;
+    case ELLIPSE:
+      if (nuses != 2 || nhelpers != 2)
+        return "an ellipse needs two points, a center and an axis";
+      kind = POINT;
+      break;
+    case SPLINE:
+      if (nuses != 2) return "a spline needs two end points";
+      kind = POINT;
+      break;
+    case PLANE:
+    case RULED:
+      if (!nuses || nhelpers) return "a face needs loops";
+      kind = LOOP;
+      break;
+    case VOLUME:
+      if (!nuses || nhelpers) return "a volume needs shells";
+      kind = SHELL;
+      break;
+    case LOOP:
+      if (!nuses || nhelpers) return "a loop needs edges";
+      for (std::uint32_t k = 0; k < nuses; ++k) {
+        if (type_dims[used(k)] != 1) return "a loop needs edges";
+      }
+      break;
+    case SHELL:
+      if (!nuses || nhelpers) return "a shell needs faces";
+      for (std::uint32_t k = 0; k < nuses; ++k) {
+        if (!is_face(used(k))) return "a shell needs faces";
+      }
+      break;
+    case GROUP:
+      if (nhelpers) return "a group has helpers";
+      break;
+  }
+  if (kind >= 0) {
+    for (std::uint32_t k = 0; k < nuses; ++k) {
+      if (used(k) != kind) return "use of the wrong kind of object";
+    }
+  }
+  for (auto j = offsets[1][i]; j < offsets[1][i + 1]; ++j) {
+    if (types[entries[1][j]] != POINT) return "a helper is not a point";
+  }
+  for (auto j = offsets[2][i]; j < offsets[2][i + 1]; ++j) {
+    if (!is_entity(types[entries[2][j]]) || !is_entity(type))
+      return "embedding of a non-entity";
+  }
+  return nullptr;
+}
+
+/* the sections of a binary model, laid over its bytes */
+struct BinaryTables {
+  std::uint32_t n;
+  std::int8_t const* types;
+  std::int32_t const* ids;
+  double const* coords[4];
+  std::uint32_t const* offsets[3];
+  std::uint32_t const* entries[3];
+};
+
+static char const* check_binary(char const* data, std::size_t size,
+    BinaryTables& t) {
+  BinaryHeader header;
+  if (reinterpret_cast<std::uintptr_t>(data) % alignof(double))
+    return "data is not 8-byte aligned";
+  if (size < sizeof(header)) return "truncated";
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, binary_magic, sizeof(binary_magic)))
+    return "not a binary gmodel file";
+  if (header.version != BINARY_VERSION) return "unknown version";
+  auto n = header.nobjects;
+  if (n == 0) return "empty";
+  /* the offset sections hold n + 1 entries */
+  if (n == std::numeric_limits<std::uint32_t>::max())
+    return "too many objects";
+  t.n = n;
+  char const* pos = data + sizeof(header);
+  char const* end = data + size;
+  char const* why;
+  if ((why = read_section(pos, end, n, t.types))) return why;
+  if ((why = read_section(pos, end, n, t.ids))) return why;
+  for (auto& c : t.coords)
+    if ((why = read_section(pos, end, header.npoints, c))) return why;
+  std::uint32_t const nentries[3] = {header.nuses, header.nhelpers,
+                                     header.nembedded};
+  for (int l = 0; l < 3; ++l) {
+    if ((why = read_section(pos, end, n + 1, t.offsets[l]))) return why;
+    if ((why = read_section(pos, end, nentries[l], t.entries[l])))
+      return why;
+    if ((why = check_list(t.offsets[l], t.entries[l], n, nentries[l],
+             l == 0 ? 1 : 0)))
+      return why;
+  }
+  std::uint32_t npoints = 0;
+  for (std::uint32_t i = 0; i < n; ++i) {
+    auto type = int(t.types[i]);
+    if (type < 0 || type >= NTYPES || type == INSTANCE) return "bad type";
+    if ((why = check_object(i, type, t.types, t.offsets, t.entries)))
+      return why;
+    if (type == POINT) ++npoints;
+  }
+  if (npoints != header.npoints) return "wrong number of points";
+  return nullptr;
+}
+
+/* builds the objects of checked tables, whose lists only refer
+   to earlier objects, and returns the last */
+static ObjPtr build_from_tables(BinaryTables const& t) {
+  auto n = t.n;
+  auto types = t.types;
+  auto ids = t.ids;
+  auto coords = t.coords;
+  auto offsets = t.offsets;
+  auto entries = t.entries;
+  std::vector<ObjPtr> objs(n);
+  std::uint32_t point = 0;
+  int max_id = -1;
+  for (std::uint32_t i = 0; i < n; ++i) {
+    auto type = int(types[i]);
+    ObjPtr obj;
+    if (type == POINT) {
+      obj = new_point3(Vector{coords[0][point], coords[1][point],
+                              coords[2][point]},
+                       coords[3][point]);
+      ++point;
+    } else {
+      obj = new_object(type);
+    }
+    obj->id = ids[i];
+    max_id = std::max(max_id, ids[i]);
+    obj->used.reserve(offsets[0][i + 1] - offsets[0][i]);
+    for (auto j = offsets[0][i]; j < offsets[0][i + 1]; ++j) {
+      obj->used.push_back(
+          Use{int(entries[0][j] & 1), objs[entries[0][j] >> 1]});
+    }
+    for (auto j = offsets[1][i]; j < offsets[1][i + 1]; ++j)
+      obj->helpers.push_back(objs[entries[1][j]]);
+    for (auto j = offsets[2][i]; j < offsets[2][i + 1]; ++j)
+      obj->embedded.push_back(objs[entries[2][j]]);
+    objs[i] = obj;
+  }
+  GMOD_COUNT(uses, offsets[0][n]);
+  GMOD_COUNT(helpers, offsets[1][n]);
+  (current_model ? current_model->ids : global_ids).skip_past(max_id);
+  invalidate_closures();
+  return objs.back();
+}
+
+ObjPtr read_closure_from_binary(char const* data, std::size_t size) {
+  BinaryTables tables;
+  if (auto why = check_binary(data, size, tables)) bad_binary(why);
+  return build_from_tables(tables);
+}
+
+/* read-only private mapping of a whole file */
+struct MappedFile {
+  MappedFile(char const* filename) : data(nullptr), size(0) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+      perror(filename);
+      abort();
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size = std::size_t(st.st_size);
+    if (size) {
+      void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        perror(filename);
+        abort();
+      }
+      madvise(p, size, MADV_SEQUENTIAL);
+      data = static_cast<char const*>(p);
+    }
+    close(fd);
+  }
+  ~MappedFile() {
+    if (data) munmap(const_cast<char*>(data), size);
+  }
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+  char const* data;
+  std::size_t size;
+};
+
+ObjPtr read_closure_from_binary(char const* filename) {
+  MappedFile file(filename);
+  if (file.size == 0) bad_binary("empty file");
+  return read_closure_from_binary(file.data, file.size);
+}
+
+std::size_t FrozenModel::bytes() const {
+  auto total = types.size() * sizeof(types[0]) + ids.size() * sizeof(ids[0]) +
+               point_of.size() * sizeof(point_of[0]);
+  for (auto const& c : coords) total += c.size() * sizeof(double);
+  for (int l = 0; l < 3; ++l) {
+    total += (offsets[l].size() + entries[l].size()) * sizeof(std::uint32_t);
+  }
+  return total;
+}
+
+FrozenModel freeze(ObjPtr obj) {
+  FrozenModel frozen;
+  tabulate_closure(obj, frozen);
+  return frozen;
+}
+
+ObjPtr thaw(FrozenModel const& f) {
+  GMOD_TIME(STATS_COPY);
+  BinaryTables t;
+  t.n = std::uint32_t(f.types.size());
+  t.types = f.types.data();
+  t.ids = f.ids.data();
+  for (int c = 0; c < 4; ++c) t.coords[c] = f.coords[c].data();
+  for (int l = 0; l < 3; ++l) {
+    t.offsets[l] = f.offsets[l].data();
+    t.entries[l] = f.entries[l].data();
+  }
+  return build_from_tables(t);
+}
+
+/* the same breadth-first order as get_closure on the objects */
+std::vector<std::uint32_t> get_closure(FrozenModel const& f,
+    std::uint32_t root, bool include_helpers, bool include_embedded) {
+  GMOD_COUNT(closure_traversals, 1);
+  std::vector<bool> visited(f.types.size(), false);
+  std::vector<std::uint32_t> queue(1, root);
+  visited[root] = true;
+  auto visit = [&](std::uint32_t o) {
+    if (!visited[o]) {
+      visited[o] = true;
+      queue.push_back(o);
+    }
+  };
+  for (std::size_t first = 0; first != queue.size(); ++first) {
+    auto current = queue[first];
+    for (auto j = f.offsets[0][current]; j < f.offsets[0][current + 1]; ++j)
+      visit(f.entries[0][j] >> 1);
+    if (include_helpers) {
+      for (auto j = f.offsets[1][current]; j < f.offsets[1][current + 1]; ++j)
+        visit(f.entries[1][j]);
+    }
+    if (include_embedded) {
+      for (auto j = f.offsets[2][current]; j < f.offsets[2][current + 1]; ++j)
+        visit(f.entries[2][j]);
+    }
+  }
+  std::reverse(queue.begin(), queue.end());
+  return queue;
+}
+
+int count_of_dim(FrozenModel const& f, std::vector<std::uint32_t> const& objs,
+    int dim) {
+  int count = 0;
+  for (auto o : objs)
+    if (type_dims[f.types[o]] == dim) ++count;
+  return count;
+}
+
+static void gather_frozen_cells(FrozenModel const& f, std::uint32_t assembly,
+    std::vector<std::uint32_t>& cells) {
+  for (auto j = f.offsets[0][assembly]; j < f.offsets[0][assembly + 1]; ++j) {
+    auto o = f.entries[0][j] >> 1;
+    if (f.types[o] == GROUP) gather_frozen_cells(f, o, cells);
+    else cells.push_back(o);
+  }
+}
+
+std::vector<std::uint32_t> collect_assembly_boundary(FrozenModel const& f,
+    std::uint32_t assembly) {
+  std::vector<std::uint32_t> cells;
+  gather_frozen_cells(f, assembly, cells);
+  std::vector<std::uint32_t> uses;
+  for (auto cell : cells) {
+    if (type_dims[f.types[cell]] != type_dims[f.types[cells[0]]]) {
+      fprintf(stderr, "gmodel: assembly %d mixes %s %d with %s cells\n",
+          f.ids[assembly], type_names[f.types[cell]], f.ids[cell],
+          type_names[f.types[cells[0]]]);
+      abort();
+    }
+    for (auto j = f.offsets[0][cell]; j < f.offsets[0][cell + 1]; ++j) {
+      auto boundary = f.entries[0][j] >> 1;
+      auto dir = f.entries[0][j] & 1;
+      for (auto k = f.offsets[0][boundary]; k < f.offsets[0][boundary + 1]; ++k)
+        uses.push_back(f.entries[0][k] ^ dir);
+    }
+  }
+  std::vector<std::uint8_t> counts(f.types.size(), 0);
+  for (auto use : uses)
+    if (counts[use >> 1] < 2) ++counts[use >> 1];
+  std::vector<std::uint32_t> sides;
+  for (auto use : uses)
+    if (counts[use >> 1] == 1) sides.push_back(use);
+  return sides;
+}
+
+/* numbers the positions of a FrozenModel by their frozen ids, so
+   that its tables print as the objects they were frozen from */
+struct FrozenNumbering {
+  typedef std::uint32_t Handle;
+  explicit FrozenNumbering(FrozenModel const& f) : f(&f) {}
+  FrozenModel const* f;
+  int type(Handle i) const { return f->types[i]; }
+  int id(Handle i) const { return f->ids[i]; }
+  Vector pos(Handle i) const {
+    auto p = f->point_of[i];
+    return Vector{f->coords[0][p], f->coords[1][p], f->coords[2][p]};
+  }
+  double size(Handle i) const { return f->coords[3][f->point_of[i]]; }
+  std::size_t list_count(int l, Handle i) const {
+    return f->offsets[l][i + 1] - f->offsets[l][i];
+  }
+  std::uint32_t entry(int l, Handle i, std::size_t k) const {
+    return f->entries[l][f->offsets[l][i] + k];
+  }
+  std::size_t use_count(Handle i) const { return list_count(0, i); }
+  Handle use(Handle i, std::size_t k) const { return entry(0, i, k) >> 1; }
+  int use_dir(Handle i, std::size_t k) const { return entry(0, i, k) & 1; }
+  std::size_t helper_count(Handle i) const { return list_count(1, i); }
+  Handle helper(Handle i, std::size_t k) const { return entry(1, i, k); }
+  std::size_t embedded_count(Handle i) const { return list_count(2, i); }
+  Handle embedded(Handle i, std::size_t k) const { return entry(2, i, k); }
+};
+
+void print_closure(Writer& w, FrozenModel const& f) {
+  GMOD_TIME(STATS_WRITE);
+  FrozenNumbering num(f);
+  auto closure = get_closure(f, f.root(), true, true);
+  print_in_chunks(w, closure.size(), [&](Writer& cw, std::size_t i) {
+    print_object_t(cw, closure[i], num);
+  });
+  closure = get_closure(f, f.root(), false, true);
+  print_in_chunks(w, closure.size(), [&](Writer& cw, std::size_t i) {
+    print_object_physical_t(cw, closure[i], num);
+  });
+  print_size_fields(w);
+}
+
+void print_closure_dmg(Writer& w, FrozenModel const& f) {
+  GMOD_TIME(STATS_WRITE);
+  FrozenNumbering num(f);
+  auto closure = get_closure(f, f.root(), false, true);
+  std::vector<std::uint32_t> buckets[4];
+  for (auto o : closure) {
+    auto dim = type_dims[f.types[o]];
+    if (dim >= 0) buckets[dim].push_back(o);
+  }
+  for (int d = 3; d >= 0; --d) {
+    w.put_int(static_cast<long long>(buckets[d].size()));
+    w.put(d ? ' ' : '\n');
+  }
+  w.put("0 0 0\n0 0 0\n", 12);
+  for (int d = 0; d <= 3; ++d) {
+    auto const& bucket = buckets[d];
+    print_in_chunks(w, bucket.size(), [&](Writer& cw, std::size_t i) {
+      print_object_dmg_t(cw, bucket[i], num);
+    });
+  }
+}
+
+/* The closure is laid out once as tables, which stand as the
+   template of every copy. Objects and their lists are then all
+   allocated serially, since a Model is only used by one thread at
+   a time, and the copies are filled in on the thread pool: each
+   transforms its coordinates and wires its uses, helpers and
+   embedded objects into the slots reserved for it. */
+std::vector<ObjPtr> pattern_closure(ObjPtr object,
+    std::vector<Matrix> const& linears,
+    std::vector<Vector> const& translations) {
+  GMOD_TIME(STATS_COPY);
+  assert(linears.size() == translations.size());
+  FrozenModel t;
+  tabulate_closure(object, t);
+  auto n = t.types.size();
+  auto ncopies = linears.size();
+  auto np = t.coords[0].size();
+  if (auto model = current_model)
+    model->objects.reserve(model->objects.size() + n * ncopies);
+  std::vector<ObjPtr> slots(n * ncopies);
+  for (std::size_t c = 0; c < ncopies; ++c) {
+    for (std::size_t i = 0; i < n; ++i) {
+      auto type = int(t.types[i]);
+      ObjPtr obj = (type == POINT) ? ObjPtr(new_point()) : new_object(type);
+      obj->used.reserve(t.offsets[0][i + 1] - t.offsets[0][i]);
+      obj->helpers.reserve(t.offsets[1][i + 1] - t.offsets[1][i]);
+      obj->embedded.reserve(t.offsets[2][i + 1] - t.offsets[2][i]);
+      slots[c * n + i] = obj;
+    }
+  }
+  parallel_for(ncopies, [&](std::size_t c) {
+    auto copy = slots.data() + c * n;
+    std::vector<double> x(t.coords[0]);
+    std::vector<double> y(t.coords[1]);
+    std::vector<double> z(t.coords[2]);
+    transform_coordinates(x.data(), y.data(), z.data(), np, linears[c],
+        translations[c]);
+    std::size_t point = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      auto obj = copy[i].get();
+      if (obj->type == POINT) {
+        auto p = as_point(obj);
+        p->pos = Vector{x[point], y[point], z[point]};
+        p->size = t.coords[3][point];
+        ++point;
+      }
+      for (auto j = t.offsets[0][i]; j < t.offsets[0][i + 1]; ++j) {
+        auto e = t.entries[0][j];
+        obj->used.push_back(Use{int(e & 1), copy[e >> 1]});
+      }
+      for (auto j = t.offsets[1][i]; j < t.offsets[1][i + 1]; ++j)
+        obj->helpers.push_back(copy[t.entries[1][j]]);
+      for (auto j = t.offsets[2][i]; j < t.offsets[2][i + 1]; ++j)
+        obj->embedded.push_back(copy[t.entries[2][j]]);
+    }
+  });
+  GMOD_COUNT(uses, t.entries[0].size() * ncopies);
+  GMOD_COUNT(helpers, t.entries[1].size() * ncopies);
+  invalidate_closures();
+  std::vector<ObjPtr> roots(ncopies);
+  for (std::size_t c = 0; c < ncopies; ++c) roots[c] = slots[c * n + n - 1];
+  return roots;
+}
+
+std::vector<ObjPtr> linear_pattern(ObjPtr object, Vector step, int count) {
+  std::vector<Matrix> linears;
+  std::vector<Vector> translations;
+  for (int i = 1; i < count; ++i) {
+    linears.push_back(identity_matrix());
+    translations.push_back(scale_vector(i, step));
+  }
+  return pattern_closure(object, linears, translations);
+}
+
+std::vector<ObjPtr> circular_pattern(ObjPtr object, Vector center,
+    Vector axis, int count) {
+  axis = normalize_vector(axis);
+  std::vector<Matrix> linears;
+  std::vector<Vector> translations;
+  for (int i = 1; i < count; ++i) {
+    auto linear = rotation_matrix(axis, 2 * PI * i / count);
+    linears.push_back(linear);
+    translations.push_back(
+        subtract_vectors(center, matrix_vector_product(linear, center)));
+  }
+  return pattern_closure(object, linears, translations);
+}
+
+std::vector<ObjPtr> grid_pattern(ObjPtr object, Vector step_a, int count_a,
+    Vector step_b, int count_b) {
+  std::vector<Matrix> linears;
+  std::vector<Vector> translations;
+  for (int j = 0; j < count_b; ++j) {
+    for (int i = 0; i < count_a; ++i) {
+      if (i == 0 && j == 0) continue;
+      linears.push_back(identity_matrix());
+      translations.push_back(
+          add_vectors(scale_vector(i, step_a), scale_vector(j, step_b)));
+    }
+  }
+  return pattern_closure(object, linears, translations);
+}
+
+/* a few runs per thread balance uneven builds without
+   giving each part a Model of its own */
+enum { PART_RUNS_PER_THREAD = 4 };
+
+/* Numbers the objects the builds made, part by part in closure
+   order, with ids drawn past every id the calling thread's Model
+   (or the global numbering) has handed out. Objects that existed
+   before, such as shared prototypes, keep their ids. */
+static void number_parts(std::vector<ObjPtr> const& parts,
+    std::function<bool(Object const*)> const& made) {
+  ObjectIndex numbered;
+  std::vector<Object*> order;
+  int nids = 0;
+  for (auto const& part : parts) {
+    if (!part) continue;
+    for (auto const& co : get_closure(part, true, true)) {
+      if (!made(co.get()) || !numbered.insert(co.get(), 0)) continue;
+      order.push_back(co.get());
+      if (co->type == INSTANCE) {
+        auto instance = as_instance(co);
+        nids += instance->id - instance->first_id + 1;
+      } else {
+        ++nids;
+      }
+    }
+  }
+  if (order.empty()) return;
+  auto next = (current_model ? current_model->ids : global_ids).allocate(nids);
+  for (auto o : order) {
+    if (o->type == INSTANCE) {
+      auto instance = as_instance(o);
+      auto size = instance->id - instance->first_id + 1;
+      instance->first_id = next;
+      next += size;
+      instance->id = next - 1;
+    } else {
+      o->id = next++;
+    }
+  }
+}
+
+/* the objects of a Model and of the Models it holds as parts */
+static void mark_model_objects(Model const& model, ObjectIndex& made) {
+  for (auto o : model.objects) made.insert(o, 0);
+  for (auto const& part : model.parts) mark_model_objects(*part, made);
+}
+
+std::vector<ObjPtr> build_parts(std::vector<PartBuild> const& builds) {
+  auto n = builds.size();
+  auto nruns = std::min(n,
+      std::size_t(resolved_num_threads()) * PART_RUNS_PER_THREAD);
+  Model* target = current_model;
+  std::vector<std::unique_ptr<Model>> models(target ? nruns : 0);
+  for (auto& model : models) model.reset(new Model());
+  std::vector<std::vector<ObjPtr>> records(target ? 0 : nruns);
+  std::vector<ObjPtr> parts(n);
+  parallel_for(nruns, [&](std::size_t run) {
+    auto previous = current_model;
+    auto previous_made = made_objects;
+    current_model = target ? models[run].get() : nullptr;
+    made_objects = target ? nullptr : &records[run];
+    for (auto i = run * n / nruns; i < (run + 1) * n / nruns; ++i)
+      parts[i] = builds[i]();
+    current_model = previous;
+    made_objects = previous_made;
+  });
+  ObjectIndex made;
+  for (auto const& model : models) mark_model_objects(*model, made);
+  for (auto const& record : records)
+    for (auto const& o : record) made.insert(o.get(), 0);
+  number_parts(parts, [&](Object const* o) { return made.find(o) == 0; });
+  for (auto& model : models) target->parts.push_back(std::move(model));
+  /* a build of an enclosing build_parts made these too */
+  if (made_objects) {
+    for (auto& record : records)
+      for (auto& o : record) made_objects->push_back(std::move(o));
+  }
+  return parts;
+}
+
+void insert_parts_into(ObjPtr into, std::vector<PartBuild> const& builds) {
+  for (auto const& part : build_parts(builds)) insert_into(into, part);
+}
+
+ObjPtr group_parts(std::vector<PartBuild> const& builds) {
+  auto group = new_group();
+  for (auto const& part : build_parts(builds)) add_to_group(group, part);
+  return group;
+}
+
+Lazy defer_value(ObjPtr built) {
+  auto node = std::make_shared<LazyNode>();
+  node->outputs.push_back(built);
+  node->built = true;
+  return Lazy{node, 0};
+}
+
+std::vector<Lazy> defer_many(LazyBuild build, std::size_t noutputs,
+    std::vector<Lazy> inputs) {
+  auto node = std::make_shared<LazyNode>();
+  node->build = std::move(build);
+  node->inputs = std::move(inputs);
+  node->built = false;
+  std::vector<Lazy> outputs;
+  for (std::size_t i = 0; i < noutputs; ++i) outputs.push_back(Lazy{node, i});
+  return outputs;
+}
+
+Lazy defer(std::function<ObjPtr(std::vector<ObjPtr> const&)> build,
+    std::vector<Lazy> inputs) {
+  return defer_many([build](std::vector<ObjPtr> const& in) {
+    return std::vector<ObjPtr>(1, build(in));
+  }, 1, std::move(inputs)).front();
+}
+
+/* builds the node after all of its inputs, without recursion so
+   long chains of modifications cannot exhaust the stack */
+static void force_node(std::shared_ptr<LazyNode> const& root) {
+  std::vector<std::pair<LazyNode*, std::size_t>> stack;
+  if (!root->built) stack.push_back(std::make_pair(root.get(), 0));
+  while (!stack.empty()) {
+    auto node = stack.back().first;
+    auto& next = stack.back().second;
+    if (next < node->inputs.size()) {
+      auto input = node->inputs[next++].node.get();
+      if (!input->built) stack.push_back(std::make_pair(input, 0));
+      continue;
+    }
+    std::vector<ObjPtr> in;
+    in.reserve(node->inputs.size());
+    for (auto const& input : node->inputs)
+      in.push_back(input.node->outputs[input.output]);
+    node->outputs = node->build(in);
+    node->built = true;
+    node->build = nullptr;
+    node->inputs.clear();
+    stack.pop_back();
+  }
+}
+
+ObjPtr force(Lazy const& lazy) {
+  force_node(lazy.node);
+  assert(lazy.output < lazy.node->outputs.size());
+  return lazy.node->outputs[lazy.output];
+}
+
+bool is_forced(Lazy const& lazy) { return lazy.node->built; }
+
+Lazy lazy_cube(Vector origin, Vector x, Vector y, Vector z) {
+  return defer([=](std::vector<ObjPtr> const&) {
+    return new_cube(origin, x, y, z);
+  });
+}
+
+Lazy lazy_ball(Vector center, Vector normal, Vector x) {
+  return defer([=](std::vector<ObjPtr> const&) {
+    return new_ball(center, normal, x);
+  });
+}
+
+LazyExtruded lazy_extrude_face(Lazy face, Vector v) {
+  auto outputs = defer_many([=](std::vector<ObjPtr> const& in) {
+    auto extruded = extrude_face(in[0], v);
+    return std::vector<ObjPtr>{extruded.middle, extruded.end};
+  }, 2, std::vector<Lazy>(1, face));
+  return LazyExtruded{outputs[0], outputs[1]};
+}
+
+Lazy lazy_group(std::vector<Lazy> const& members) {
+  return defer([](std::vector<ObjPtr> const& in) {
+    auto group = new_group();
+    for (auto const& member : in) add_to_group(group, member);
+    return group;
+  }, members);
+}
+
+Lazy lazy_insert_into(Lazy into, Lazy inserted) {
+  return defer([](std::vector<ObjPtr> const& in) {
+    insert_into(in[0], in[1]);
+    return in[0];
+  }, std::vector<Lazy>{into, inserted});
+}
+
+Lazy lazy_assembly_boundary(Lazy assembly) {
+  return defer([](std::vector<ObjPtr> const& in) {
+    return collect_assembly_boundary(in[0]);
+  }, std::vector<Lazy>(1, assembly));
+}
+
+static std::uint64_t mix_hash(std::uint64_t h, std::uint64_t bits) {
+  h ^= bits + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  h *= 0xff51afd7ed558ccdULL;
+  return h ^ (h >> 33);
+}
+
+static std::uint64_t double_bits(double x) {
+  if (x == 0) x = 0; /* -0 hashes like 0 */
+  std::uint64_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  return bits;
+}
+
+static std::uint64_t vector_hash(std::uint64_t h, Vector v) {
+  h = mix_hash(h, double_bits(v.x));
+  h = mix_hash(h, double_bits(v.y));
+  return mix_hash(h, double_bits(v.z));
+}
+
+/* objects are named by their closure positions, so equal
+   constructions hash alike whatever their ids */
+std::uint64_t hash_closure(ObjPtr const& o) {
+  ObjectIndex positions;
+  auto closure = get_closure(o, true, true, positions);
+  for (std::size_t i = 0; i < closure.size(); ++i)
+    positions.assign(closure[i].get(), static_cast<int>(i));
+  std::uint64_t h = closure.size();
+  for (auto const& co : closure) {
+    h = mix_hash(h, std::uint64_t(co->type));
+    for (auto const& use : co->used) {
+      h = mix_hash(h, std::uint64_t(use.dir));
+      h = mix_hash(h, std::uint64_t(positions.find(use.obj.get())));
+    }
+    h = mix_hash(h, co->helpers.size());
+    for (auto const& helper : co->helpers)
+      h = mix_hash(h, std::uint64_t(positions.find(helper.get())));
+    h = mix_hash(h, co->embedded.size());
+    for (auto const& e : co->embedded)
+      h = mix_hash(h, std::uint64_t(positions.find(e.get())));
+    if (co->type == POINT) {
+      auto p = as_point(co);
+      h = vector_hash(h, p->pos);
+      h = mix_hash(h, double_bits(p->size));
+    } else if (co->type == INSTANCE) {
+      auto instance = as_instance(co);
+      h = mix_hash(h, hash_closure(instance->prototype));
+      h = vector_hash(h, instance->linear.x);
+      h = vector_hash(h, instance->linear.y);
+      h = vector_hash(h, instance->linear.z);
+      h = vector_hash(h, instance->translation);
+    }
+  }
+  return h;
+}
+
+MemoKey::MemoKey(char const* what) : hash(0) {
+  for (; *what; ++what) add(std::uint64_t(*what));
+}
+
+MemoKey& MemoKey::add(std::uint64_t bits) {
+  hash = mix_hash(hash, bits);
+  words.push_back(bits);
+  return *this;
+}
+
+MemoKey& MemoKey::add(double x) { return add(double_bits(x)); }
+
+MemoKey& MemoKey::add(Vector v) {
+  return add(v.x).add(v.y).add(v.z);
+}
+
+MemoKey& MemoKey::add(ObjPtr const& o) { return add(hash_closure(o)); }
+
+std::string memo_cache_directory;
+
+/* prototypes by key hash, each with the words of its key */
+typedef std::unordered_multimap<std::uint64_t,
+    std::pair<std::vector<std::uint64_t>, ObjPtr>> MemoPrototypes;
+
+static std::mutex memo_lock;
+static MemoPrototypes& memo_prototypes() {
+  static MemoPrototypes prototypes;
+  return prototypes;
+}
+
+static ObjPtr find_memo_prototype(MemoKey const& key) {
+  auto range = memo_prototypes().equal_range(key.hash);
+  for (auto it = range.first; it != range.second; ++it)
+    if (it->second.first == key.words) return it->second.second;
+  return ObjPtr();
+}
+
+static std::string memo_file(std::uint64_t hash) {
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.gmb",
+      static_cast<unsigned long long>(hash));
+  return memo_cache_directory + name;
+}
+
+/* A cache file holds the number of key words, the words and then
+   the binary model, so a file whose name matches by a hash
+   collision, or that an older key layout wrote, is rebuilt. A
+   model another binary version wrote, or a damaged one, is
+   removed and rebuilt as well. */
+static ObjPtr read_memo_file(std::string const& path, MemoKey const& key) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) return ObjPtr();
+  MappedFile file(path.c_str());
+  auto nwords = key.words.size();
+  auto key_bytes = (nwords + 1) * sizeof(std::uint64_t);
+  if (file.size <= key_bytes) return ObjPtr();
+  std::uint64_t stored;
+  std::memcpy(&stored, file.data, sizeof(stored));
+  if (stored != nwords ||
+      std::memcmp(file.data + sizeof(stored), key.words.data(),
+          nwords * sizeof(std::uint64_t)))
+    return ObjPtr();
+  BinaryTables tables;
+  if (check_binary(file.data + key_bytes, file.size - key_bytes, tables)) {
+    unlink(path.c_str());
+    return ObjPtr();
+  }
+  return build_from_tables(tables);
+}
+
+static void write_memo_file(std::string const& path, MemoKey const& key,
+    ObjPtr const& prototype) {
+  BufferSink sink;
+  std::uint64_t nwords = key.words.size();
+  sink.write(reinterpret_cast<char const*>(&nwords), sizeof(nwords));
+  sink.write(reinterpret_cast<char const*>(key.words.data()),
+      key.words.size() * sizeof(std::uint64_t));
+  write_closure_to_binary(prototype, sink);
+  /* renamed into place so concurrent runs never read half a file */
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%ld.tmp", long(getpid()));
+  auto temporary = path + suffix;
+  FILE* f = fopen(temporary.c_str(), "wb");
+  if (!f) return;
+  auto written = fwrite(sink.buffer.data(), 1, sink.buffer.size(), f);
+  if (fclose(f) == 0 && written == sink.buffer.size())
+    rename(temporary.c_str(), path.c_str());
+  else
+    unlink(temporary.c_str());
+}
+
+/* built outside any Model so it outlives the caller's */
+static ObjPtr build_prototype(MemoKey const& key,
+    std::function<ObjPtr()> const& build) {
+  auto model = get_current_model();
+  set_current_model(nullptr);
+  ObjPtr prototype;
+  if (!memo_cache_directory.empty()) {
+    auto path = memo_file(key.hash);
+    prototype = read_memo_file(path, key);
+    if (!prototype) {
+      prototype = build();
+      write_memo_file(path, key, prototype);
+    }
+  } else {
+    prototype = build();
+  }
+  set_current_model(model);
+  return prototype;
+}
+
+ObjPtr memoize(MemoKey const& key, std::function<ObjPtr()> const& build,
+    bool instanced) {
+  ObjPtr prototype;
+  {
+    std::lock_guard<std::mutex> lock(memo_lock);
+    prototype = find_memo_prototype(key);
+  }
+  if (!prototype) {
+    /* built unlocked so builds may memoize their own parts; if
+       two threads race, both get the first one stored */
+    auto built = build_prototype(key, build);
+    std::lock_guard<std::mutex> lock(memo_lock);
+    prototype = find_memo_prototype(key);
+    if (!prototype) {
+      prototype = built;
+      memo_prototypes().insert(std::make_pair(key.hash,
+          std::make_pair(key.words, built)));
+    }
+  }
+  if (instanced) {
+    return new_instance(prototype,
+        Matrix{Vector{1, 0, 0}, Vector{0, 1, 0}, Vector{0, 0, 1}},
+        Vector{0, 0, 0});
+  }
+  return copy_closure(prototype);
+}
+
+void clear_memo_cache() {
+  std::lock_guard<std::mutex> lock(memo_lock);
+  memo_prototypes().clear();
+}
+
+ObjPtr memo_cube(Vector origin, Vector x, Vector y, Vector z) {
+  return memoize(MemoKey("new_cube").add(origin).add(x).add(y).add(z)
+      .add(default_size), [&]() { return new_cube(origin, x, y, z); });
+}
+
+ObjPtr memo_ball(Vector center, Vector normal, Vector x) {
+  return memoize(MemoKey("new_ball").add(center).add(normal).add(x)
+      .add(default_size), [&]() { return new_ball(center, normal, x); });
+}
+
+ObjPtr memo_extrude_face(ObjPtr face, Vector v) {
+  return memoize(MemoKey("extrude_face").add(face).add(v),
+      [&]() { return extrude_face(copy_closure(face), v).middle; });
+}
+
+/* walks the text in place; every failure is fatal */
+struct GeoScanner {
+  char const* pos;
+  char const* end;
+  char const* begin;
+  void fail(char const* why) {
+    long line = 1 + std::count(begin, pos, '\n');
+    fprintf(stderr, "bad .geo file at line %ld: %s\n", line, why);
+    abort();
+  }
+  void skip_space() {
+    while (pos != end) {
+      if (*pos == ' ' || *pos == '\n' || *pos == '\t' || *pos == '\r') {
+        ++pos;
+      } else if (*pos == '/' && pos + 1 != end && pos[1] == '/') {
+        while (pos != end && *pos != '\n') ++pos;
+      } else if (*pos == '/' && pos + 1 != end && pos[1] == '*') {
+        pos += 2;
+        while (pos + 1 < end && !(pos[0] == '*' && pos[1] == '/')) ++pos;
+        if (pos + 1 >= end) fail("unterminated comment");
+        pos += 2;
+      } else {
+        return;
+      }
+    }
+  }
+  bool at_end() {
+    skip_space();
+    return pos == end;
+  }
+  /* up to and past the next ';' outside of a string */
+  void skip_statement() {
+    bool quoted = false;
+    while (pos != end && (quoted || *pos != ';')) {
+      if (*pos == '"') quoted = !quoted;
+      ++pos;
+    }
+    if (pos == end) fail("expected ';'");
+    ++pos;
+  }
+  void expect(char c) {
+    skip_space();
+    if (pos == end || *pos != c) {
+      char why[] = "expected 'x'";
+      why[10] = c;
+      fail(why);
+    }
+    ++pos;
+  }
+  bool accept(char c) {
+    skip_space();
+    if (pos == end || *pos != c) return false;
+    ++pos;
+    return true;
+  }
+  /* one or more space-separated words, e.g. "Plane Surface" */
+  std::size_t keyword(char* out, std::size_t capacity) {
+    skip_space();
+    std::size_t n = 0;
+    while (pos != end) {
+      auto word = pos;
+      while (pos != end && isalpha(static_cast<unsigned char>(*pos))) ++pos;
+      if (pos == word) break;
+      if (n && n < capacity) out[n++] = ' ';
+      for (; word != pos && n < capacity; ++word) out[n++] = *word;
+      auto after = pos;
+      while (pos != end && *pos == ' ') ++pos;
+      if (pos == end || !isalpha(static_cast<unsigned char>(*pos))) {
+        pos = after;
+        break;
+      }
+    }
+    if (n == 0) fail("expected a keyword");
+    if (n == capacity) fail("keyword too long");
+    out[n] = '\0';
+    return n;
+  }
+  long integer() {
+    skip_space();
+    bool negative = false;
+    if (pos != end && (*pos == '-' || *pos == '+')) negative = (*pos++ == '-');
+    if (pos == end || !isdigit(static_cast<unsigned char>(*pos)))
+      fail("expected an integer");
+    long value = 0;
+    while (pos != end && isdigit(static_cast<unsigned char>(*pos))) {
+      value = value * 10 + (*pos++ - '0');
+      if (value > 0x7fffffffL) fail("integer too large");
+    }
+    return negative ? -value : value;
+  }
+  /* decimal mantissas below 2^53 with small exponents convert
+     exactly with one multiply or divide; strtod does the rest */
+  double real() {
+    skip_space();
+    bool negative = false;
+    if (pos != end && (*pos == '-' || *pos == '+')) negative = (*pos++ == '-');
+    auto start = pos;
+    std::uint64_t mantissa = 0;
+    int ndigits = 0;
+    int exponent = 0;
+    while (pos != end && isdigit(static_cast<unsigned char>(*pos))) {
+      if (ndigits < 19) mantissa = mantissa * 10 + std::uint64_t(*pos - '0');
+      else ++exponent;
+      if (mantissa) ++ndigits;
+      ++pos;
+    }
+    if (pos != end && *pos == '.') {
+      ++pos;
+      while (pos != end && isdigit(static_cast<unsigned char>(*pos))) {
+        if (ndigits < 19) {
+          mantissa = mantissa * 10 + std::uint64_t(*pos - '0');
+          --exponent;
+          if (mantissa) ++ndigits;
+        }
+        ++pos;
+      }
+    }
+    if (pos == start) fail("expected a number");
+    if (pos != end && (*pos == 'e' || *pos == 'E')) {
+      ++pos;
+      bool negative_exponent = false;
+      if (pos != end && (*pos == '-' || *pos == '+'))
+        negative_exponent = (*pos++ == '-');
+      int e = 0;
+      while (pos != end && isdigit(static_cast<unsigned char>(*pos))) {
+        if (e < 10000) e = e * 10 + (*pos - '0');
+        ++pos;
+      }
+      exponent += negative_exponent ? -e : e;
+    }
+    static double const powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                    1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                    1e18, 1e19, 1e20, 1e21, 1e22};
+    double value;
+    if (mantissa < (std::uint64_t(1) << 53) && exponent >= -22 &&
+        exponent <= 22) {
+      value = double(mantissa);
+      if (exponent < 0) value /= powers[-exponent];
+      else value *= powers[exponent];
+      return negative ? -value : value;
+    }
+    char text[128];
+    auto n = std::size_t(pos - start);
+    if (n >= sizeof(text)) fail("number too long");
+    memcpy(text, start, n);
+    text[n] = '\0';
+    value = strtod(text, nullptr);
+    return negative ? -value : value;
+  }
+};
+
+/* object lookup by .geo id, kept separately for each kind of
+   entity since other writers may reuse ids across kinds */
+enum {
+  GEO_POINTS,
+  GEO_CURVES,
+  GEO_SURFACES,
+  GEO_VOLUMES,
+  GEO_LINE_LOOPS,
+  GEO_SURFACE_LOOPS,
+  GEO_KINDS
+};
+
+struct GeoTable {
+  std::vector<int> dense;
+  std::map<long, int> sparse;
+  void set(long id, int position) {
+    if (id >= 0 && id < (long(1) << 24)) {
+      if (std::size_t(id) >= dense.size())
+        dense.resize(std::max(std::size_t(id) + 1, 2 * dense.size()), -1);
+      dense[std::size_t(id)] = position;
+    } else {
+      sparse[id] = position;
+    }
+  }
+  int get(long id) const {
+    if (id >= 0 && std::size_t(id) < dense.size())
+      return dense[std::size_t(id)];
+    auto it = sparse.find(id);
+    return it == sparse.end() ? -1 : it->second;
+  }
+};
+
+static int geo_kind_of_type(int type) {
+  if (type == LOOP) return GEO_LINE_LOOPS;
+  if (type == SHELL) return GEO_SURFACE_LOOPS;
+  return type_dims[type];
+}
+
+ObjPtr read_closure_from_geo(char const* data, std::size_t size) {
+  GeoScanner scan{data, data + size, data};
+  GeoTable tables[GEO_KINDS];
+  std::vector<ObjPtr> objs;
+  std::vector<char> referenced;
+  std::vector<long> list;
+  long max_id = -1;
+  auto lookup = [&](int kind, long id) -> ObjPtr const& {
+    auto position = tables[kind].get(id);
+    if (position < 0) scan.fail("reference to an undefined entity");
+    referenced[std::size_t(position)] = 1;
+    return objs[std::size_t(position)];
+  };
+  char name[64];
+  char target_name[64];
+  while (!scan.at_end()) {
+    scan.keyword(name, sizeof(name));
+    if (!strcmp(name, "Field") || !strcmp(name, "Background Field")) {
+      /* size fields are settings, not entities */
+      scan.skip_statement();
+      continue;
+    }
+    if (scan.accept('{')) {
+      /* Dim{a} In Dim{b}; */
+      auto dim = std::find_if(dim_names, dim_names + 4, [&](char const* d) {
+        return !strcmp(d, name);
+      }) - dim_names;
+      if (dim == 4) scan.fail("unknown entity kind");
+      long emb_id = scan.integer();
+      scan.expect('}');
+      scan.keyword(target_name, sizeof(target_name));
+      if (strncmp(target_name, "In ", 3)) scan.fail("expected \"In\"");
+      auto into_dim = std::find_if(dim_names, dim_names + 4,
+          [&](char const* d) { return !strcmp(d, target_name + 3); }) -
+          dim_names;
+      if (into_dim == 4) scan.fail("unknown entity kind");
+      scan.expect('{');
+      long into_id = scan.integer();
+      scan.expect('}');
+      scan.expect(';');
+      auto emb = lookup(int(dim), emb_id);
+      auto into = tables[into_dim].get(into_id);
+      if (into < 0) scan.fail("reference to an undefined entity");
+      objs[std::size_t(into)]->embedded.push_back(emb);
+      continue;
+    }
+    scan.expect('(');
+    long id = scan.integer();
+    scan.expect(')');
+    scan.expect('=');
+    scan.expect('{');
+    list.clear();
+    bool physical = !strncmp(name, "Physical ", 9);
+    int type = -1;
+    if (!physical) {
+      for (int t = 0; t < NTYPES; ++t)
+        if (t != GROUP && t != INSTANCE && !strcmp(type_names[t], name))
+          type = t;
+      if (type == -1) scan.fail("unsupported statement");
+    }
+    if (type == POINT) {
+      double v[4];
+      for (int i = 0; i < 4; ++i) {
+        if (i) scan.expect(',');
+        v[i] = scan.real();
+      }
+      scan.expect('}');
+      scan.expect(';');
+      auto p = new_point3(Vector{v[0], v[1], v[2]}, v[3]);
+      p->id = int(id);
+      max_id = std::max(max_id, id);
+      tables[GEO_POINTS].set(id, int(objs.size()));
+      objs.push_back(p);
+      referenced.push_back(0);
+      continue;
+    }
+    if (!scan.accept('}')) {
+      do list.push_back(scan.integer());
+      while (scan.accept(','));
+      scan.expect('}');
+    }
+    scan.expect(';');
+    if (physical) continue;
+    auto obj = new_object(type);
+    obj->id = int(id);
+    max_id = std::max(max_id, id);
+    switch (type) {
+      case LINE:
+        if (list.size() != 2) scan.fail("a Line needs two points");
+        obj->used.push_back(Use{FORWARD, lookup(GEO_POINTS, list[0])});
+        obj->used.push_back(Use{FORWARD, lookup(GEO_POINTS, list[1])});
+        break;
+      case ARC:
+        if (list.size() != 3) scan.fail("a Circle needs three points");
+        obj->used.push_back(Use{FORWARD, lookup(GEO_POINTS, list[0])});
+        obj->helpers.push_back(lookup(GEO_POINTS, list[1]));
+        obj->used.push_back(Use{FORWARD, lookup(GEO_POINTS, list[2])});
+        break;
+      case ELLIPSE:
+        if (list.size() != 4) scan.fail("an Ellipse needs four points");
+        obj->used.push_back(Use{FORWARD, lookup(GEO_POINTS, list[0])});
+        obj->helpers.push_back(lookup(GEO_POINTS, list[1]));
+        obj->helpers.push_back(lookup(GEO_POINTS, list[2]));
+        obj->used.push_back(Use{FORWARD, lookup(GEO_POINTS, list[3])});
+        break;
+      case SPLINE:
+        if (list.size() < 2) scan.fail("a Spline needs two points");
+        obj->used.push_back(Use{FORWARD, lookup(GEO_POINTS, list.front())});
+        for (std::size_t i = 1; i + 1 < list.size(); ++i)
+          obj->helpers.push_back(lookup(GEO_POINTS, list[i]));
+        obj->used.push_back(Use{FORWARD, lookup(GEO_POINTS, list.back())});
+        break;
+      case PLANE:
+      case RULED:
+      case VOLUME: {
+        /* holes and inclusions are the REVERSE uses after the first */
+        auto kind = type == VOLUME ? GEO_SURFACE_LOOPS : GEO_LINE_LOOPS;
+        for (std::size_t i = 0; i < list.size(); ++i) {
+          obj->used.push_back(Use{i ? REVERSE : FORWARD, lookup(kind, list[i])});
+        }
+      } break;
+      case LOOP:
+      case SHELL: {
+        auto kind = type == LOOP ? GEO_CURVES : GEO_SURFACES;
+        for (auto i : list) {
+          obj->used.push_back(
+              Use{i < 0 ? REVERSE : FORWARD, lookup(kind, i < 0 ? -i : i)});
+        }
+      } break;
+    }
+    GMOD_COUNT(uses, obj->used.size());
+    GMOD_COUNT(helpers, obj->helpers.size());
+    tables[geo_kind_of_type(type)].set(id, int(objs.size()));
+    objs.push_back(obj);
+    referenced.push_back(0);
+  }
+  if (objs.empty()) scan.fail("no entities");
+  (current_model ? current_model->ids : global_ids).skip_past(int(max_id));
+  invalidate_closures();
+  /* print_closure emits the root's direct children last, in
+     reverse order, so walking backwards restores their order */
+  std::vector<ObjPtr> roots;
+  for (std::size_t i = objs.size(); i-- > 0;)
+    if (!referenced[i]) roots.push_back(objs[i]);
+  if (roots.size() == 1) return roots.front();
+  auto group = new_group();
+  for (auto const& root : roots) add_to_group(group, root);
+  return group;
+}
+
+ObjPtr read_closure_from_geo(char const* filename) {
+  MappedFile file(filename);
+  return read_closure_from_geo(file.data, file.size);
+}
+
+
+/* the points of an edge at segments + 1 even parameters, or at
+   its two ends if it is a line and segments may be fewer */
+static std::vector<Vector> sample_edge(Object const* edge, int segments,
+    bool exact) {
+  auto n = (edge->type == LINE && !exact) ? 1 : std::max(segments, 1);
+  std::vector<double> params(std::size_t(n + 1));
+  for (int i = 0; i <= n; ++i) params[std::size_t(i)] = double(i) / n;
+  std::vector<Vector> points(params.size());
+  /* eval_many only reads the object, so it needs no shared owner */
+  switch (edge->type) {
+    case LINE: eval_frame(line_frame(edge), params.data(), params.size(),
+                   points.data()); break;
+    case ARC: eval_frame(arc_frame(edge), params.data(), params.size(),
+                  points.data()); break;
+    case ELLIPSE: eval_frame(ellipse_frame(edge), params.data(),
+                      params.size(), points.data()); break;
+    case SPLINE: eval_spline(edge, params.data(), params.size(),
+                     points.data()); break;
+    default:
+      fprintf(stderr, "can't tessellate a %s\n", type_names[edge->type]);
+      abort();
+  }
+  return points;
+}
+
+/* The edges of a loop in walking order, with the directions the
+   loop walks them in. Gmsh accepts loops listing their edges out
+   of order (new_sphere makes some), so those are chained by their
+   end points. */
+static std::vector<Use> walk_loop(Object const* loop, int dir) {
+  std::vector<Use> walk;
+  walk.reserve(loop->used.size());
+  for (auto const& use : loop->used)
+    walk.push_back(Use{use.dir ^ dir, use.obj});
+  if (dir == REVERSE) std::reverse(walk.begin(), walk.end());
+  auto head = [](Use const& u) { return edge_point_view(u.obj.get(), u.dir); };
+  auto tail = [](Use const& u) {
+    return edge_point_view(u.obj.get(), 1 - u.dir);
+  };
+  bool chained = true;
+  for (std::size_t i = 0; i + 1 < walk.size(); ++i)
+    if (tail(walk[i]) != head(walk[i + 1])) chained = false;
+  if (chained) return walk;
+  std::unordered_map<Point const*, std::vector<std::size_t>> touching;
+  for (std::size_t i = 0; i < walk.size(); ++i) {
+    touching[head(walk[i])].push_back(i);
+    touching[tail(walk[i])].push_back(i);
+  }
+  std::vector<bool> taken(walk.size(), false);
+  std::vector<Use> ordered(1, walk[0]);
+  taken[0] = true;
+  while (ordered.size() < walk.size()) {
+    auto end = tail(ordered.back());
+    bool found = false;
+    for (auto i : touching[end]) {
+      if (taken[i]) continue;
+      auto next = walk[i];
+      if (head(next) != end) next.dir ^= 1;
+      ordered.push_back(next);
+      taken[i] = true;
+      found = true;
+      break;
+    }
+    if (!found) {
+      fprintf(stderr, "loop %d is not closed\n", loop->id);
+      abort();
+    }
+  }
+  return ordered;
+}
+
+/* the samples of each edge of a loop in walking order */
+static std::vector<std::vector<Vector>> sample_sides(Object const* loop,
+    int dir, int segments, bool exact) {
+  std::vector<std::vector<Vector>> sides;
+  for (auto const& use : walk_loop(loop, dir)) {
+    sides.push_back(sample_edge(use.obj.get(), segments, exact));
+    if (use.dir == REVERSE)
+      std::reverse(sides.back().begin(), sides.back().end());
+  }
+  return sides;
+}
+
+/* appends the points of a loop walked in its use direction,
+   each shared end once, and returns the index of the first */
+static int sample_loop(Object const* loop, int dir, int segments,
+    std::vector<Vector>& vertices) {
+  auto first = static_cast<int>(vertices.size());
+  for (auto const& side : sample_sides(loop, dir, segments, false))
+    vertices.insert(vertices.end(), side.begin(), side.end() - 1);
+  return first;
+}
+
+struct Point2 {
+  double x, y;
+};
+
+static double cross2(Point2 a, Point2 b, Point2 c) {
+  return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+static bool same2(Point2 a, Point2 b) { return a.x == b.x && a.y == b.y; }
+
+static bool segments_cross(Point2 a, Point2 b, Point2 c, Point2 d) {
+  if (same2(a, c) || same2(a, d) || same2(b, c) || same2(b, d)) return false;
+  auto d1 = cross2(a, b, c);
+  auto d2 = cross2(a, b, d);
+  auto d3 = cross2(c, d, a);
+  auto d4 = cross2(c, d, b);
+  return ((d1 > 0) != (d2 > 0)) && ((d3 > 0) != (d4 > 0));
+}
+
+/* whether p lies on the segment from a to b, short of its ends */
+static bool inside_segment(Point2 a, Point2 b, Point2 p) {
+  if (cross2(a, b, p) != 0 || same2(p, a) || same2(p, b)) return false;
+  return (p.x - a.x) * (b.x - a.x) + (p.y - a.y) * (b.y - a.y) > 0 &&
+         (p.x - b.x) * (a.x - b.x) + (p.y - b.y) * (a.y - b.y) > 0;
+}
+
+static double signed_area(std::vector<Point2> const& uv,
+    std::vector<int> const& ring) {
+  double area = 0;
+  for (std::size_t i = 0; i < ring.size(); ++i) {
+    auto a = uv[std::size_t(ring[i])];
+    auto b = uv[std::size_t(ring[(i + 1) % ring.size()])];
+    area += a.x * b.y - b.x * a.y;
+  }
+  return area / 2;
+}
+
+/* Uniform buckets over the box of some uv points, about one point
+   per cell, so that the searches of the triangulation only look
+   near where they are. Items are filed under every cell that the
+   box of two points covers. */
+struct Grid2 {
+  Grid2(std::vector<Point2> const& uv, std::vector<int> const& points) {
+    lo = Point2{HUGE_VAL, HUGE_VAL};
+    Point2 hi{-HUGE_VAL, -HUGE_VAL};
+    for (auto i : points) {
+      auto p = uv[std::size_t(i)];
+      lo = Point2{std::min(lo.x, p.x), std::min(lo.y, p.y)};
+      hi = Point2{std::max(hi.x, p.x), std::max(hi.y, p.y)};
+    }
+    auto w = hi.x - lo.x;
+    auto h = hi.y - lo.y;
+    auto n = static_cast<double>(std::max<std::size_t>(points.size(), 1));
+    size = std::max(std::sqrt(w * h / n), std::max(w, h) / n);
+    if (!(size > 0)) size = 1;
+    nx = static_cast<int>(w / size) + 1;
+    ny = static_cast<int>(h / size) + 1;
+    cells.resize(std::size_t(nx) * std::size_t(ny));
+  }
+  int column(double x) const {
+    return std::max(0, std::min(nx - 1, static_cast<int>((x - lo.x) / size)));
+  }
+  int row(double y) const {
+    return std::max(0, std::min(ny - 1, static_cast<int>((y - lo.y) / size)));
+  }
+  std::vector<int>& cell(int x, int y) {
+    return cells[std::size_t(y) * std::size_t(nx) + std::size_t(x)];
+  }
+  std::vector<int> const& cell(int x, int y) const {
+    return cells[std::size_t(y) * std::size_t(nx) + std::size_t(x)];
+  }
+  void insert(Point2 a, Point2 b, int item) {
+    for (int y = row(std::min(a.y, b.y)); y <= row(std::max(a.y, b.y)); ++y)
+    for (int x = column(std::min(a.x, b.x)); x <= column(std::max(a.x, b.x));
+         ++x)
+      cell(x, y).push_back(item);
+  }
+  /* whether f holds for an item filed under a cell the box of a and
+     b covers; items filed under several cells may come up again */
+  template <class F>
+  bool any(Point2 a, Point2 b, F const& f) const {
+    for (int y = row(std::min(a.y, b.y)); y <= row(std::max(a.y, b.y)); ++y)
+    for (int x = column(std::min(a.x, b.x)); x <= column(std::max(a.x, b.x));
+         ++x)
+      for (auto item : cell(x, y))
+        if (f(item)) return true;
+    return false;
+  }
+  /* the items of the cells r cells away from that of p */
+  template <class F>
+  void visit_ring(Point2 p, int r, F const& f) const {
+    auto cx = column(p.x);
+    auto cy = row(p.y);
+    for (int y = std::max(0, cy - r); y <= std::min(ny - 1, cy + r); ++y) {
+      auto step = (y == cy - r || y == cy + r) ? 1 : 2 * r;
+      for (int x = cx - r; x <= cx + r; x += step) {
+        if (x < 0 || x >= nx) continue;
+        for (auto item : cell(x, y)) f(item);
+      }
+    }
+  }
+  Point2 lo;
+  double size;
+  int nx, ny;
+  std::vector<std::vector<int>> cells;
+};
+
+static double distance2(Point2 a, Point2 b) {
+  return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+}
+
+/* Joins each hole to the outer ring by a pair of coincident
+   bridge edges from its rightmost vertex to the nearest vertex
+   it can see past every edge and vertex, rightmost holes first,
+   giving one simple ring. The rings are linked lists of nodes,
+   each holding a vertex (a bridge duplicates its two ends), and
+   grids of the edges and of the nodes already on the outer ring
+   keep each search local: the nearest vertices come from rings of
+   cells around the hole, and are final once no unvisited cell can
+   hold a nearer one. */
+static std::vector<int> bridge_holes(std::vector<Point2> const& uv,
+    std::vector<int> const& outer, std::vector<std::vector<int>> holes) {
+  auto rightmost = [&](std::vector<int> const& ring) {
+    std::size_t best = 0;
+    for (std::size_t i = 1; i < ring.size(); ++i)
+      if (uv[std::size_t(ring[i])].x > uv[std::size_t(ring[best])].x) best = i;
+    return best;
+  };
+  std::sort(holes.begin(), holes.end(),
+      [&](std::vector<int> const& a, std::vector<int> const& b) {
+        return uv[std::size_t(a[rightmost(a)])].x >
+               uv[std::size_t(b[rightmost(b)])].x;
+      });
+  std::vector<int> all(outer);
+  for (auto const& hole : holes)
+    all.insert(all.end(), hole.begin(), hole.end());
+  Grid2 edges(uv, all);
+  Grid2 joined(uv, all);
+  std::vector<int> vertex;
+  std::vector<int> prev, next;
+  auto link = [&](std::vector<int> const& ring) {
+    auto first = static_cast<int>(vertex.size());
+    auto n = ring.size();
+    for (std::size_t i = 0; i < n; ++i) {
+      vertex.push_back(ring[i]);
+      prev.push_back(first + static_cast<int>((i + n - 1) % n));
+      next.push_back(first + static_cast<int>((i + 1) % n));
+    }
+    return first;
+  };
+  auto at = [&](int node) {
+    return uv[std::size_t(vertex[std::size_t(node)])];
+  };
+  auto add_edge = [&](int node) {
+    edges.insert(at(node), at(next[std::size_t(node)]), node);
+  };
+  auto add_joined = [&](int node) { joined.insert(at(node), at(node), node); };
+  /* whether the way from a node towards p starts inside the ring,
+     between the edges into and out of the node */
+  auto locally_inside = [&](int node, Point2 p) {
+    auto a = at(prev[std::size_t(node)]);
+    auto b = at(node);
+    auto c = at(next[std::size_t(node)]);
+    if (cross2(a, b, c) > 0)
+      return cross2(b, p, c) <= 0 && cross2(b, a, p) <= 0;
+    return cross2(b, p, a) > 0 || cross2(b, c, p) > 0;
+  };
+  link(outer);
+  std::vector<int> firsts;
+  for (auto const& hole : holes) firsts.push_back(link(hole));
+  for (int node = 0; node < static_cast<int>(vertex.size()); ++node)
+    add_edge(node);
+  for (int node = 0; node < static_cast<int>(outer.size()); ++node)
+    add_joined(node);
+  std::vector<unsigned> marks;
+  unsigned mark = 0;
+  typedef std::pair<double, int> Candidate;
+  std::vector<Candidate> heap;
+  auto nearer = [](Candidate const& a, Candidate const& b) { return a > b; };
+  for (std::size_t h = 0; h < holes.size(); ++h) {
+    auto const& hole = holes[h];
+    auto size = static_cast<int>(hole.size());
+    auto mi = static_cast<int>(rightmost(hole));
+    auto m = firsts[h] + mi;
+    auto mp = at(m);
+    marks.resize(vertex.size(), 0);
+    auto visible = [&](Point2 vp) {
+      ++mark;
+      return !edges.any(mp, vp, [&](int e) {
+        if (marks[std::size_t(e)] == mark) return false;
+        marks[std::size_t(e)] = mark;
+        return segments_cross(mp, vp, at(e), at(next[std::size_t(e)])) ||
+               inside_segment(mp, vp, at(e));
+      });
+    };
+    int bridge = -1;
+    int nearest = -1;
+    heap.clear();
+    auto last = std::max(joined.nx, joined.ny);
+    for (int r = 0; bridge < 0 && r <= last; ++r) {
+      joined.visit_ring(mp, r, [&](int node) {
+        heap.push_back(Candidate(distance2(mp, at(node)), node));
+        std::push_heap(heap.begin(), heap.end(), nearer);
+      });
+      auto settled = r < last ? (r * joined.size) * (r * joined.size)
+                              : HUGE_VAL;
+      while (!heap.empty() && heap.front().first <= settled) {
+        auto node = heap.front().second;
+        std::pop_heap(heap.begin(), heap.end(), nearer);
+        heap.pop_back();
+        if (nearest < 0) nearest = node;
+        if (!visible(at(node))) continue;
+        /* bridges leave several nodes on one vertex: take the one
+           the way to the hole leaves between its edges */
+        auto vp = at(node);
+        bridge = node;
+        joined.any(vp, vp, [&](int other) {
+          if (!same2(at(other), vp) || !locally_inside(other, mp))
+            return false;
+          bridge = other;
+          return true;
+        });
+        break;
+      }
+    }
+    if (bridge < 0) bridge = nearest;
+    /* bridge, m, ..., the node before m, m again, bridge again */
+    auto before_m = firsts[h] + (mi + size - 1) % size;
+    auto after_bridge = next[std::size_t(bridge)];
+    auto bridge2 = static_cast<int>(vertex.size());
+    vertex.push_back(vertex[std::size_t(bridge)]);
+    auto m2 = static_cast<int>(vertex.size());
+    vertex.push_back(vertex[std::size_t(m)]);
+    prev.push_back(m2);
+    next.push_back(after_bridge);
+    prev.push_back(before_m);
+    next.push_back(bridge2);
+    prev[std::size_t(after_bridge)] = bridge2;
+    next[std::size_t(bridge)] = m;
+    prev[std::size_t(m)] = bridge;
+    next[std::size_t(before_m)] = m2;
+    add_edge(bridge);
+    add_edge(bridge2);
+    add_edge(m2);
+    for (int node = firsts[h]; node < firsts[h] + size; ++node)
+      add_joined(node);
+    add_joined(bridge2);
+    add_joined(m2);
+  }
+  std::vector<int> ring;
+  ring.reserve(vertex.size());
+  int node = 0;
+  do {
+    ring.push_back(vertex[std::size_t(node)]);
+    node = next[std::size_t(node)];
+  } while (node != 0);
+  return ring;
+}
+
+/* Ear clipping of a counter-clockwise ring; vertices coincident
+   with the corners of an ear, as bridges make, do not block it.
+   The ring is a linked list walked onwards from each clipped ear,
+   and a grid of its vertices finds those that may lie in an ear. */
+static void clip_ears(std::vector<Point2> const& uv,
+    std::vector<int> const& ring, std::vector<int>& triangles) {
+  auto n = ring.size();
+  if (n < 3) return;
+  std::vector<std::size_t> prev(n), next(n);
+  std::vector<bool> removed(n, false);
+  Grid2 grid(uv, ring);
+  auto at = [&](std::size_t i) { return uv[std::size_t(ring[i])]; };
+  for (std::size_t i = 0; i < n; ++i) {
+    prev[i] = (i + n - 1) % n;
+    next[i] = (i + 1) % n;
+    grid.insert(at(i), at(i), static_cast<int>(i));
+  }
+  auto remove = [&](std::size_t i) {
+    next[prev[i]] = next[i];
+    prev[next[i]] = prev[i];
+    removed[i] = true;
+  };
+  std::size_t current = 0;
+  std::size_t failures = 0;
+  while (n > 3) {
+    auto ia = prev[current];
+    auto ic = next[current];
+    auto a = at(ia);
+    auto b = at(current);
+    auto c = at(ic);
+    auto turn = cross2(a, b, c);
+    if (turn == 0) {
+      /* a collinear vertex encloses nothing */
+      remove(current);
+      --n;
+      current = ia;
+      failures = 0;
+      continue;
+    }
+    bool ear = turn > 0;
+    if (ear) {
+      Point2 lo{std::min(a.x, std::min(b.x, c.x)),
+                std::min(a.y, std::min(b.y, c.y))};
+      Point2 hi{std::max(a.x, std::max(b.x, c.x)),
+                std::max(a.y, std::max(b.y, c.y))};
+      ear = !grid.any(lo, hi, [&](int item) {
+        auto j = std::size_t(item);
+        if (removed[j] || j == ia || j == current || j == ic) return false;
+        auto p = at(j);
+        if (same2(p, a) || same2(p, b) || same2(p, c)) return false;
+        return cross2(a, b, p) >= 0 && cross2(b, c, p) >= 0 &&
+               cross2(c, a, p) >= 0 &&
+               cross2(at(prev[j]), p, at(next[j])) <= 0;
+      });
+    }
+    if (ear) {
+      triangles.insert(triangles.end(), {ring[ia], ring[current], ring[ic]});
+      remove(current);
+      --n;
+      current = ic;
+      failures = 0;
+    } else if (++failures < n) {
+      current = ic;
+    } else {
+      /* degenerate rings have no proper ear left: drop a vertex */
+      remove(current);
+      --n;
+      current = ic;
+      failures = 0;
+    }
+  }
+  auto ia = prev[current];
+  auto ic = next[current];
+  if (cross2(at(ia), at(current), at(ic)) > 0)
+    triangles.insert(triangles.end(), {ring[ia], ring[current], ring[ic]});
+}
+
+/* projects the loops of a face onto the plane of its outer loop
+   (by Newell's normal) and triangulates them with the outer loop
+   counter-clockwise and the holes clockwise */
+static void triangulate_loops(Object const* face, int segments,
+    Tessellation& t) {
+  std::vector<int> starts;
+  for (auto const& use : face->used)
+    starts.push_back(sample_loop(use.obj.get(), use.dir, segments, t.vertices));
+  starts.push_back(static_cast<int>(t.vertices.size()));
+  Vector normal{0, 0, 0};
+  for (int i = starts[0]; i < starts[1]; ++i) {
+    auto a = t.vertices[std::size_t(i)];
+    auto b = t.vertices[std::size_t(i + 1 < starts[1] ? i + 1 : starts[0])];
+    normal = normal + cross_product(a, b);
+  }
+  if (vector_norm(normal) == 0) return;
+  normal = normalize_vector(normal);
+  Vector axis = fabs(normal.x) < 0.9 ? Vector{1, 0, 0} : Vector{0, 1, 0};
+  auto u = normalize_vector(cross_product(axis, normal));
+  auto v = cross_product(normal, u);
+  std::vector<Point2> uv;
+  uv.reserve(t.vertices.size());
+  for (auto p : t.vertices)
+    uv.push_back(Point2{dot_product(p, u), dot_product(p, v)});
+  std::vector<int> outer;
+  std::vector<std::vector<int>> holes;
+  for (std::size_t l = 0; l + 1 < starts.size(); ++l) {
+    std::vector<int> ring;
+    for (int i = starts[l]; i < starts[l + 1]; ++i) ring.push_back(i);
+    if (ring.size() < 3) continue;
+    auto area = signed_area(uv, ring);
+    if ((l == 0) != (area > 0)) std::reverse(ring.begin(), ring.end());
+    if (l == 0) outer = ring;
+    else holes.push_back(ring);
+  }
+  if (outer.empty()) return;
+  clip_ears(uv, bridge_holes(uv, outer, holes), t.triangles);
+}
+
+/* a Coons patch between the three or four sides of a ruled face,
+   sampled on a segments by segments grid */
+static void tessellate_ruled(Object const* face, int segments,
+    Tessellation& t) {
+  auto loop = face->used[0].obj.get();
+  auto dir = face->used[0].dir;
+  auto sides = sample_sides(loop, dir, segments, true);
+  if (sides.size() == 3) {
+    sides.push_back(std::vector<Vector>(sides[0].size(), sides[0].front()));
+  }
+  auto m = static_cast<std::size_t>(std::max(segments, 1));
+  auto const& bottom = sides[0];
+  auto const& right = sides[1];
+  auto const& top = sides[2];
+  auto const& left = sides[3];
+  auto p00 = bottom.front();
+  auto p10 = bottom.back();
+  auto p11 = top.front();
+  auto p01 = top.back();
+  auto first = static_cast<int>(t.vertices.size());
+  for (std::size_t j = 0; j <= m; ++j) {
+    auto tt = double(j) / double(m);
+    for (std::size_t i = 0; i <= m; ++i) {
+      auto ss = double(i) / double(m);
+      auto p = (1 - tt) * bottom[i] + tt * top[m - i] +
+               (1 - ss) * left[m - j] + ss * right[j] -
+               ((1 - ss) * (1 - tt) * p00 + ss * (1 - tt) * p10 +
+                (1 - ss) * tt * p01 + ss * tt * p11);
+      t.vertices.push_back(p);
+    }
+  }
+  auto at = [&](std::size_t i, std::size_t j) {
+    return first + static_cast<int>(j * (m + 1) + i);
+  };
+  auto add = [&](int a, int b, int c) {
+    auto ab = t.vertices[std::size_t(b)] - t.vertices[std::size_t(a)];
+    auto ac = t.vertices[std::size_t(c)] - t.vertices[std::size_t(a)];
+    if (vector_norm(cross_product(ab, ac)) > 0)
+      t.triangles.insert(t.triangles.end(), {a, b, c});
+  };
+  for (std::size_t j = 0; j < m; ++j)
+  for (std::size_t i = 0; i < m; ++i) {
+    add(at(i, j), at(i + 1, j), at(i + 1, j + 1));
+    add(at(i, j), at(i + 1, j + 1), at(i, j + 1));
+  }
+}
+
+static Tessellation tessellate_face_t(Object const* face, int segments) {
+  Tessellation t;
+  if (face->type == RULED && face->used.size() == 1 &&
+      (face->used[0].obj->used.size() == 3 ||
+       face->used[0].obj->used.size() == 4)) {
+    tessellate_ruled(face, segments, t);
+  } else {
+    triangulate_loops(face, segments, t);
+  }
+  return t;
+}
+
+Tessellation tessellate_face(ObjPtr const& face, int segments) {
+  assert(is_face(face->type));
+  return tessellate_face_t(face.get(), segments);
+}
+
+void tessellate_closure(ObjPtr root, int segments,
+    std::function<void(ObjPtr const&, Tessellation const&)> const& callback) {
+  struct Job {
+    ObjPtr face;
+    Instance const* instance;
+  };
+  std::vector<Job> jobs;
+  for (auto const& co : get_closure(root, false, true)) {
+    if (is_face(co->type)) jobs.push_back(Job{co, nullptr});
+    if (co->type != INSTANCE) continue;
+    auto instance = as_instance(co);
+    for (auto const& pco : get_closure(instance->prototype, false, true))
+      if (is_face(pco->type)) jobs.push_back(Job{pco, instance});
+  }
+  std::vector<Tessellation> results(jobs.size());
+  parallel_for(jobs.size(), [&](std::size_t i) {
+    results[i] = tessellate_face_t(jobs[i].face.get(), segments);
+    if (auto instance = jobs[i].instance) {
+      for (auto& p : results[i].vertices)
+        p = instance->linear * p + instance->translation;
+    }
+  });
+  for (std::size_t i = 0; i < jobs.size(); ++i)
+    callback(jobs[i].face, results[i]);
+}
+
+void write_closure_to_stl(ObjPtr root, int segments, Sink& sink) {
+  GMOD_TIME(STATS_WRITE);
+  std::vector<char> body;
+  std::uint32_t count = 0;
+  auto put = [&](float x) {
+    char bytes[sizeof(float)];
+    std::memcpy(bytes, &x, sizeof(float));
+    body.insert(body.end(), bytes, bytes + sizeof(float));
+  };
+  tessellate_closure(root, segments,
+      [&](ObjPtr const&, Tessellation const& t) {
+        for (std::size_t k = 0; k + 2 < t.triangles.size(); k += 3) {
+          Vector v[3];
+          for (int c = 0; c < 3; ++c)
+            v[c] = t.vertices[std::size_t(t.triangles[k + std::size_t(c)])];
+          auto n = cross_product(v[1] - v[0], v[2] - v[0]);
+          if (vector_norm(n) > 0) n = normalize_vector(n);
+          put(float(n.x)); put(float(n.y)); put(float(n.z));
+          for (auto p : v) {
+            put(float(p.x)); put(float(p.y)); put(float(p.z));
+          }
+          body.push_back(0);
+          body.push_back(0);
+          ++count;
+        }
+      });
+  char header[80] = "gmodel preview";
+  sink.write(header, sizeof(header));
+  sink.write(reinterpret_cast<char const*>(&count), sizeof(count));
+  if (!body.empty()) sink.write(body.data(), body.size());
+}
+
+void write_closure_to_stl(ObjPtr root, int segments, char const* filename) {
+  FILE* f = fopen(filename, "wb");
+  FileSink sink(f);
+  write_closure_to_stl(root, segments, sink);
+  fclose(f);
+}
+
+Stats get_stats() {
+  Stats stats;
+  for (int t = 0; t < NTYPES; ++t)
+    stats.live[t] = stats_counters.live[t].load(std::memory_order_relaxed);
+  stats.uses = stats_counters.uses.load(std::memory_order_relaxed);
+  stats.helpers = stats_counters.helpers.load(std::memory_order_relaxed);
+  stats.bytes_allocated =
+      stats_counters.bytes_allocated.load(std::memory_order_relaxed);
+  stats.closure_traversals =
+      stats_counters.closure_traversals.load(std::memory_order_relaxed);
+  stats.closure_cache_hits =
+      stats_counters.closure_cache_hits.load(std::memory_order_relaxed);
+  for (int p = 0; p < NSTATS_PHASES; ++p) {
+    stats.seconds[p] =
+        double(stats_counters.nanoseconds[p].load(std::memory_order_relaxed)) *
+        1e-9;
+  }
+  return stats;
+}
+
+void reset_stats() {
+  stats_counters.bytes_allocated.store(0, std::memory_order_relaxed);
+  stats_counters.closure_traversals.store(0, std::memory_order_relaxed);
+  stats_counters.closure_cache_hits.store(0, std::memory_order_relaxed);
+  for (int p = 0; p < NSTATS_PHASES; ++p)
+    stats_counters.nanoseconds[p].store(0, std::memory_order_relaxed);
+}
+
+static void print_stats_field(Writer& w, char const* name, long long value) {
+  w.put(",\n  \"");
+  w.put(name);
+  w.put("\": ");
+  w.put_int(value);
+}
+
+void print_stats(Writer& w, Stats const& stats) {
+  w.put("{\n  \"enabled\": ");
+  w.put(stats_enabled ? "true" : "false");
+  w.put(",\n  \"live\": {");
+  for (int t = 0; t < NTYPES; ++t) {
+    w.put(t ? ", \"" : "\"");
+    w.put(type_names[t]);
+    w.put("\": ");
+    w.put_int(stats.live[t]);
+  }
+  w.put('}');
+  print_stats_field(w, "uses", stats.uses);
+  print_stats_field(w, "helpers", stats.helpers);
+  print_stats_field(w, "bytes_allocated", stats.bytes_allocated);
+  print_stats_field(w, "closure_traversals", stats.closure_traversals);
+  print_stats_field(w, "closure_cache_hits", stats.closure_cache_hits);
+  w.put(",\n  \"seconds\": {");
+  for (int p = 0; p < NSTATS_PHASES; ++p) {
+    w.put(p ? ", \"" : "\"");
+    w.put(stats_phase_names[p]);
+    w.put("\": ");
+    w.put_fixed(stats.seconds[p]);
+  }
+  w.put("}\n}\n");
+}
+
+void write_stats_to_json(Stats const& stats, Sink& sink) {
+  Writer w(sink);
+  print_stats(w, stats);
+}
+
+void write_stats_to_json(Stats const& stats, char const* filename) {
+  FILE* f = fopen(filename, "w");
+  FileSink sink(f);
+  write_stats_to_json(stats, sink);
+  fclose(f);
 }
 
 }  // end namespace gmod
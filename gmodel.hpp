@@ -1,9 +1,15 @@
 #ifndef GMODEL_HPP
 #define GMODEL_HPP
 
+#include <atomic>
+#include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 #include <functional>
 
@@ -11,7 +17,7 @@ namespace gmod {
 
 constexpr double PI = 3.14159265359;
 
-enum { NTYPES = 11 };
+enum { NTYPES = 12 };
 
 enum {
   POINT = 0,
@@ -24,7 +30,8 @@ enum {
   VOLUME = 7,
   LOOP = 8,
   SHELL = 9,
-  GROUP = 10
+  GROUP = 10,
+  INSTANCE = 11
 };
 
 extern char const* const type_names[NTYPES];
@@ -42,49 +49,252 @@ enum {
   REVERSE = 1,
 };
 
+/* threads used by the parallel algorithms, including the
+   .geo/.dmg writers; 0 means one per hardware thread */
+extern int num_threads;
+
+/* runs body(0) ... body(n - 1) on a shared thread pool, with
+   the calling thread taking part; nested calls run serially */
+void parallel_for(std::size_t n, std::function<void(std::size_t)> const& body);
+
 struct Object;
 
 typedef std::shared_ptr<Object> ObjPtr;
 
+/* hands out object ids; in atomic mode ids may be
+   drawn from several threads at once */
+struct IdAllocator {
+  IdAllocator(bool atomic = false);
+  int allocate(int n = 1);
+  void skip_past(int id);
+  std::atomic<int> next;
+  bool atomic;
+};
+
+/* A Model is an optional arena for objects.
+   While a Model is current on a thread, new objects and their
+   use lists are carved out of its contiguous pools instead of
+   being individually heap-allocated, and the ObjPtrs handed out
+   share a single reference count owned by the Model.
+   Everything is released at once when the Model is destroyed,
+   so ObjPtrs into a Model must not be dereferenced after that.
+   Points get a pool of their own, so a Model's coordinates
+   sit in dense runs that the batch transforms stream through.
+   Objects created in a Model are numbered by its own ids, so
+   independent Models can be built on separate threads.
+   A Model must only be used by one thread at a time. The Models
+   in parts hold objects this Model's objects may refer to, such
+   as those made by build_parts, and are destroyed with it. */
+struct Model {
+  Model(bool atomic_ids = false);
+  ~Model();
+  Model(Model const&) = delete;
+  Model& operator=(Model const&) = delete;
+  void* allocate(std::size_t size, std::size_t align);
+  void* allocate_point(std::size_t size, std::size_t align);
+  void* allocate_block(std::size_t size);
+  void deallocate_block(void* p, std::size_t size);
+  std::shared_ptr<void> anchor;
+  std::vector<Object*> objects;
+  std::vector<char*> chunks;
+  char* chunk_pos;
+  char* chunk_end;
+  char* point_pos;
+  char* point_end;
+  std::vector<void*> free_blocks[32];
+  std::size_t bytes_reserved;
+  IdAllocator ids;
+  std::vector<std::unique_ptr<Model>> parts;
+};
+
+void set_current_model(Model* model);
+Model* get_current_model();
+
+/* allocates from the Model that was current when the
+   container was created, or from the heap if there was none */
+template <typename T>
+struct ModelAllocator {
+  typedef T value_type;
+  Model* model;
+  ModelAllocator() : model(get_current_model()) {}
+  template <typename U>
+  ModelAllocator(ModelAllocator<U> const& other) : model(other.model) {}
+  T* allocate(std::size_t n) {
+    if (!model) return static_cast<T*>(::operator new(n * sizeof(T)));
+    return static_cast<T*>(model->allocate_block(n * sizeof(T)));
+  }
+  void deallocate(T* p, std::size_t n) {
+    if (!model) ::operator delete(p);
+    else model->deallocate_block(p, n * sizeof(T));
+  }
+};
+
+template <typename T, typename U>
+bool operator==(ModelAllocator<T> const& a, ModelAllocator<U> const& b) {
+  return a.model == b.model;
+}
+
+template <typename T, typename U>
+bool operator!=(ModelAllocator<T> const& a, ModelAllocator<U> const& b) {
+  return a.model != b.model;
+}
+
 struct Use {
   int dir;
   ObjPtr obj;
 };
 
+typedef std::vector<Use, ModelAllocator<Use>> UseList;
+typedef std::vector<ObjPtr, ModelAllocator<ObjPtr>> ObjList;
+
+struct ClosureCache;
+
 struct Object {
   int type;
   int id;
-  std::vector<Use> used;
-  std::vector<ObjPtr> helpers;
-  std::vector<ObjPtr> embedded;
-  int scratch;
+  UseList used;
+  ObjList helpers;
+  ObjList embedded;
+  ClosureCache* closure_cache;
   Object(int type);
   virtual ~Object();
 };
 
 ObjPtr new_object(int type);
 
-int get_used_dir(ObjPtr user, ObjPtr used);
-std::vector<ObjPtr> get_objs_used(ObjPtr user);
+/* Associates objects with non-negative integers for the span
+   of one traversal, standing in for marks on the objects
+   themselves. clear() is O(1), and traversals that each use
+   their own ObjectIndex may share objects across threads. */
+struct ObjectIndex {
+  ObjectIndex();
+  void clear();
+  void reserve(std::size_t n);
+  int find(Object const* o) const;
+  bool insert(Object const* o, int value);
+  void assign(Object const* o, int value);
+  std::size_t size() const { return count; }
+  struct Slot {
+    Object const* key;
+    unsigned stamp;
+    int value;
+  };
+  std::vector<Slot> slots;
+  unsigned epoch;
+  std::size_t count;
+};
+
+int get_used_dir(ObjPtr const& user, ObjPtr const& used);
+std::vector<ObjPtr> get_objs_used(ObjPtr const& user);
+
+/* destination for serialized models */
+struct Sink {
+  virtual ~Sink();
+  virtual void write(char const* data, std::size_t size) = 0;
+};
+
+/* writes to an open file or pipe, which it does not close */
+struct FileSink : public Sink {
+  FileSink(FILE* f);
+  void write(char const* data, std::size_t size) override;
+  FILE* file;
+};
+
+struct BufferSink : public Sink {
+  void write(char const* data, std::size_t size) override;
+  std::string buffer;
+};
+
+/* Formats text into a fixed buffer and passes it to its Sink
+   in large blocks. Its output matches the printf formats the
+   writers always used: put_fixed is "%f". */
+struct Writer {
+  Writer(Sink& sink, std::size_t capacity = std::size_t(1) << 20);
+  ~Writer();
+  Writer(Writer const&) = delete;
+  Writer& operator=(Writer const&) = delete;
+  void flush();
+  void put(char c) {
+    if (size == buffer.size()) flush();
+    buffer[size++] = c;
+  }
+  void put(char const* s);
+  void put(char const* s, std::size_t n);
+  void put_int(long long i);
+  void put_fixed(double x);
+  Sink& sink;
+  std::vector<char> buffer;
+  std::size_t size;
+};
+
+void print_object(Writer& w, ObjPtr const& obj);
+void print_object_physical(Writer& w, ObjPtr const& obj);
+/* with compact_ids the closure is numbered from zero in the order
+   it is printed, an instance taking up the ids of its whole copy,
+   so the output does not depend on the order objects were made
+   in; the objects keep their own ids */
+void print_closure(Writer& w, ObjPtr obj, bool compact_ids = false);
+void print_simple_object(Writer& w, ObjPtr const& obj);
 
 void print_object(FILE* f, ObjPtr obj);
 void print_object_physical(FILE* f, ObjPtr obj);
 void print_closure(FILE* f, ObjPtr obj);
 void print_simple_object(FILE* f, ObjPtr obj);
 
-void write_closure_to_geo(ObjPtr obj, char const* filename);
+void write_closure_to_geo(ObjPtr obj, Sink& sink, bool compact_ids = false);
+void write_closure_to_geo(ObjPtr obj, char const* filename,
+    bool compact_ids = false);
+
+/* Incremental .geo writing. A GeoCache keeps the text of every
+   record printed through it together with what the record was
+   made from: a point's id, position and size, or an entity's id
+   and the ids and directions it refers to. Printing through it
+   again formats only the records whose inputs differ, whatever
+   changed them, and copies the text of the rest; the output is
+   identical to print_closure with the objects' own ids. Instances
+   are always formatted. Records formatted again are appended, and
+   the cache compacts itself once stale text outweighs the live
+   text, so it holds at most about twice the file. */
+struct GeoCache {
+  struct Entry {
+    Object const* object;
+    std::size_t text, text_size;
+    std::size_t physical, physical_size;
+    std::size_t signature, signature_size;
+  };
+  ObjectIndex index;
+  std::vector<Entry> entries;
+  std::string text;
+  std::vector<long long> signatures;
+  std::size_t reused = 0;
+  std::size_t formatted = 0;
+};
+void print_closure(Writer& w, ObjPtr obj, GeoCache& cache);
+void write_closure_to_geo(ObjPtr obj, char const* filename, GeoCache& cache);
 
+void print_object_dmg(Writer& w, ObjPtr const& obj);
 void print_object_dmg(FILE* f, ObjPtr obj);
 int count_of_type(std::vector<ObjPtr> const& objs, int type);
 int count_of_dim(std::vector<ObjPtr> const& objs, int dim);
+void print_closure_dmg(Writer& w, ObjPtr obj, bool compact_ids = false);
 void print_closure_dmg(FILE* f, ObjPtr obj);
 
-void write_closure_to_dmg(ObjPtr obj, char const* filename);
+void write_closure_to_dmg(ObjPtr obj, Sink& sink, bool compact_ids = false);
+void write_closure_to_dmg(ObjPtr obj, char const* filename,
+    bool compact_ids = false);
 
 void add_use(ObjPtr by, int dir, ObjPtr of);
 void add_helper(ObjPtr to, ObjPtr h);
+/* the closure in reverse breadth-first order, ending with obj.
+   the second form uses only `visited`, so traversals may run
+   concurrently. The writers cache the closures they print until
+   the next add_use, add_helper or embed; code that edits use lists
+   directly must call invalidate_closures() afterwards. */
 std::vector<ObjPtr> get_closure(ObjPtr obj, bool include_helpers,
     bool include_embedded = false);
+std::vector<ObjPtr> get_closure(ObjPtr obj, bool include_helpers,
+    bool include_embedded, ObjectIndex& visited);
+void invalidate_closures();
 std::vector<ObjPtr> filter_by_dim(std::vector<ObjPtr> const& objs, int dim);
 
 struct Vector {
@@ -171,6 +381,42 @@ struct Point : public Object {
 
 typedef std::shared_ptr<Point> PointPtr;
 
+/* Checked, non-owning views of objects whose type is already known
+   from Object::type. Unlike std::dynamic_pointer_cast these cost
+   neither an RTTI lookup nor a reference count update; a view is
+   valid for as long as something owns the object. */
+
+static inline Point* as_point(Object* o) {
+  assert(o->type == POINT);
+  return static_cast<Point*>(o);
+}
+
+static inline Point* as_point(ObjPtr const& o) { return as_point(o.get()); }
+
+static inline PointPtr to_point(ObjPtr const& o) {
+  assert(o->type == POINT);
+  return std::static_pointer_cast<Point>(o);
+}
+
+static inline Point* edge_point_view(Object const* edge, int i) {
+  return as_point(edge->used[std::size_t(i)].obj.get());
+}
+
+static inline Point* arc_center_view(Object const* arc) {
+  assert(arc->type == ARC);
+  return as_point(arc->helpers[0].get());
+}
+
+static inline Point* ellipse_center_view(Object const* e) {
+  assert(e->type == ELLIPSE);
+  return as_point(e->helpers[0].get());
+}
+
+static inline Point* ellipse_major_pt_view(Object const* e) {
+  assert(e->type == ELLIPSE);
+  return as_point(e->helpers[1].get());
+}
+
 extern double default_size;
 
 PointPtr new_point();
@@ -179,8 +425,39 @@ PointPtr new_point3(Vector v, double size);
 std::vector<PointPtr> new_points(std::vector<Vector> vs);
 std::vector<PointPtr> filter_points(std::vector<ObjPtr> const& objs);
 
+void print_point(Writer& w, PointPtr const& p);
 void print_point(FILE* f, PointPtr p);
 
+/* Sets the size of every point below root (not those of instance
+   prototypes) in one pass: from a function of position, from a
+   batch function filling sizes for coordinate arrays, or from a
+   grid of samples interpolated trilinearly and clamped at its
+   edges. Batch functions run on the thread pool, one block of
+   points per call, so they must be safe to call concurrently. */
+typedef std::function<double(Vector)> SizeFunction;
+typedef std::function<void(double const* x, double const* y,
+    double const* z, std::size_t n, double* sizes)> BatchSizeFunction;
+struct SizeGrid {
+  Vector origin;
+  Vector spacing;
+  int counts[3];
+  std::vector<double> sizes; /* x varies fastest */
+};
+double sample_size_grid(SizeGrid const& grid, Vector at);
+void set_sizes(ObjPtr root, SizeFunction const& size_of);
+void set_sizes_batch(ObjPtr root, BatchSizeFunction const& sizes_of);
+void set_sizes(ObjPtr root, SizeGrid const& grid);
+
+/* Gmsh mesh size fields, which print_closure writes after the
+   entities as Field[1], Field[2]... with their minimum as the
+   background field. Option values are written as given, so
+   strings must carry their own quotes. */
+struct SizeField {
+  std::string type;
+  std::vector<std::pair<std::string, std::string>> options;
+};
+extern std::vector<SizeField> size_fields;
+
 struct Extruded {
   ObjPtr middle;
   ObjPtr end;
@@ -188,11 +465,45 @@ struct Extruded {
 
 typedef std::function<Vector(Vector)> Transform;
 
+/* Transforms whose type is known at compile time. The extrusions
+   have an overload for each of these, which inlines the transform
+   into the loop over points instead of calling through a Transform;
+   they still convert to a Transform where only that is accepted. */
+
+struct Translation {
+  Vector v;
+  Vector operator()(Vector a) const { return add_vectors(a, v); }
+};
+
+struct Affine {
+  Matrix linear;
+  Vector translation;
+  Vector operator()(Vector a) const {
+    return add_vectors(matrix_vector_product(linear, a), translation);
+  }
+};
+
+/* rotation by `angle` about the axis through `center` */
+struct Rotation {
+  Vector center;
+  Matrix linear;
+  Rotation(Vector center_in, Vector axis, double angle);
+  Vector operator()(Vector a) const {
+    return add_vectors(center,
+        matrix_vector_product(linear, subtract_vectors(a, center)));
+  }
+};
+
 Extruded extrude_point(PointPtr start, Vector v);
 Extruded extrude_point2(PointPtr start, Transform tr);
+Extruded extrude_point2(PointPtr start, Translation tr);
+Extruded extrude_point2(PointPtr start, Affine tr);
+Extruded extrude_point2(PointPtr start, Rotation tr);
+/* the batch extrusions record in `indices` where each input
+   landed in the returned vector, for use by the next stage */
 std::vector<Extruded> extrude_points(std::vector<PointPtr> const& points,
-    Transform tr);
-PointPtr edge_point(ObjPtr edge, int i);
+    Transform tr, ObjectIndex& indices);
+PointPtr edge_point(ObjPtr const& edge, int i);
 
 ObjPtr new_line();
 ObjPtr new_line2(PointPtr start, PointPtr end);
@@ -201,35 +512,51 @@ ObjPtr new_line4(Vector a, Vector b);
 
 ObjPtr new_arc();
 ObjPtr new_arc2(PointPtr start, PointPtr center, PointPtr end);
-PointPtr arc_center(ObjPtr arc);
-Vector arc_normal(ObjPtr arc);
+PointPtr arc_center(ObjPtr const& arc);
+Vector arc_normal(ObjPtr const& arc);
+void print_arc(Writer& w, ObjPtr const& arc);
 void print_arc(FILE* f, ObjPtr arc);
 
 ObjPtr new_ellipse();
 ObjPtr new_ellipse2(PointPtr start, PointPtr center, PointPtr major_pt,
                     PointPtr end);
-PointPtr ellipse_center(ObjPtr e);
-PointPtr ellipse_major_pt(ObjPtr e);
+PointPtr ellipse_center(ObjPtr const& e);
+PointPtr ellipse_major_pt(ObjPtr const& e);
+void print_ellipse(Writer& w, ObjPtr const& e);
 void print_ellipse(FILE* f, ObjPtr e);
 
 ObjPtr new_spline();
 ObjPtr new_spline2(std::vector<PointPtr> const& pts);
 ObjPtr new_spline3(std::vector<Vector> const& pts);
+void print_spline(Writer& w, ObjPtr const& e);
 void print_spline(FILE* f, ObjPtr e);
 
 Extruded extrude_edge(ObjPtr start, Vector v);
 Extruded extrude_edge2(ObjPtr start, Vector v, Extruded left, Extruded right);
-Extruded extrude_edge3(ObjPtr start, Transform tr, Extruded left, Extruded right);
+Extruded extrude_edge3(ObjPtr start, Transform tr, Extruded const& left,
+    Extruded const& right);
+Extruded extrude_edge3(ObjPtr start, Translation tr, Extruded const& left,
+    Extruded const& right);
+Extruded extrude_edge3(ObjPtr start, Affine tr, Extruded const& left,
+    Extruded const& right);
+Extruded extrude_edge3(ObjPtr start, Rotation tr, Extruded const& left,
+    Extruded const& right);
 std::vector<Extruded> extrude_edges(std::vector<ObjPtr> const& edges,
-    Transform tr, std::vector<Extruded> const& point_extrusions);
+    Transform tr, std::vector<Extruded> const& point_extrusions,
+    ObjectIndex& indices);
 
 ObjPtr new_loop();
-std::vector<PointPtr> loop_points(ObjPtr loop);
+std::vector<PointPtr> loop_points(ObjPtr const& loop);
 Extruded extrude_loop(ObjPtr start, Vector v);
 Extruded extrude_loop2(ObjPtr start, Vector v, ObjPtr shell, int shell_dir);
 Extruded extrude_loop3(ObjPtr start, Transform tr, ObjPtr shell, int shell_dir);
+Extruded extrude_loop3(ObjPtr start, Translation tr, ObjPtr shell,
+    int shell_dir);
+Extruded extrude_loop3(ObjPtr start, Affine tr, ObjPtr shell, int shell_dir);
+Extruded extrude_loop3(ObjPtr start, Rotation tr, ObjPtr shell, int shell_dir);
 Extruded extrude_loop4(ObjPtr start, ObjPtr shell, int shell_dir,
-    std::vector<Extruded> const& edge_extrusions);
+    std::vector<Extruded> const& edge_extrusions,
+    ObjectIndex const& indices);
 
 ObjPtr new_circle(Vector center, Vector normal, Vector x);
 ObjPtr new_ellipse3(Vector center, Vector major, Vector minor);
@@ -251,8 +578,45 @@ ObjPtr new_ruled2(ObjPtr loop);
 void add_hole_to_face(ObjPtr face, ObjPtr loop);
 Extruded extrude_face(ObjPtr face, Vector v);
 Extruded extrude_face2(ObjPtr face, Transform tr);
-Extruded extrude_face3(ObjPtr face, std::vector<Extruded> const& edge_extrusions);
+Extruded extrude_face2(ObjPtr face, Translation tr);
+Extruded extrude_face2(ObjPtr face, Affine tr);
+Extruded extrude_face2(ObjPtr face, Rotation tr);
+Extruded extrude_face3(ObjPtr face,
+    std::vector<Extruded> const& edge_extrusions,
+    ObjectIndex const& indices);
 Extruded extrude_face_group(ObjPtr face_group, Transform tr);
+Extruded extrude_face_group(ObjPtr face_group, Translation tr);
+Extruded extrude_face_group(ObjPtr face_group, Affine tr);
+Extruded extrude_face_group(ObjPtr face_group, Rotation tr);
+/* extrude many faces, or many loops each into a new shell, with
+   one transform: points and edges they share are extruded only
+   once, and the i'th result belongs to the i'th input */
+std::vector<Extruded> extrude_faces(std::vector<ObjPtr> const& faces,
+    Transform tr);
+std::vector<Extruded> extrude_faces(std::vector<ObjPtr> const& faces,
+    Translation tr);
+std::vector<Extruded> extrude_faces(std::vector<ObjPtr> const& faces,
+    Affine tr);
+std::vector<Extruded> extrude_faces(std::vector<ObjPtr> const& faces,
+    Rotation tr);
+std::vector<Extruded> extrude_loops(std::vector<ObjPtr> const& loops,
+    Transform tr);
+std::vector<Extruded> extrude_loops(std::vector<ObjPtr> const& loops,
+    Translation tr);
+std::vector<Extruded> extrude_loops(std::vector<ObjPtr> const& loops,
+    Affine tr);
+std::vector<Extruded> extrude_loops(std::vector<ObjPtr> const& loops,
+    Rotation tr);
+/* extrudes a face through a stack of layers in one pass: layer i
+   extrudes the end face of layer i - 1 (the face itself for i = 0)
+   by the i'th offset or step, and the i'th result holds its volume
+   and end face. Each volume is also added to `group` if given. */
+std::vector<Extruded> extrude_layers(ObjPtr face,
+    std::vector<Vector> const& offsets, ObjPtr group = nullptr);
+std::vector<Extruded> extrude_layers(ObjPtr face,
+    std::vector<Transform> const& steps, ObjPtr group = nullptr);
+std::vector<Extruded> extrude_layers(ObjPtr face,
+    std::vector<Affine> const& steps, ObjPtr group = nullptr);
 ObjPtr face_loop(ObjPtr face);
 
 ObjPtr new_shell();
@@ -282,13 +646,176 @@ void weld_volume_face_into(ObjPtr big_volume, ObjPtr small_volume,
 void weld_plane_with_holes_into(ObjPtr big_volume, ObjPtr small_volume,
                            ObjPtr big_volume_face, ObjPtr small_volume_face);
 
-Vector eval(ObjPtr o, double const* param);
+/* Evaluates a curve at parameters in [0, 1] from its start to its
+   end. eval_many sets up the curve once and then evaluates all n
+   parameters in blocks; splines follow Gmsh's Catmull-Rom curve
+   through their start point, helpers and end point. */
+Vector eval(ObjPtr const& o, double const* param);
+void eval_many(ObjPtr const& o, double const* params, std::size_t n,
+    Vector* out);
+
+/* in-place x = linear * x + translation over coordinate arrays,
+   written as fixed-width blocks of plain loops so the compiler
+   can vectorize them */
+void transform_coordinates(double* x, double* y, double* z, std::size_t n,
+    Matrix linear, Vector translation);
+void transform_points(Point* const* points, std::size_t n, Matrix linear,
+    Vector translation);
 
 void transform_closure(ObjPtr object, Matrix linear, Vector translation);
 
+/* a copy of the closure with helpers and embedded objects under
+   new ids; each copy embeds the copies of what its original embeds */
 ObjPtr copy_closure(ObjPtr object);
 
+/* An Instance stands for a transformed copy of the closure of its
+   prototype without holding one. It reserves the ids of the copy
+   when created, and the .geo, .dmg and binary writers print the
+   copy as if it existed, numbering its objects from first_id in
+   closure order; its own id is that of the copied prototype.
+   Instances are leaves of the closures they appear in, and the
+   prototype must not change size or contain instances itself. */
+struct Instance : public Object {
+  ObjPtr prototype;
+  Matrix linear;
+  Vector translation;
+  int first_id;
+  Instance();
+  ~Instance();
+};
+
+static inline Instance* as_instance(Object* o) {
+  assert(o->type == INSTANCE);
+  return static_cast<Instance*>(o);
+}
+
+static inline Instance* as_instance(ObjPtr const& o) {
+  return as_instance(o.get());
+}
+
+ObjPtr new_instance(ObjPtr prototype, Matrix linear, Vector translation);
+/* builds the copy an instance stands for, with the ids it reserved */
+ObjPtr materialize_instance(ObjPtr instance);
+/* replaces every instance below root by its materialized copy,
+   as needed before welding into or modifying one */
+void materialize_instances(ObjPtr root);
+
+/* Fully built transformed copies of a closure, the k'th moved by
+   linears[k] and translations[k]; the copies are filled in on the
+   thread pool. The patterns place `count` (for grids count_a *
+   count_b) copies in all, of which the first is the original, so
+   they return the others, in order. circular_pattern spaces them
+   evenly around the axis through center. */
+std::vector<ObjPtr> pattern_closure(ObjPtr object,
+    std::vector<Matrix> const& linears,
+    std::vector<Vector> const& translations);
+std::vector<ObjPtr> linear_pattern(ObjPtr object, Vector step, int count);
+std::vector<ObjPtr> circular_pattern(ObjPtr object, Vector center,
+    Vector axis, int count);
+std::vector<ObjPtr> grid_pattern(ObjPtr object, Vector step_a, int count_a,
+    Vector step_b, int count_b);
+
+/* Concurrent construction of independent parts. The builds are
+   split into runs of consecutive parts, and idle threads of the
+   pool claim one run at a time. Each run is built in order into a
+   Model of its own, which then becomes one of the parts of the
+   calling thread's current Model. Without a current Model, the
+   parts are heap-allocated as usual, and each run records what it
+   makes until the parts are numbered. A build may read objects
+   made elsewhere, such as a prototype to copy, but must not change
+   them or use the calling thread's Model. The objects the builds
+   made, including those read from files with their own ids, are
+   then numbered part by part, past every id handed out so far, so
+   their ids do not depend on the thread count or on timing;
+   objects that existed before keep theirs. The merging
+   functions add the parts in order. */
+typedef std::function<ObjPtr()> PartBuild;
+std::vector<ObjPtr> build_parts(std::vector<PartBuild> const& builds);
+void insert_parts_into(ObjPtr into, std::vector<PartBuild> const& builds);
+ObjPtr group_parts(std::vector<PartBuild> const& builds);
+
+/* Deferred construction. A Lazy is one output of a node recording
+   how to build some objects from the outputs of its inputs; force
+   builds what it depends on, once, in dependency order, and then
+   drops the recipe, so nodes that are never forced never allocate
+   and discarded variants cost only their small node graphs.
+   Operations that modify an object, like lazy_insert_into, output
+   that object again, and later steps should use the new Lazy so
+   they are ordered after the change. Forcing is single-threaded. */
+struct LazyNode;
+struct Lazy {
+  std::shared_ptr<LazyNode> node;
+  std::size_t output;
+};
+typedef std::function<std::vector<ObjPtr>(std::vector<ObjPtr> const&)>
+    LazyBuild;
+struct LazyNode {
+  LazyBuild build;
+  std::vector<Lazy> inputs;
+  std::vector<ObjPtr> outputs;
+  bool built;
+};
+Lazy defer_value(ObjPtr built);
+Lazy defer(std::function<ObjPtr(std::vector<ObjPtr> const&)> build,
+    std::vector<Lazy> inputs = std::vector<Lazy>());
+std::vector<Lazy> defer_many(LazyBuild build, std::size_t noutputs,
+    std::vector<Lazy> inputs = std::vector<Lazy>());
+ObjPtr force(Lazy const& lazy);
+bool is_forced(Lazy const& lazy);
+
+struct LazyExtruded {
+  Lazy middle;
+  Lazy end;
+};
+Lazy lazy_cube(Vector origin, Vector x, Vector y, Vector z);
+Lazy lazy_ball(Vector center, Vector normal, Vector x);
+LazyExtruded lazy_extrude_face(Lazy face, Vector v);
+Lazy lazy_group(std::vector<Lazy> const& members);
+Lazy lazy_insert_into(Lazy into, Lazy inserted);
+Lazy lazy_assembly_boundary(Lazy assembly);
+
+/* Memoization of generated sub-models. A MemoKey hashes the
+   arguments of a construction, objects by the topology and
+   geometry of their closures rather than their ids. memoize
+   builds a miss once, outside any Model, and keeps the result as
+   a private prototype; every call then returns a fresh copy_closure
+   of it, or an identity Instance of it if `instanced`. If
+   memo_cache_directory is set, prototypes are also kept there as
+   binary models named by the key's hash, so later runs skip the
+   build too. Keys are told apart by all their words, in memory and
+   in the files, not by the hash alone. A key must cover every
+   input of its build, such as default_size for memo_cube and
+   memo_ball. Built objects must not contain instances. */
+struct MemoKey {
+  MemoKey(char const* what);
+  MemoKey& add(std::uint64_t bits);
+  MemoKey& add(double x);
+  MemoKey& add(Vector v);
+  MemoKey& add(ObjPtr const& o);
+  std::uint64_t hash;
+  std::vector<std::uint64_t> words;
+};
+std::uint64_t hash_closure(ObjPtr const& o);
+extern std::string memo_cache_directory;
+ObjPtr memoize(MemoKey const& key, std::function<ObjPtr()> const& build,
+    bool instanced = false);
+void clear_memo_cache();
+ObjPtr memo_cube(Vector origin, Vector x, Vector y, Vector z);
+ObjPtr memo_ball(Vector center, Vector normal, Vector x);
+/* the volume swept by a copy of face, not sharing face itself */
+ObjPtr memo_extrude_face(ObjPtr face, Vector v);
+
+/* the sides used by exactly one cell of an assembly, whose cells
+   may be grouped into nested groups; the boundaries version also
+   splits a boundary of edges into its separate loops, each in
+   walking order. The assembly is left as it is: the sides of an
+   instance cell are moved copies of its prototype's, numbered as
+   the instance prints them. Cells of different dimensions are an
+   error. insert_into and weld_half_shell_onto, whose boundaries
+   must share sides with the cells, first replace instance cells
+   in their groups by their materialized copies. */
 ObjPtr collect_assembly_boundary(ObjPtr assembly);
+std::vector<ObjPtr> collect_assembly_boundaries(ObjPtr assembly);
 
 void unscramble_loop(ObjPtr loop);
 
@@ -297,6 +824,169 @@ void weld_half_shell_onto(ObjPtr volume, ObjPtr big_face,
 
 void embed(ObjPtr into, ObjPtr embedded);
 
+/* Axis-aligned bounding boxes. They are exact for points, lines
+   and arcs; quarter ellipses are bounded by the parallelogram of
+   their center and endpoints and splines by their control points.
+   get_box caches boxes on the objects until the next topology
+   change like get_closure, so code that moves points directly must
+   call invalidate_closures() afterwards. Overlap means the
+   interiors intersect by more than the tolerance. */
+struct Box {
+  Vector lo, hi;
+};
+Box empty_box();
+Box unite_boxes(Box a, Box b);
+bool box_contains(Box outer, Box inner, double tolerance);
+bool boxes_overlap(Box a, Box b, double tolerance);
+Box get_box(ObjPtr const& o);
+/* a Gmsh Box field: size_in inside the box and size_out outside */
+SizeField box_size_field(Box box, double size_in, double size_out);
+
+/* A bounding volume hierarchy over the boxes of some objects,
+   split at the median center along the widest axis. Queries
+   return indices into the objects it was built from. */
+struct BoxTree {
+  struct Node {
+    Box box;
+    std::size_t first, end;
+    int left, right;
+  };
+  std::vector<Node> nodes;
+  std::vector<ObjPtr> objects;
+  std::vector<std::size_t> order;
+  std::vector<Box> boxes;
+};
+BoxTree build_box_tree(std::vector<ObjPtr> const& objects);
+std::vector<std::size_t> find_overlapping(BoxTree const& tree, Box box,
+    double tolerance);
+
+/* Checks the inclusions below root before they reach Gmsh: every
+   hole of a face or volume must lie within its outer boundary,
+   holes of one object must not overlap, and embedded objects must
+   lie within their host. Containment is judged by boxes. Holes
+   whose boxes overlap are tested exactly when both are balls or
+   disks, or both convex with straight edges; other such pairs are
+   printed as candidates that may overlap and not counted. Prints
+   each problem to stderr and returns how many there were. */
+int check_inclusions(ObjPtr root, double tolerance);
+
+/* Merges the coincident entities below root: points within the
+   tolerance of one another, then edges joining the same points
+   and faces bounded by the same edges, redirecting every use to
+   the survivor. Returns how many objects were merged away. */
+int merge_coincident(ObjPtr root, double tolerance);
+
+/* Binary models store the closure of an object as flat arrays
+   in native byte order: types, ids, point coordinates and sizes,
+   and offset-indexed lists of uses, helpers and embedded objects.
+   Reading maps the file and rebuilds the objects (in the current
+   Model, if any) with their original ids in a single pass; the
+   in-memory overload reads the arrays in place, so its data must
+   be 8-byte aligned. Malformed files are reported and abort. */
+void write_closure_to_binary(ObjPtr obj, Sink& sink);
+void write_closure_to_binary(ObjPtr obj, char const* filename);
+ObjPtr read_closure_from_binary(char const* data, std::size_t size);
+ObjPtr read_closure_from_binary(char const* filename);
+
+/* A frozen closure keeps the binary format's tables in memory, for
+   models that are only read from then on: objects are numbered by
+   position, children first and the root last, with instances
+   expanded into their copies. Object i's uses, helpers and embedded
+   objects are entries[l] from offsets[l][i] to offsets[l][i + 1],
+   for l = 0, 1, 2; uses hold the position shifted left once with the
+   direction in bit 0. Points index coords (x, y, z, size) through
+   point_of, which is ~0 for other objects. Closures, counts and
+   boundaries come out as positions and packed uses, and the writers
+   print the root's closure as the object writers would, except that
+   expanded instances need not come in the same order. thaw builds
+   the objects again, with their ids. */
+struct FrozenModel {
+  std::vector<std::int8_t> types;
+  std::vector<std::int32_t> ids;
+  std::vector<std::uint32_t> point_of;
+  std::vector<double> coords[4];
+  std::vector<std::uint32_t> offsets[3];
+  std::vector<std::uint32_t> entries[3];
+  std::uint32_t root() const { return std::uint32_t(types.size() - 1); }
+  std::size_t bytes() const;
+};
+FrozenModel freeze(ObjPtr obj);
+ObjPtr thaw(FrozenModel const& frozen);
+std::vector<std::uint32_t> get_closure(FrozenModel const& frozen,
+    std::uint32_t root, bool include_helpers, bool include_embedded = false);
+int count_of_dim(FrozenModel const& frozen,
+    std::vector<std::uint32_t> const& objs, int dim);
+std::vector<std::uint32_t> collect_assembly_boundary(
+    FrozenModel const& frozen, std::uint32_t assembly);
+void print_closure(Writer& w, FrozenModel const& frozen);
+void print_closure_dmg(Writer& w, FrozenModel const& frozen);
+void write_closure_to_binary(FrozenModel const& frozen, Sink& sink);
+
+/* Reads the .geo subset that print_closure writes: elementary
+   entities, loops, "In" embeddings, and Physical groups and size
+   fields, which it ignores. Objects keep the ids in the file. The
+   result is the only object nothing else refers to, or else a
+   GROUP of all such objects in the order print_closure would have
+   visited them. */
+ObjPtr read_closure_from_geo(char const* data, std::size_t size);
+ObjPtr read_closure_from_geo(char const* filename);
+
+/* Triangles approximating faces for quick previews. Curved edges
+   are sampled at `segments` even parameters, planes (and ruled
+   faces not bounded by three or four edges) are projected onto
+   the plane of their outer loop and triangulated around their
+   holes, and ruled faces are Coons patches of their sides.
+   tessellate_closure works on the faces below root in parallel,
+   instances as their transformed prototype faces, and then calls
+   back with each in closure order. STL files are binary, in
+   native byte order. */
+struct Tessellation {
+  std::vector<Vector> vertices;
+  std::vector<int> triangles; /* three vertex indices each */
+};
+Tessellation tessellate_face(ObjPtr const& face, int segments);
+void tessellate_closure(ObjPtr root, int segments,
+    std::function<void(ObjPtr const&, Tessellation const&)> const& callback);
+void write_closure_to_stl(ObjPtr root, int segments, Sink& sink);
+void write_closure_to_stl(ObjPtr root, int segments, char const* filename);
+
+/* Instrumentation, counted only when the library is built with
+   GMOD_STATS (the cmake option of that name); otherwise every
+   count stays zero. Live objects, uses and helpers are current
+   totals. Bytes allocated (objects and Model arena chunks, but not
+   the use lists of objects outside a Model), closure traversals
+   and phase times add up until reset_stats. A phase's time is the
+   wall-clock time spent in its outermost calls on each thread, so
+   two phases overlap when one calls the other, such as copying
+   within memo_extrude_face. Welding includes merge_coincident and
+   writing covers every .geo, .dmg, binary and STL writer. */
+enum {
+  STATS_EXTRUDE = 0,
+  STATS_COPY = 1,
+  STATS_WELD = 2,
+  STATS_WRITE = 3,
+  NSTATS_PHASES = 4
+};
+
+extern char const* const stats_phase_names[NSTATS_PHASES];
+extern bool const stats_enabled;
+
+struct Stats {
+  long long live[NTYPES];
+  long long uses;
+  long long helpers;
+  long long bytes_allocated;
+  long long closure_traversals; /* breadth-first searches run */
+  long long closure_cache_hits; /* writes that reused a closure */
+  double seconds[NSTATS_PHASES];
+};
+
+Stats get_stats();
+void reset_stats();
+void print_stats(Writer& w, Stats const& stats);
+void write_stats_to_json(Stats const& stats, Sink& sink);
+void write_stats_to_json(Stats const& stats, char const* filename);
+
 }  // end namespace gmod
 
 static inline gmod::Vector operator+(gmod::Vector a, gmod::Vector b) {
@@ -1,7 +1,6 @@
 #include <gmodel.hpp>
 #include <minidiff.hpp>
 #include <vector>
-#include <cassert>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -31,14 +30,14 @@ bool readFileCoords(std::string filePath, std::vector<double>& buffer) {
 
 int main(int argc, char** argv)
 {
-  assert(argc==3);
+  CHECK(argc==3);
   std::string in = std::string(argv[1]);
   std::string geo = std::string(argv[2]) + ".geo";
   std::string dmg = std::string(argv[2]) + ".dmg";
 
   std::vector<double> xy;
   bool read = readFileCoords(in, xy);
-  assert(read);
+  CHECK(read);
 
   // gather the points with +y, top, and -y, bottom, coords
   // skip the coords with y=0, we'll add those later
@@ -0,0 +1,97 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+/* an n by n grid of unit squares sharing edges, leaving out the
+   squares for which skip(i, j) holds */
+template <class Skip>
+static std::vector<gmod::ObjPtr> build_grid(int n, Skip skip)
+{
+  std::vector<gmod::PointPtr> points;
+  for (int j = 0; j <= n; ++j)
+  for (int i = 0; i <= n; ++i)
+    points.push_back(gmod::new_point2(gmod::Vector{double(i), double(j), 0}));
+  auto pt = [&](int i, int j) { return points[std::size_t(j * (n + 1) + i)]; };
+  std::vector<gmod::ObjPtr> xlines;
+  std::vector<gmod::ObjPtr> ylines;
+  for (int j = 0; j <= n; ++j)
+  for (int i = 0; i < n; ++i)
+    xlines.push_back(gmod::new_line2(pt(i, j), pt(i + 1, j)));
+  for (int j = 0; j < n; ++j)
+  for (int i = 0; i <= n; ++i)
+    ylines.push_back(gmod::new_line2(pt(i, j), pt(i, j + 1)));
+  std::vector<gmod::ObjPtr> faces;
+  for (int j = 0; j < n; ++j)
+  for (int i = 0; i < n; ++i) {
+    if (skip(i, j)) continue;
+    auto loop = gmod::new_loop();
+    gmod::add_use(loop, gmod::FORWARD, xlines[std::size_t(j * n + i)]);
+    gmod::add_use(loop, gmod::FORWARD, ylines[std::size_t(j * (n + 1) + i + 1)]);
+    gmod::add_use(loop, gmod::REVERSE, xlines[std::size_t((j + 1) * n + i)]);
+    gmod::add_use(loop, gmod::REVERSE, ylines[std::size_t(j * (n + 1) + i)]);
+    faces.push_back(gmod::new_plane2(loop));
+  }
+  return faces;
+}
+
+/* the faces in groups of up to four, inside one more group */
+static gmod::ObjPtr nest(std::vector<gmod::ObjPtr> const& faces)
+{
+  auto outer = gmod::new_group();
+  gmod::ObjPtr inner;
+  for (std::size_t i = 0; i < faces.size(); ++i) {
+    if (i % 4 == 0) {
+      inner = gmod::new_group();
+      gmod::add_to_group(outer, inner);
+    }
+    gmod::add_to_group(inner, faces[i]);
+  }
+  return outer;
+}
+
+static gmod::Point* end_point(gmod::Use const& use)
+{
+  return gmod::edge_point_view(use.obj.get(), 1 - use.dir);
+}
+
+static gmod::Point* start_point(gmod::Use const& use)
+{
+  return gmod::edge_point_view(use.obj.get(), use.dir);
+}
+
+static void check_chained(gmod::ObjPtr loop)
+{
+  auto const& used = loop->used;
+  for (std::size_t i = 0; i < used.size(); ++i)
+    CHECK(end_point(used[i]) == start_point(used[(i + 1) % used.size()]));
+}
+
+int main()
+{
+  int const n = 10;
+  {
+    auto faces = build_grid(n, [](int, int) { return false; });
+    auto boundaries = gmod::collect_assembly_boundaries(nest(faces));
+    CHECK(boundaries.size() == 1);
+    CHECK(boundaries[0]->used.size() == 4 * n);
+    check_chained(boundaries[0]);
+    auto boundary = gmod::collect_assembly_boundary(nest(faces));
+    CHECK(boundary->type == gmod::LOOP);
+    CHECK(boundary->used.size() == 4 * n);
+    gmod::unscramble_loop(boundary);
+    check_chained(boundary);
+  }
+  {
+    /* a frame: the middle four squares are missing */
+    auto faces = build_grid(n, [](int i, int j) {
+      return i >= n / 2 - 1 && i <= n / 2 && j >= n / 2 - 1 && j <= n / 2;
+    });
+    auto boundaries = gmod::collect_assembly_boundaries(nest(faces));
+    CHECK(boundaries.size() == 2);
+    std::size_t total = 0;
+    for (auto const& loop : boundaries) {
+      check_chained(loop);
+      total += loop->used.size();
+    }
+    CHECK(total == 4 * n + 8);
+  }
+}
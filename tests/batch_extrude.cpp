@@ -0,0 +1,81 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+/* a grid of unit squares sharing their edges and corners */
+static std::vector<gmod::ObjPtr> build_grid(int n)
+{
+  std::vector<gmod::PointPtr> points;
+  for (int j = 0; j <= n; ++j)
+  for (int i = 0; i <= n; ++i)
+    points.push_back(gmod::new_point2(gmod::Vector{double(i), double(j), 0}));
+  auto pt = [&](int i, int j) { return points[std::size_t(j * (n + 1) + i)]; };
+  std::vector<gmod::ObjPtr> xlines;
+  std::vector<gmod::ObjPtr> ylines;
+  for (int j = 0; j <= n; ++j)
+  for (int i = 0; i < n; ++i)
+    xlines.push_back(gmod::new_line2(pt(i, j), pt(i + 1, j)));
+  for (int j = 0; j < n; ++j)
+  for (int i = 0; i <= n; ++i)
+    ylines.push_back(gmod::new_line2(pt(i, j), pt(i, j + 1)));
+  std::vector<gmod::ObjPtr> faces;
+  for (int j = 0; j < n; ++j)
+  for (int i = 0; i < n; ++i) {
+    auto loop = gmod::new_loop();
+    gmod::add_use(loop, gmod::FORWARD, xlines[std::size_t(j * n + i)]);
+    gmod::add_use(loop, gmod::FORWARD, ylines[std::size_t(j * (n + 1) + i + 1)]);
+    gmod::add_use(loop, gmod::REVERSE, xlines[std::size_t((j + 1) * n + i)]);
+    gmod::add_use(loop, gmod::REVERSE, ylines[std::size_t(j * (n + 1) + i)]);
+    faces.push_back(gmod::new_plane2(loop));
+  }
+  return faces;
+}
+
+int main()
+{
+  int const n = 8;
+  gmod::Vector const v{0, 0, 0.5};
+  std::string batch_geo;
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto faces = build_grid(n);
+    /* stands in for the face group below, so the ids line up */
+    gmod::new_group();
+    auto extrusions = gmod::extrude_faces(faces, gmod::Translation{v});
+    CHECK(extrusions.size() == faces.size());
+    auto group = gmod::new_group();
+    for (auto const& ext : extrusions) gmod::add_to_group(group, ext.middle);
+    auto closure = gmod::get_closure(group, false);
+    CHECK(gmod::count_of_dim(closure, 0) == 2 * (n + 1) * (n + 1));
+    CHECK(gmod::count_of_dim(closure, 3) == n * n);
+    batch_geo = geo_of(group);
+    gmod::set_current_model(nullptr);
+  }
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto faces = build_grid(n);
+    auto face_group = gmod::new_group();
+    for (auto const& face : faces) gmod::add_to_group(face_group, face);
+    auto ext = gmod::extrude_face_group(face_group, gmod::Translation{v});
+    CHECK(geo_of(ext.middle) == batch_geo);
+    gmod::set_current_model(nullptr);
+  }
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto a = gmod::new_square(gmod::Vector{0,0,0},
+        gmod::Vector{1,0,0}, gmod::Vector{0,1,0});
+    auto b = gmod::new_square(gmod::Vector{2,0,0},
+        gmod::Vector{1,0,0}, gmod::Vector{0,1,0});
+    std::vector<gmod::ObjPtr> loops = {gmod::face_loop(a), gmod::face_loop(b)};
+    auto extrusions = gmod::extrude_loops(loops, gmod::Translation{v});
+    CHECK(extrusions.size() == 2);
+    for (auto const& ext : extrusions) {
+      CHECK(ext.middle->type == gmod::SHELL);
+      CHECK(ext.middle->used.size() == 4);
+      CHECK(ext.end->type == gmod::LOOP);
+    }
+    gmod::set_current_model(nullptr);
+  }
+}
@@ -0,0 +1,62 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+static gmod::ObjPtr dimple()
+{
+  auto cube = gmod::new_cube(
+      gmod::Vector{0,0,0},
+      gmod::Vector{1,0,0},
+      gmod::Vector{0,1,0},
+      gmod::Vector{0,0,1});
+  auto cube_bottom = gmod::get_cube_face(cube, gmod::BOTTOM);
+  auto dimple_circle = gmod::new_circle(
+      gmod::Vector{0.5,0.5,0},
+      gmod::Vector{0,0,1},
+      gmod::Vector{0.25,0,0});
+  auto dimple_shell = gmod::new_shell();
+  gmod::make_hemisphere(dimple_circle,
+      new_point2(gmod::Vector{0.5,0.5,0}),
+      dimple_shell, gmod::FORWARD);
+  gmod::weld_half_shell_onto(cube, cube_bottom, dimple_shell, gmod::REVERSE);
+  return cube;
+}
+
+static gmod::ObjPtr line_in_cube()
+{
+  gmod::default_size = 0.5;
+  auto c = gmod::new_cube(
+      gmod::Vector{0,0,0},
+      gmod::Vector{1,0,0},
+      gmod::Vector{0,1,0},
+      gmod::Vector{0,0,1});
+  gmod::default_size = 0.05;
+  auto l = gmod::new_line4(gmod::Vector{.25,.5,.5}, gmod::Vector{.75,.5,.5});
+  gmod::embed(c, l);
+  gmod::default_size = 0.1;
+  return c;
+}
+
+static void round_trip(gmod::ObjPtr (*build)(), std::string const& name)
+{
+  gmod::Model built;
+  gmod::set_current_model(&built);
+  auto original = build();
+  gmod::write_closure_to_binary(original, (name + ".gmb").c_str());
+  gmod::Model loaded;
+  gmod::set_current_model(&loaded);
+  auto copy = gmod::read_closure_from_binary((name + ".gmb").c_str());
+  CHECK(loaded.objects.size() ==
+      gmod::get_closure(original, true, true).size());
+  prevent_regression(copy, "binary_" + name, name + "_gold");
+  auto r = gmod::rotation_matrix(gmod::Vector{0,0,1}, gmod::PI / 3);
+  gmod::transform_closure(original, r, gmod::Vector{1,2,3});
+  gmod::transform_closure(copy, r, gmod::Vector{1,2,3});
+  CHECK(geo_of(copy) == geo_of(original));
+  gmod::set_current_model(nullptr);
+}
+
+int main()
+{
+  round_trip(dimple, "dimple");
+  round_trip(line_in_cube, "line_in_cube");
+}
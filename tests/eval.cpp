@@ -0,0 +1,92 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <random>
+
+static bool near(gmod::Vector a, gmod::Vector b)
+{
+  return gmod::vector_norm(gmod::subtract_vectors(a, b)) < 1e-9;
+}
+
+static bool same(gmod::Vector a, gmod::Vector b)
+{
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static double at(gmod::ObjPtr const& curve, double u, int axis)
+{
+  auto p = gmod::eval(curve, &u);
+  return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+int main()
+{
+  int const n = 1001;
+  std::vector<double> params;
+  for (int i = 0; i < n; ++i) params.push_back(double(i) / (n - 1));
+  std::vector<gmod::Vector> out(n);
+  {
+    auto line = gmod::new_line4(gmod::Vector{1, 2, 3}, gmod::Vector{3, 2, 1});
+    double half = .5;
+    CHECK(near(gmod::eval(line, &half), gmod::Vector{2, 2, 2}));
+  }
+  {
+    /* lines end exactly on their points, so edges meet bit for bit */
+    std::mt19937 random(5);
+    std::uniform_real_distribution<double> coordinate(-10, 10);
+    auto point = [&]() {
+      return gmod::Vector{coordinate(random), coordinate(random),
+          coordinate(random)};
+    };
+    for (int i = 0; i < 1000; ++i) {
+      auto a = point();
+      auto b = point();
+      auto line = gmod::new_line2(gmod::new_point2(a), gmod::new_point2(b));
+      double ends[2] = {0, 1};
+      gmod::Vector at_ends[2];
+      gmod::eval_many(line, ends, 2, at_ends);
+      CHECK(same(at_ends[0], a));
+      CHECK(same(at_ends[1], b));
+    }
+  }
+  {
+    /* a quarter circle of radius 2 around (1, 1, 1) */
+    auto center = gmod::new_point2(gmod::Vector{1, 1, 1});
+    auto arc = gmod::new_arc2(gmod::new_point2(gmod::Vector{3, 1, 1}), center,
+        gmod::new_point2(gmod::Vector{1, 3, 1}));
+    gmod::eval_many(arc, params.data(), params.size(), out.data());
+    CHECK(near(out.front(), gmod::Vector{3, 1, 1}));
+    CHECK(near(out.back(), gmod::Vector{1, 3, 1}));
+    for (int i = 0; i < n; ++i) {
+      auto r = gmod::subtract_vectors(out[std::size_t(i)], center->pos);
+      CHECK(std::fabs(gmod::vector_norm(r) - 2) < 1e-9);
+      CHECK(near(out[std::size_t(i)], gmod::eval(arc, &params[std::size_t(i)])));
+    }
+    CHECK(std::fabs(at(arc, .5, 0) - (1 + std::sqrt(2.))) < 1e-9);
+  }
+  {
+    /* every quarter of an ellipse, both ways round */
+    auto loop = gmod::new_ellipse3(gmod::Vector{0, 0, 0},
+        gmod::Vector{2, 0, 0}, gmod::Vector{0, 1, 0});
+    for (auto const& use : loop->used) {
+      gmod::eval_many(use.obj, params.data(), params.size(), out.data());
+      CHECK(near(out.front(), gmod::edge_point_view(use.obj.get(), 0)->pos));
+      CHECK(near(out.back(), gmod::edge_point_view(use.obj.get(), 1)->pos));
+      for (auto p : out)
+        CHECK(std::fabs(p.x * p.x / 4 + p.y * p.y - 1) < 1e-9);
+    }
+  }
+  {
+    /* a spline passes through its points, one span per pair */
+    std::vector<gmod::Vector> pts = {
+        {0, 0, 0}, {1, 1, 0}, {2, 0, 0}, {3, 1, 0}};
+    auto spline = gmod::new_spline3(pts);
+    for (std::size_t i = 0; i < pts.size(); ++i)
+      CHECK(std::fabs(at(spline, double(i) / 3, 1) - pts[i].y) < 1e-12);
+    /* the end spans use reflected neighbours: (-1,-1) and (4,0) */
+    CHECK(std::fabs(at(spline, 1. / 6, 1) - 0.625) < 1e-12);
+    CHECK(std::fabs(at(spline, .5, 1) - 0.5) < 1e-12);
+    gmod::eval_many(spline, params.data(), params.size(), out.data());
+    for (std::size_t i = 0; i < params.size(); ++i)
+      CHECK(near(out[i], gmod::eval(spline, &params[i])));
+  }
+}
@@ -0,0 +1,61 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <string>
+
+int main()
+{
+  auto x = gmod::Vector{1, 0, 0};
+  auto y = gmod::Vector{0, 1, 0};
+  auto z = gmod::Vector{0, 0, 1};
+  auto model = gmod::new_group();
+  auto big = gmod::new_cube(gmod::Vector{0, 0, 0}, 4 * x, 4 * y, 4 * z);
+  gmod::insert_into(big, gmod::new_ball(gmod::Vector{1, 1, 1}, z, .5 * x));
+  gmod::embed(big, gmod::new_line4(gmod::Vector{3, 3, 1},
+      gmod::Vector{3, 3, 3}));
+  gmod::add_to_group(model, big);
+  gmod::add_to_group(model, gmod::new_elliptical_disk(
+      gmod::Vector{0, 0, 9}, 2 * x, y));
+  gmod::add_to_group(model, gmod::new_spline3({gmod::Vector{0, 0, -1},
+      gmod::Vector{1, 1, -1}, gmod::Vector{2, 0, -1}}));
+  auto frozen = gmod::freeze(model);
+  auto closure = gmod::get_closure(model, true, true);
+  CHECK(frozen.types.size() == closure.size());
+  CHECK(frozen.bytes() < closure.size() * sizeof(gmod::Object));
+  /* closures and counts match those of the objects */
+  for (int helpers = 0; helpers < 2; ++helpers) {
+    auto objs = gmod::get_closure(model, helpers, true);
+    auto positions = gmod::get_closure(frozen, frozen.root(), helpers, true);
+    CHECK(positions.size() == objs.size());
+    for (std::size_t i = 0; i < objs.size(); ++i)
+      CHECK(frozen.ids[positions[i]] == objs[i]->id);
+    for (int d = 0; d < 4; ++d)
+      CHECK(gmod::count_of_dim(frozen, positions, d) ==
+            gmod::count_of_dim(objs, d));
+  }
+  /* the writers print the same files */
+  auto geo = geo_of(model);
+  CHECK(geo_of(frozen) == geo);
+  CHECK(dmg_of(frozen) == dmg_of(model));
+  gmod::BufferSink from_objects;
+  gmod::BufferSink from_tables;
+  gmod::write_closure_to_binary(model, from_objects);
+  gmod::write_closure_to_binary(frozen, from_tables);
+  CHECK(from_objects.buffer == from_tables.buffer);
+  auto thawed = gmod::thaw(frozen);
+  CHECK(geo_of(thawed) == geo);
+  {
+    /* the boundary of a group of cubes, as packed uses */
+    auto cubes = gmod::new_group();
+    for (int i = 0; i < 3; ++i)
+      gmod::add_to_group(cubes, gmod::new_cube(gmod::Vector{double(i), 0, 0},
+          x, y, z));
+    auto boundary = gmod::collect_assembly_boundary(cubes);
+    auto f = gmod::freeze(cubes);
+    auto sides = gmod::collect_assembly_boundary(f, f.root());
+    CHECK(sides.size() == boundary->used.size());
+    for (std::size_t i = 0; i < sides.size(); ++i) {
+      CHECK(f.ids[sides[i] >> 1] == boundary->used[i].obj->id);
+      CHECK(int(sides[i] & 1) == boundary->used[i].dir);
+    }
+  }
+}
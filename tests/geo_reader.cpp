@@ -0,0 +1,28 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <cstdlib>
+#include <cstring>
+
+int main()
+{
+  char const* const names[] = {
+    "cube", "cylinder", "cube_in_cube", "spline_shape",
+    "target", "dimple", "line_in_cube", "renumber"};
+  for (auto name : names) {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto gold = std::string(name) + "_gold";
+    auto obj = gmod::read_closure_from_geo((gold + ".geo").c_str());
+    prevent_regression(obj, std::string("geo_reader_") + name, gold);
+    gmod::set_current_model(nullptr);
+  }
+  {
+    /* signs apply to numbers read digit by digit or by strtod */
+    char const* text =
+        "Point(1) = {-1.25e-300, +2, -123456789012345678901234, -.5};\n";
+    auto p = gmod::as_point(gmod::read_closure_from_geo(text, strlen(text)));
+    if (p->pos.x != -1.25e-300 || p->pos.y != 2 ||
+        p->pos.z != -123456789012345678901234.0 || p->size != -.5)
+      abort();
+  }
+}
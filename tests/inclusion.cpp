@@ -0,0 +1,105 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <cmath>
+
+static gmod::ObjPtr unit_cube(gmod::Vector origin, double side)
+{
+  return gmod::new_cube(origin, gmod::Vector{side, 0, 0},
+      gmod::Vector{0, side, 0}, gmod::Vector{0, 0, side});
+}
+
+static bool near(gmod::Vector a, gmod::Vector b)
+{
+  return gmod::vector_norm(gmod::subtract_vectors(a, b)) < 1e-12;
+}
+
+int main()
+{
+  double const tol = 1e-9;
+  {
+    /* arcs and ellipses are bounded by their whole quarter */
+    auto circle = gmod::new_circle(gmod::Vector{1, 2, 3},
+        gmod::Vector{0, 0, 1}, gmod::Vector{2, 0, 0});
+    auto box = gmod::get_box(circle);
+    CHECK(near(box.lo, gmod::Vector{-1, 0, 3}));
+    CHECK(near(box.hi, gmod::Vector{3, 4, 3}));
+    auto ellipse = gmod::new_ellipse3(gmod::Vector{0, 0, 0},
+        gmod::Vector{2, 0, 0}, gmod::Vector{0, 1, 0});
+    box = gmod::get_box(ellipse);
+    CHECK(near(box.lo, gmod::Vector{-2, -1, 0}));
+    CHECK(near(box.hi, gmod::Vector{2, 1, 0}));
+  }
+  int const n = 10;
+  auto big = unit_cube(gmod::Vector{0, 0, 0}, n);
+  std::vector<gmod::ObjPtr> smalls;
+  for (int i = 0; i < n; ++i)
+  for (int j = 0; j < n; ++j)
+  for (int k = 0; k < n; ++k) {
+    auto small = unit_cube(gmod::Vector{i + .25, j + .25, k + .25}, .5);
+    gmod::insert_into(big, small);
+    smalls.push_back(small);
+  }
+  CHECK(gmod::check_inclusions(big, tol) == 0);
+  {
+    /* the tree finds what a brute-force search finds */
+    auto tree = gmod::build_box_tree(smalls);
+    gmod::Box query{gmod::Vector{2, 3, 4}, gmod::Vector{4.5, 3.5, 9}};
+    auto found = gmod::find_overlapping(tree, query, tol);
+    std::size_t expected = 0;
+    for (auto const& s : smalls)
+      if (gmod::boxes_overlap(gmod::get_box(s), query, tol)) ++expected;
+    CHECK(found.size() == expected);
+    CHECK(expected == 3 * 1 * 5);
+    for (auto i : found)
+      CHECK(gmod::boxes_overlap(gmod::get_box(smalls[i]), query, tol));
+  }
+  gmod::insert_into(big, unit_cube(gmod::Vector{n - .2, .8, .8}, .4));
+  CHECK(gmod::check_inclusions(big, tol) == 1);
+  gmod::insert_into(big, unit_cube(gmod::Vector{.5, .5, .5}, .5));
+  CHECK(gmod::check_inclusions(big, tol) == 2);
+  gmod::embed(big, gmod::new_line4(gmod::Vector{1, 1, 1},
+      gmod::Vector{1, 1, n + 1}));
+  CHECK(gmod::check_inclusions(big, tol) == 3);
+  {
+    /* holes whose boxes overlap are told apart by their shapes */
+    auto z = gmod::Vector{0, 0, 1};
+    auto x = gmod::Vector{1, 0, 0};
+    auto host = unit_cube(gmod::Vector{0, 0, 0}, n);
+    gmod::insert_into(host, gmod::new_ball(gmod::Vector{3, 3, 3}, z, x));
+    gmod::insert_into(host,
+        gmod::new_ball(gmod::Vector{4.5, 4.5, 4.5}, z, x));
+    gmod::insert_into(host, unit_cube(gmod::Vector{6, 1, 1}, 1));
+    auto turned = unit_cube(gmod::Vector{-.5, -.5, -.5}, 1);
+    gmod::transform_closure(turned,
+        gmod::Rotation(gmod::Vector{0, 0, 0}, z, std::atan(1.0)).linear,
+        gmod::Vector{7.6, 2.6, 1.5});
+    gmod::insert_into(host, turned);
+    CHECK(gmod::check_inclusions(host, tol) == 0);
+    /* a ball and a cube are only candidates */
+    gmod::insert_into(host, unit_cube(gmod::Vector{3.8, 3.8, 1.5}, 1));
+    CHECK(gmod::check_inclusions(host, tol) == 0);
+    gmod::insert_into(host, gmod::new_ball(gmod::Vector{3, 3, 4.5}, z, x));
+    CHECK(gmod::check_inclusions(host, tol) == 1);
+    auto face = gmod::new_square(gmod::Vector{0, 0, 0}, n * x,
+        gmod::Vector{0, n, 0});
+    gmod::insert_into(face, gmod::new_disk(gmod::Vector{3, 3, 0}, z, x));
+    gmod::insert_into(face, gmod::new_disk(gmod::Vector{4.5, 4.5, 0}, z, x));
+    auto y = gmod::Vector{0, 1, 0};
+    gmod::insert_into(face, gmod::new_square(gmod::Vector{6, 1, 0}, x, y));
+    auto diamond = gmod::new_square(gmod::Vector{-.5, -.5, 0}, x, y);
+    gmod::transform_closure(diamond,
+        gmod::Rotation(gmod::Vector{0, 0, 0}, z, std::atan(1.0)).linear,
+        gmod::Vector{7.6, 2.6, 0});
+    gmod::insert_into(face, diamond);
+    CHECK(gmod::check_inclusions(face, tol) == 0);
+    gmod::insert_into(face, gmod::new_square(gmod::Vector{5.5, .5, 0}, x, y));
+    CHECK(gmod::check_inclusions(face, tol) == 1);
+    gmod::insert_into(face, gmod::new_disk(gmod::Vector{4.5, 3, 0}, z, x));
+    CHECK(gmod::check_inclusions(face, tol) == 3);
+  }
+  /* moving the whole model keeps the cached boxes honest */
+  gmod::transform_closure(big, gmod::Matrix{gmod::Vector{1, 0, 0},
+      gmod::Vector{0, 1, 0}, gmod::Vector{0, 0, 1}},
+      gmod::Vector{5, 0, 0});
+  CHECK(near(gmod::get_box(big).lo, gmod::Vector{5, 0, 0}));
+}
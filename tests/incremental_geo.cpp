@@ -0,0 +1,59 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <string>
+
+static std::string cached_geo(gmod::ObjPtr o, gmod::GeoCache& cache)
+{
+  gmod::BufferSink sink;
+  {
+    gmod::Writer w(sink);
+    gmod::print_closure(w, o, cache);
+  }
+  return sink.buffer;
+}
+
+static gmod::ObjPtr cube(gmod::Vector origin, double side)
+{
+  return gmod::new_cube(origin, gmod::Vector{side, 0, 0},
+      gmod::Vector{0, side, 0}, gmod::Vector{0, 0, side});
+}
+
+int main()
+{
+  auto big = cube(gmod::Vector{0, 0, 0}, 10);
+  for (int i = 0; i < 10; ++i)
+    gmod::insert_into(big, cube(gmod::Vector{i + .25, .25, .25}, .5));
+  gmod::GeoCache cache;
+  CHECK(cached_geo(big, cache) == geo_of(big));
+  auto records = cache.formatted;
+  CHECK(cache.reused == 0 && records > 0);
+  /* nothing changed: every record is copied */
+  CHECK(cached_geo(big, cache) == geo_of(big));
+  CHECK(cache.formatted == 0 && cache.reused == records);
+  /* a point moved directly, without any notification */
+  auto p = gmod::filter_points(gmod::get_closure(big, true, true))[3];
+  p->pos.x += 0.125;
+  CHECK(cached_geo(big, cache) == geo_of(big));
+  CHECK(cache.formatted == 1);
+  /* another inclusion adds its records and changes the volume's */
+  auto extra = cube(gmod::Vector{.25, 5, 5}, .5);
+  gmod::insert_into(big, extra);
+  CHECK(cached_geo(big, cache) == geo_of(big));
+  auto added = gmod::get_closure(extra, true, true).size() - 1;
+  /* both records of each new object, and the volume's own */
+  CHECK(cache.formatted == 2 * added + 1);
+  /* new ids rewrite every record that refers to one */
+  for (auto const& co : gmod::get_closure(big, true, true)) co->id += 1000;
+  CHECK(cached_geo(big, cache) == geo_of(big));
+  CHECK(cache.reused < cache.formatted);
+  /* stale records don't pile up over many edits */
+  for (int i = 0; i < 5; ++i) {
+    p->pos.y += 0.125;
+    for (auto const& co : gmod::get_closure(big, true, true)) co->id += 1000;
+    auto geo = geo_of(big);
+    CHECK(cached_geo(big, cache) == geo);
+    CHECK(cache.text.size() <= 3 * geo.size() + 4096);
+  }
+  CHECK(cached_geo(big, cache) == geo_of(big));
+  CHECK(cache.formatted == 0);
+}
@@ -0,0 +1,152 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <algorithm>
+#include <sstream>
+
+static std::string write_binary(gmod::ObjPtr model)
+{
+  gmod::BufferSink sink;
+  gmod::write_closure_to_binary(model, sink);
+  return sink.buffer;
+}
+
+/* a materialized copy lands elsewhere in closure order than the
+   instance it replaces, so compare the records regardless of order */
+static std::vector<std::string> sorted_lines(std::string const& text)
+{
+  std::vector<std::string> lines;
+  std::istringstream stream(text);
+  std::string line;
+  while (std::getline(stream, line)) lines.push_back(line);
+  std::sort(lines.begin(), lines.end());
+  return lines;
+}
+
+int const ninstances = 100;
+
+/* a bolt (a cylinder with a line embedded along its axis)
+   repeated around a plate */
+static std::size_t objects_before_instancing;
+
+static gmod::ObjPtr build()
+{
+  auto plate = gmod::new_cube(
+      gmod::Vector{-2,-2,0},
+      gmod::Vector{4,0,0},
+      gmod::Vector{0,4,0},
+      gmod::Vector{0,0,0.2});
+  auto bolt = gmod::extrude_face(gmod::new_disk(
+      gmod::Vector{0,0,0},
+      gmod::Vector{0,0,1},
+      gmod::Vector{0.05,0,0}), gmod::Vector{0,0,0.5}).middle;
+  gmod::embed(bolt, gmod::new_line4(
+      gmod::Vector{0,0,0.1}, gmod::Vector{0,0,0.4}));
+  auto group = gmod::new_group();
+  gmod::add_to_group(group, plate);
+  objects_before_instancing = gmod::get_current_model()->objects.size();
+  for (int i = 0; i < ninstances; ++i) {
+    auto r = gmod::rotation_matrix(gmod::Vector{0,0,1},
+        2 * gmod::PI * i / ninstances);
+    gmod::add_to_group(group, gmod::new_instance(bolt, r,
+          gmod::Vector{0,0,0.2}));
+  }
+  return group;
+}
+
+int main()
+{
+  std::string geo;
+  std::string dmg;
+  std::string binary;
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto group = build();
+    /* memory goes with the parts, not the instances */
+    CHECK(model.objects.size() == objects_before_instancing + ninstances);
+    geo = geo_of(group);
+    dmg = dmg_of(group);
+    binary = write_binary(group);
+    gmod::num_threads = 3;
+    CHECK(geo_of(group) == geo);
+    CHECK(dmg_of(group) == dmg);
+    gmod::num_threads = 1;
+    gmod::set_current_model(nullptr);
+  }
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto group = build();
+    gmod::materialize_instances(group);
+    CHECK(model.objects.size() > 40 * ninstances);
+    CHECK(sorted_lines(geo_of(group)) == sorted_lines(geo));
+    CHECK(sorted_lines(dmg_of(group)) == sorted_lines(dmg));
+    gmod::set_current_model(nullptr);
+  }
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto group = gmod::read_closure_from_binary(binary.data(), binary.size());
+    CHECK(sorted_lines(geo_of(group)) == sorted_lines(geo));
+    gmod::set_current_model(nullptr);
+  }
+  {
+    /* compact ids don't depend on what was made before, and the
+       objects keep their own */
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto first = build();
+    auto second = build();
+    auto id = second->id;
+    CHECK(geo_of(second) != geo_of(first));
+    CHECK(geo_of(second, true) == geo_of(first, true));
+    CHECK(dmg_of(second, true) == dmg_of(first, true));
+    CHECK(second->id == id);
+    gmod::set_current_model(nullptr);
+  }
+  {
+    /* inserting a group of parts and instances materializes the
+       instances it seals in, as doing so beforehand would */
+    auto inserted = [](bool materialize_first) {
+      gmod::Model model;
+      gmod::set_current_model(&model);
+      auto group = build();
+      auto box = gmod::new_cube(gmod::Vector{-3,-3,-1},
+          gmod::Vector{6,0,0}, gmod::Vector{0,6,0}, gmod::Vector{0,0,2});
+      if (materialize_first) gmod::materialize_instances(group);
+      gmod::insert_into(box, group);
+      for (auto const& use : group->used)
+        CHECK(use.obj->type != gmod::INSTANCE);
+      auto geo = geo_of(box);
+      gmod::set_current_model(nullptr);
+      return geo;
+    };
+    CHECK(sorted_lines(inserted(false)) == sorted_lines(inserted(true)));
+  }
+  {
+    /* the boundary of parts and instances leaves the instances in
+       place and matches that of their materialized copies, but for
+       the shell itself */
+    auto boundary_records = [](bool materialize_first) {
+      gmod::Model model;
+      gmod::set_current_model(&model);
+      auto group = build();
+      if (materialize_first) gmod::materialize_instances(group);
+      auto boundary = gmod::collect_assembly_boundary(group);
+      int instances = 0;
+      for (auto const& use : group->used)
+        instances += use.obj->type == gmod::INSTANCE;
+      CHECK(instances == (materialize_first ? 0 : ninstances));
+      auto lines = sorted_lines(geo_of(boundary));
+      auto shell = "Surface Loop(" + std::to_string(boundary->id) + ")";
+      lines.erase(std::remove_if(lines.begin(), lines.end(),
+          [&](std::string const& line) {
+            return !line.compare(0, shell.size(), shell);
+          }),
+          lines.end());
+      gmod::set_current_model(nullptr);
+      return lines;
+    };
+    CHECK(boundary_records(false) == boundary_records(true));
+  }
+}
@@ -0,0 +1,62 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+static gmod::ObjPtr new_base()
+{
+  auto disk = gmod::new_disk(
+      gmod::Vector{0,0,0},
+      gmod::Vector{0,0,1},
+      gmod::Vector{1,0,0});
+  gmod::add_hole_to_face(disk, gmod::face_loop(gmod::new_disk(
+      gmod::Vector{0,0,0},
+      gmod::Vector{0,0,1},
+      gmod::Vector{0.5,0,0})));
+  return disk;
+}
+
+int main()
+{
+  gmod::Vector const dz{0, 0, 0.1};
+  /* one layer is exactly extrude_face */
+  std::string single_geo;
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    single_geo = geo_of(gmod::extrude_face(new_base(), dz).middle);
+    gmod::set_current_model(nullptr);
+  }
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto layers = gmod::extrude_layers(new_base(),
+        std::vector<gmod::Vector>(1, dz));
+    CHECK(geo_of(layers[0].middle) == single_geo);
+    gmod::set_current_model(nullptr);
+  }
+  int const n = 50;
+  std::string offsets_geo;
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto group = gmod::new_group();
+    auto layers = gmod::extrude_layers(new_base(),
+        std::vector<gmod::Vector>(n, dz), group);
+    CHECK(layers.size() == std::size_t(n));
+    CHECK(group->used.size() == std::size_t(n));
+    auto closure = gmod::get_closure(group, true);
+    CHECK(gmod::count_of_dim(closure, 3) == n);
+    auto top = gmod::filter_points(gmod::get_closure(layers.back().end, true));
+    for (auto const& p : top) CHECK(std::fabs(p->pos.z - n * dz.z) < 1e-12);
+    offsets_geo = geo_of(group);
+    gmod::set_current_model(nullptr);
+  }
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto group = gmod::new_group();
+    gmod::extrude_layers(new_base(),
+        std::vector<gmod::Transform>(n, gmod::Translation{dz}), group);
+    CHECK(geo_of(group) == offsets_geo);
+    gmod::set_current_model(nullptr);
+  }
+}
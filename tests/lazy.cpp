@@ -0,0 +1,69 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+static int next_id()
+{
+  return gmod::new_point()->id;
+}
+
+int main()
+{
+  auto x = gmod::Vector{1, 0, 0};
+  auto y = gmod::Vector{0, 1, 0};
+  auto z = gmod::Vector{0, 0, 1};
+  {
+    /* discarded variants never build anything */
+    auto before = next_id();
+    for (int i = 0; i < 1000; ++i) {
+      auto big = gmod::lazy_cube(gmod::Vector{0, 0, 0}, 4 * x, 4 * y, 4 * z);
+      auto ball = gmod::lazy_ball(gmod::Vector{2, 2, 2}, z, .5 * x);
+      auto variant = gmod::lazy_insert_into(big, ball);
+      CHECK(!gmod::is_forced(variant));
+    }
+    CHECK(next_id() == before + 1);
+  }
+  {
+    /* only the branch that is forced gets built */
+    auto square = gmod::defer([](std::vector<gmod::ObjPtr> const&) {
+      return gmod::new_square(gmod::Vector{0, 0, 0},
+          gmod::Vector{1, 0, 0}, gmod::Vector{0, 1, 0});
+    });
+    auto slab = gmod::lazy_extrude_face(square, z);
+    auto unused = gmod::lazy_extrude_face(slab.end, z);
+    auto volume = gmod::force(slab.middle);
+    CHECK(volume->type == gmod::VOLUME);
+    CHECK(gmod::is_forced(square) && gmod::is_forced(slab.end));
+    CHECK(!gmod::is_forced(unused.middle));
+    CHECK(gmod::force(slab.middle) == volume);
+    auto end = gmod::force(slab.end);
+    CHECK(gmod::get_used_dir(gmod::volume_shell(volume), end) ==
+          gmod::FORWARD);
+  }
+  {
+    /* forcing matches building eagerly */
+    auto cells = std::vector<gmod::Lazy>();
+    for (int i = 0; i < 3; ++i)
+      cells.push_back(gmod::lazy_cube(gmod::Vector{double(i), 0, 0}, x, y, z));
+    auto group = gmod::lazy_group(cells);
+    auto boundary = gmod::force(gmod::lazy_assembly_boundary(group));
+    CHECK(boundary->type == gmod::SHELL);
+    CHECK(boundary->used.size() == 3 * 6);
+    /* the group was built once and is shared */
+    auto big = gmod::lazy_cube(gmod::Vector{-1, -1, -1}, 9 * x, 9 * y, 9 * z);
+    auto model = gmod::force(gmod::lazy_insert_into(big, group));
+    CHECK(model->used.size() == 2);
+    CHECK(gmod::force(group)->used.size() == 3);
+  }
+  {
+    /* a long chain of modifications forces without recursion */
+    auto host = gmod::lazy_cube(gmod::Vector{0, 0, 0}, 1e5 * x, y, z);
+    auto chain = host;
+    for (int i = 0; i < 20000; ++i) {
+      chain = gmod::lazy_insert_into(chain, gmod::lazy_cube(
+          gmod::Vector{5.0 * i + 1, .25, .25}, .5 * x, .5 * y, .5 * z));
+    }
+    auto built = gmod::force(chain);
+    CHECK(built == gmod::force(host));
+    CHECK(built->used.size() == 20001);
+  }
+}
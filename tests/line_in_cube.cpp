@@ -1,5 +1,6 @@
 #include <gmodel.hpp>
 #include <minidiff.hpp>
+#include <algorithm>
 
 int main()
 {
@@ -13,5 +14,19 @@ int main()
   auto l = gmod::new_line4(gmod::Vector{.25,.5,.5}, gmod::Vector{.75,.5,.5});
   gmod::embed(c, l);
   prevent_regression(c, "line_in_cube");
+  auto copy = gmod::copy_closure(c);
+  CHECK(copy->embedded.size() == 1);
+  auto copied_line = copy->embedded[0];
+  CHECK(copied_line != l && copied_line->type == gmod::LINE);
+  for (int i = 0; i < 2; ++i) {
+    auto a = gmod::edge_point_view(l.get(), i);
+    auto b = gmod::edge_point_view(copied_line.get(), i);
+    CHECK(a != b && a->pos.x == b->pos.x && a->pos.y == b->pos.y &&
+          a->pos.z == b->pos.z);
+  }
+  auto closure = gmod::get_closure(copy, true, true);
+  CHECK(closure.size() == gmod::get_closure(c, true, true).size());
+  CHECK(std::find(closure.begin(), closure.end(), copied_line) !=
+        closure.end());
 }
 
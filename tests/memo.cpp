@@ -0,0 +1,113 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <string>
+#include <unistd.h>
+
+int main()
+{
+  auto x = gmod::Vector{1, 0, 0};
+  auto y = gmod::Vector{0, 1, 0};
+  auto z = gmod::Vector{0, 0, 1};
+  auto origin = gmod::Vector{0, 0, 0};
+  /* equal constructions hash alike, whatever their ids */
+  auto a = gmod::new_cube(origin, x, y, z);
+  auto b = gmod::new_cube(origin, x, y, z);
+  auto c = gmod::new_cube(origin, x, y, 2 * z);
+  CHECK(gmod::hash_closure(a) == gmod::hash_closure(b));
+  CHECK(gmod::hash_closure(a) != gmod::hash_closure(c));
+  int builds = 0;
+  auto build = [&]() {
+    ++builds;
+    return gmod::new_cube(origin, x, y, z);
+  };
+  auto key = gmod::MemoKey("cube").add(origin).add(x);
+  auto first = gmod::memoize(key, build);
+  auto second = gmod::memoize(key, build);
+  CHECK(builds == 1);
+  CHECK(first != second && first->id != second->id);
+  CHECK(gmod::hash_closure(first) == gmod::hash_closure(a));
+  CHECK(gmod::hash_closure(second) == gmod::hash_closure(a));
+  /* copies are independent of the cached prototype */
+  gmod::insert_into(first, gmod::new_cube(gmod::Vector{.25, .25, .25},
+      .5 * x, .5 * y, .5 * z));
+  auto third = gmod::memoize(key, build);
+  CHECK(gmod::hash_closure(third) == gmod::hash_closure(a));
+  auto instance = gmod::memoize(key, build, true);
+  CHECK(instance->type == gmod::INSTANCE && builds == 1);
+  {
+    auto ball1 = gmod::memo_ball(origin, z, x);
+    auto ball2 = gmod::memo_ball(origin, z, x);
+    CHECK(gmod::hash_closure(ball1) == gmod::hash_closure(ball2));
+    auto square = gmod::new_square(origin, x, y);
+    auto slab = gmod::memo_extrude_face(square, z);
+    CHECK(slab->type == gmod::VOLUME);
+    CHECK(gmod::hash_closure(gmod::memo_extrude_face(
+        gmod::new_square(origin, x, y), z)) == gmod::hash_closure(slab));
+    /* the point size is an input too */
+    auto size = gmod::default_size;
+    auto coarse = gmod::memo_cube(origin, x, y, z);
+    gmod::default_size = 2 * size;
+    auto fine = gmod::memo_cube(origin, x, y, z);
+    gmod::default_size = size;
+    CHECK(gmod::hash_closure(fine) != gmod::hash_closure(coarse));
+    CHECK(gmod::filter_points(gmod::get_closure(fine, true, true))[0]->size ==
+          2 * size);
+  }
+  {
+    /* a second run finds the prototype on disk */
+    char dir[] = "/tmp/gmodel_memo_XXXXXX";
+    CHECK(mkdtemp(dir));
+    gmod::memo_cache_directory = dir;
+    gmod::clear_memo_cache();
+    auto disk_key = gmod::MemoKey("disk cube").add(origin);
+    auto built = gmod::memoize(disk_key, build);
+    CHECK(builds == 2);
+    gmod::clear_memo_cache();
+    auto loaded = gmod::memoize(disk_key, build);
+    CHECK(builds == 2);
+    CHECK(gmod::hash_closure(loaded) == gmod::hash_closure(built));
+    CHECK(geo_of(loaded, true) == geo_of(built, true));
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%016llx.gmb", dir,
+        static_cast<unsigned long long>(disk_key.hash));
+    /* a file found under another key's name is not that key's */
+    auto other_key = gmod::MemoKey("other cube").add(origin);
+    char other_path[64];
+    snprintf(other_path, sizeof(other_path), "%s/%016llx.gmb", dir,
+        static_cast<unsigned long long>(other_key.hash));
+    CHECK(rename(path, other_path) == 0);
+    gmod::memoize(other_key, build);
+    CHECK(builds == 3);
+    CHECK(unlink(other_path) == 0);
+    gmod::memoize(disk_key, build);
+    CHECK(builds == 3);
+    gmod::clear_memo_cache();
+    gmod::memoize(disk_key, build);
+    CHECK(builds == 4);
+    /* a damaged model, or one another binary version wrote, is
+       rebuilt and replaced */
+    auto key_bytes = (disk_key.words.size() + 1) * sizeof(std::uint64_t);
+    auto damage = [&](std::size_t at, char byte, bool truncate) {
+      FILE* f = fopen(path, "r+b");
+      CHECK(f);
+      fseek(f, long(key_bytes + at), SEEK_SET);
+      fputc(byte, f);
+      fclose(f);
+      if (truncate) CHECK(::truncate(path, long(key_bytes + at + 1)) == 0);
+    };
+    damage(40, 0, true);
+    gmod::clear_memo_cache();
+    gmod::memoize(disk_key, build);
+    CHECK(builds == 5);
+    damage(8, 99, false);
+    gmod::clear_memo_cache();
+    gmod::memoize(disk_key, build);
+    CHECK(builds == 6);
+    gmod::clear_memo_cache();
+    gmod::memoize(disk_key, build);
+    CHECK(builds == 6);
+    CHECK(unlink(path) == 0);
+    CHECK(rmdir(dir) == 0);
+    gmod::memo_cache_directory.clear();
+  }
+}
@@ -0,0 +1,57 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+static int count_dim(gmod::ObjPtr root, int dim)
+{
+  return gmod::count_of_dim(gmod::get_closure(root, true, true), dim);
+}
+
+/* the face a shell shares with another shell, and its direction */
+static gmod::Use const* shared_use(gmod::ObjPtr a, gmod::ObjPtr b)
+{
+  for (auto const& use : a->used)
+  for (auto const& other : b->used)
+    if (use.obj == other.obj) return &use;
+  return nullptr;
+}
+
+int main()
+{
+  auto x = gmod::Vector{1, 0, 0};
+  auto y = gmod::Vector{0, 1, 0};
+  auto z = gmod::Vector{0, 0, 1};
+  auto left = gmod::new_cube(gmod::Vector{0, 0, 0}, x, y, z);
+  auto right = gmod::new_cube(gmod::Vector{1 + 1e-9, 0, 0}, x, y, z);
+  auto model = gmod::new_group();
+  gmod::add_to_group(model, left);
+  gmod::add_to_group(model, right);
+  CHECK(count_dim(model, 0) == 16);
+  CHECK(count_dim(model, 1) == 24);
+  CHECK(count_dim(model, 2) == 12);
+  CHECK(gmod::merge_coincident(model, 1e-6) == 4 + 4 + 1);
+  CHECK(count_dim(model, 0) == 12);
+  CHECK(count_dim(model, 1) == 20);
+  CHECK(count_dim(model, 2) == 11);
+  auto left_shell = left->used[0].obj;
+  auto right_shell = right->used[0].obj;
+  auto a = shared_use(left_shell, right_shell);
+  auto b = shared_use(right_shell, left_shell);
+  CHECK(a && b && a->dir != b->dir);
+  CHECK(gmod::collect_assembly_boundary(model)->used.size() == 10);
+  CHECK(gmod::merge_coincident(model, 1e-6) == 0);
+  {
+    /* a point near two others that are apart merges into the earlier
+       in closure order, though its cell is searched last */
+    auto group = gmod::new_group();
+    for (int i = 0; i < 3; ++i)
+      gmod::add_to_group(group, gmod::new_point2(gmod::Vector{0, 0, 0}));
+    auto points = gmod::filter_points(gmod::get_closure(group, true));
+    points[0]->pos = gmod::Vector{2.5, 0, 0};
+    points[1]->pos = gmod::Vector{0.75, 0, 0};
+    points[2]->pos = gmod::Vector{1.6, 0, 0};
+    std::size_t last = 0;
+    while (group->used[last].obj != points[2]) ++last;
+    CHECK(gmod::merge_coincident(group, 1) == 1);
+    CHECK(group->used[last].obj == points[0]);
+  }
+}
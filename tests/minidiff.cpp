@@ -1,29 +1,165 @@
 #include "minidiff.hpp"
 
-#include <fstream>
-#include <cassert>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
-static bool are_same(std::string const& path1, std::string const& path2) {
-  std::ifstream file1(path1.c_str());
-  std::ifstream file2(path2.c_str());
-  assert(file1.is_open());
-  assert(file2.is_open());
-  char c1, c2;
-  while (file1.get(c1)) {
-    if (!file2.get(c2)) return false;
-    if (c1 != c2) return false;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum { COMPARE_BLOCK = 64 * 1024 };
+
+static std::size_t first_difference(char const* a, char const* b,
+    std::size_t n) {
+  std::size_t i = 0;
+  while (i < n) {
+    auto block = std::min(n - i, std::size_t(COMPARE_BLOCK));
+    if (std::memcmp(a + i, b + i, block) != 0) break;
+    i += block;
+  }
+  while (i < n && a[i] == b[i]) ++i;
+  return i;
+}
+
+static void print_line(char const* label, char const* data, std::size_t size,
+    std::size_t start) {
+  auto end = start;
+  while (end < size && data[end] != '\n' && end - start < 200) ++end;
+  fprintf(stderr, "  %s: %.*s\n", label, int(end - start), data + start);
+}
+
+void check(bool ok, char const* what, char const* file, int line) {
+  if (ok) return;
+  fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+  abort();
+}
+
+bool matches_text(std::string const& text, char const* expected,
+    std::size_t expected_size, std::string const& what) {
+  auto n = std::min(text.size(), expected_size);
+  auto at = first_difference(text.data(), expected, n);
+  if (at == n && text.size() == expected_size) return true;
+  auto line_start = at;
+  while (line_start > 0 && expected[line_start - 1] != '\n') --line_start;
+  auto line = std::count(expected, expected + line_start, '\n') + 1;
+  fprintf(stderr, "minidiff: %s differs at line %ld", what.c_str(),
+      long(line));
+  if (at == n) {
+    fprintf(stderr, ", %zu bytes instead of %zu\n", text.size(),
+        expected_size);
+  } else {
+    fprintf(stderr, "\n");
   }
-  return true;
+  print_line("got", text.data(), text.size(), line_start);
+  print_line("expected", expected, expected_size, line_start);
+  return false;
+}
+
+bool matches_file(std::string const& text, std::string const& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "minidiff: can't open %s\n", path.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "minidiff: can't stat %s\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  auto size = std::size_t(st.st_size);
+  if (size == 0) {
+    close(fd);
+    return matches_text(text, "", 0, path);
+  }
+  void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    fprintf(stderr, "minidiff: can't map %s\n", path.c_str());
+    return false;
+  }
+  auto same = matches_text(text, static_cast<char const*>(mapped), size, path);
+  munmap(mapped, size);
+  return same;
+}
+
+std::string geo_of(gmod::ObjPtr model, bool compact_ids) {
+  gmod::BufferSink sink;
+  gmod::write_closure_to_geo(model, sink, compact_ids);
+  return sink.buffer;
+}
+
+std::string dmg_of(gmod::ObjPtr model, bool compact_ids) {
+  gmod::BufferSink sink;
+  gmod::write_closure_to_dmg(model, sink, compact_ids);
+  return sink.buffer;
+}
+
+std::string geo_of(gmod::FrozenModel const& frozen) {
+  gmod::BufferSink sink;
+  {
+    gmod::Writer w(sink);
+    gmod::print_closure(w, frozen);
+  }
+  return sink.buffer;
+}
+
+std::string dmg_of(gmod::FrozenModel const& frozen) {
+  gmod::BufferSink sink;
+  {
+    gmod::Writer w(sink);
+    gmod::print_closure_dmg(w, frozen);
+  }
+  return sink.buffer;
+}
+
+static void save(std::string const& text, std::string const& path) {
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) return;
+  fwrite(text.data(), 1, text.size(), f);
+  fclose(f);
 }
 
 void prevent_regression(gmod::ObjPtr model, std::string const& name) {
-  std::string gold_name = name + "_gold";
-  std::string geo_name = name + ".geo";
-  std::string dmg_name = name + ".dmg";
-  std::string gold_geo_name = gold_name + ".geo";
-  std::string gold_dmg_name = gold_name + ".dmg";
-  gmod::write_closure_to_geo(model, geo_name.c_str());
-  gmod::write_closure_to_dmg(model, dmg_name.c_str());
-  assert(are_same(geo_name, gold_geo_name));
-  assert(are_same(dmg_name, gold_dmg_name));
+  prevent_regression(model, name, name + "_gold");
+}
+
+void prevent_regression(gmod::ObjPtr model, std::string const& name,
+    std::string const& gold_name, bool compact_ids) {
+  auto geo = geo_of(model, compact_ids);
+  auto dmg = dmg_of(model, compact_ids);
+  bool same = true;
+  if (!matches_file(geo, gold_name + ".geo")) {
+    save(geo, name + ".geo");
+    same = false;
+  }
+  if (!matches_file(dmg, gold_name + ".dmg")) {
+    save(dmg, name + ".dmg");
+    same = false;
+  }
+  if (!same) abort();
+}
+
+void prevent_round_trip_regression(gmod::ObjPtr model,
+    std::string const& name) {
+  auto geo = geo_of(model);
+  auto dmg = dmg_of(model);
+  gmod::BufferSink binary;
+  gmod::write_closure_to_binary(model, binary);
+  auto from_geo = gmod::read_closure_from_geo(geo.data(), geo.size());
+  auto from_binary = gmod::read_closure_from_binary(binary.buffer.data(),
+      binary.buffer.size());
+  bool same = true;
+  same = matches_text(geo_of(from_geo), geo.data(), geo.size(),
+      name + ".geo read from .geo") && same;
+  same = matches_text(dmg_of(from_geo), dmg.data(), dmg.size(),
+      name + ".dmg read from .geo") && same;
+  same = matches_text(geo_of(from_binary), geo.data(), geo.size(),
+      name + ".geo read from binary") && same;
+  same = matches_text(dmg_of(from_binary), dmg.data(), dmg.size(),
+      name + ".dmg read from binary") && same;
+  if (!same) abort();
 }
@@ -4,6 +4,33 @@
 #include <gmodel.hpp>
 #include <string>
 
+/* like assert, but kept under NDEBUG, so that release builds of
+   the tests make the same calls and check the same results */
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+void check(bool ok, char const* what, char const* file, int line);
+
+/* compare text with the expected text or the contents of a file,
+   printing the first line that differs to stderr */
+bool matches_text(std::string const& text, char const* expected,
+    std::size_t expected_size, std::string const& what);
+bool matches_file(std::string const& text, std::string const& path);
+
+/* the .geo and .dmg text that the writers produce for a model,
+   or for the tables of a frozen one */
+std::string geo_of(gmod::ObjPtr model, bool compact_ids = false);
+std::string dmg_of(gmod::ObjPtr model, bool compact_ids = false);
+std::string geo_of(gmod::FrozenModel const& frozen);
+std::string dmg_of(gmod::FrozenModel const& frozen);
+
+/* the model's .geo and .dmg output must match the gold files;
+   whatever differs is also written out as name.geo or name.dmg */
 void prevent_regression(gmod::ObjPtr model, std::string const& name);
+void prevent_regression(gmod::ObjPtr model, std::string const& name,
+    std::string const& gold_name, bool compact_ids = false);
+
+/* for models too big to keep gold files for: reading the model's
+   .geo and binary output back must give the same .geo and .dmg */
+void prevent_round_trip_regression(gmod::ObjPtr model,
+    std::string const& name);
 
 #endif
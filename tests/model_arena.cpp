@@ -0,0 +1,22 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+int main()
+{
+  gmod::Model model;
+  gmod::set_current_model(&model);
+  auto outer = gmod::new_cube(
+      gmod::Vector{0,0,0},
+      gmod::Vector{1,0,0},
+      gmod::Vector{0,1,0},
+      gmod::Vector{0,0,1});
+  auto inner = gmod::new_cube(
+      gmod::Vector{1./3.,1./3.,1./3.},
+      gmod::Vector{1./3.,0,0},
+      gmod::Vector{0,1./3.,0},
+      gmod::Vector{0,0,1./3.});
+  gmod::insert_into(outer, inner);
+  CHECK(model.objects.size() == 68);
+  prevent_regression(outer, "model_arena", "cube_in_cube_gold");
+  gmod::set_current_model(nullptr);
+}
@@ -0,0 +1,111 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <algorithm>
+#include <string>
+
+/* no two objects of a closure share an id, and objects made
+   afterwards are numbered past all of them */
+static void check_ids(gmod::ObjPtr root)
+{
+  std::vector<int> ids;
+  for (auto const& co : gmod::get_closure(root, true, true))
+    ids.push_back(co->id);
+  std::sort(ids.begin(), ids.end());
+  CHECK(std::adjacent_find(ids.begin(), ids.end()) == ids.end());
+  CHECK(gmod::new_point()->id > ids.back());
+}
+
+static gmod::ObjPtr inclusion(int i)
+{
+  auto corner = gmod::Vector{2.0 * (i % 10) + .5, 2.0 * (i / 10 % 10) + .5,
+      2.0 * (i / 100) + .5};
+  if (i % 3) {
+    return gmod::new_cube(corner, gmod::Vector{1, 0, 0},
+        gmod::Vector{0, 1, 0}, gmod::Vector{0, 0, 1});
+  }
+  return gmod::new_ball(corner + gmod::Vector{.5, .5, .5},
+      gmod::Vector{0, 0, 1}, gmod::Vector{.4, 0, 0});
+}
+
+static gmod::ObjPtr new_box()
+{
+  return gmod::new_cube(gmod::Vector{0, 0, 0}, gmod::Vector{20, 0, 0},
+      gmod::Vector{0, 20, 0}, gmod::Vector{0, 0, 20});
+}
+
+enum { NPARTS = 300 };
+
+static std::string serial_geo()
+{
+  gmod::Model model;
+  gmod::set_current_model(&model);
+  auto box = new_box();
+  for (int i = 0; i < NPARTS; ++i) gmod::insert_into(box, inclusion(i));
+  auto geo = geo_of(box, true);
+  gmod::set_current_model(nullptr);
+  return geo;
+}
+
+static std::vector<gmod::PartBuild> inclusion_builds()
+{
+  std::vector<gmod::PartBuild> builds;
+  for (int i = 0; i < NPARTS; ++i)
+    builds.push_back([i]() { return inclusion(i); });
+  return builds;
+}
+
+static std::string parallel_geo(int nthreads, bool in_model)
+{
+  gmod::num_threads = nthreads;
+  gmod::Model model;
+  if (in_model) gmod::set_current_model(&model);
+  auto box = new_box();
+  /* objects made before the parts keep their ids */
+  auto before = gmod::new_point();
+  auto id = before->id;
+  gmod::insert_parts_into(box, inclusion_builds());
+  if (in_model) CHECK(!model.parts.empty());
+  CHECK(before->id == id);
+  check_ids(box);
+  auto geo = geo_of(box, true);
+  gmod::set_current_model(nullptr);
+  gmod::num_threads = 1;
+  return geo;
+}
+
+int main()
+{
+  auto expected = serial_geo();
+  CHECK(parallel_geo(1, true) == expected);
+  CHECK(parallel_geo(4, true) == expected);
+  CHECK(parallel_geo(3, false) == expected);
+  {
+    gmod::num_threads = 4;
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto group = gmod::group_parts(inclusion_builds());
+    CHECK(group->used.size() == NPARTS);
+    check_ids(group);
+    gmod::set_current_model(nullptr);
+    gmod::num_threads = 1;
+  }
+  {
+    /* parts read from one file keep no ids of the file, with or
+       without a Model */
+    gmod::BufferSink sink;
+    gmod::write_closure_to_geo(inclusion(1), sink);
+    auto text = sink.buffer;
+    std::vector<gmod::PartBuild> builds(8, [&]() {
+      return gmod::read_closure_from_geo(text.data(), text.size());
+    });
+    gmod::num_threads = 4;
+    for (int in_model = 0; in_model < 2; ++in_model) {
+      gmod::Model model;
+      if (in_model) gmod::set_current_model(&model);
+      check_ids(gmod::group_parts(builds));
+      gmod::set_current_model(nullptr);
+    }
+    gmod::num_threads = 1;
+  }
+  CHECK(gmod::build_parts(std::vector<gmod::PartBuild>()).empty());
+}
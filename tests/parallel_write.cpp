@@ -0,0 +1,63 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+
+/* the threads that take part in a parallel_for of n short tasks */
+static std::size_t threads_used(std::size_t n)
+{
+  std::mutex mutex;
+  std::set<std::thread::id> ids;
+  gmod::parallel_for(n, [&](std::size_t) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::lock_guard<std::mutex> lock(mutex);
+    ids.insert(std::this_thread::get_id());
+  });
+  return ids.size();
+}
+
+int main()
+{
+  int const n = 12;
+  double const h = 1.0 / n;
+  auto outer = gmod::new_cube(
+      gmod::Vector{0,0,0},
+      gmod::Vector{1,0,0},
+      gmod::Vector{0,1,0},
+      gmod::Vector{0,0,1});
+  for (int i = 0; i < n; ++i)
+  for (int j = 0; j < n; ++j)
+  for (int k = 0; k < n; ++k) {
+    auto inner = gmod::new_cube(
+        gmod::Vector{(i + .25) * h, (j + .25) * h, (k + .25) * h},
+        gmod::Vector{h / 2,0,0},
+        gmod::Vector{0,h / 2,0},
+        gmod::Vector{0,0,h / 2});
+    gmod::insert_into(outer, inner);
+  }
+  gmod::num_threads = 1;
+  auto serial_geo = geo_of(outer);
+  auto serial_dmg = dmg_of(outer);
+  gmod::num_threads = 4;
+  auto parallel_geo = geo_of(outer);
+  auto parallel_dmg = dmg_of(outer);
+  CHECK(serial_geo.size() > 1000000);
+  CHECK(parallel_geo == serial_geo);
+  CHECK(parallel_dmg == serial_dmg);
+  /* lowering num_threads shrinks the pool */
+  gmod::num_threads = 16;
+  CHECK(threads_used(256) > 2);
+  gmod::num_threads = 2;
+  CHECK(threads_used(256) <= 2);
+  /* bodies may run parallel_for themselves, on any thread */
+  gmod::num_threads = 4;
+  std::atomic<int> inner(0);
+  gmod::parallel_for(16, [&](std::size_t) {
+    gmod::parallel_for(16, [&](std::size_t) { ++inner; });
+  });
+  CHECK(inner == 256);
+  gmod::num_threads = 1;
+}
@@ -0,0 +1,74 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+static gmod::ObjPtr new_part()
+{
+  auto cube = gmod::new_cube(
+      gmod::Vector{2,0,0},
+      gmod::Vector{1,0,0},
+      gmod::Vector{0,1,0},
+      gmod::Vector{0,0,1});
+  gmod::embed(cube, gmod::new_line4(
+      gmod::Vector{2.25,.5,.5}, gmod::Vector{2.75,.5,.5}));
+  return cube;
+}
+
+static gmod::ObjPtr group_of(std::vector<gmod::ObjPtr> const& objs)
+{
+  auto group = gmod::new_group();
+  for (auto const& o : objs) gmod::add_to_group(group, o);
+  return group;
+}
+
+int main()
+{
+  int const n = 40;
+  gmod::Vector const step{0, 1.5, 0};
+  /* a pattern builds what the same copies and transforms do */
+  std::string serial_geo;
+  {
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto part = new_part();
+    std::vector<gmod::ObjPtr> copies;
+    for (int i = 1; i < n; ++i) {
+      auto copy = gmod::copy_closure(part);
+      gmod::transform_closure(copy, gmod::identity_matrix(),
+          gmod::scale_vector(i, step));
+      copies.push_back(copy);
+    }
+    serial_geo = geo_of(group_of(copies));
+    gmod::set_current_model(nullptr);
+  }
+  for (int nthreads = 1; nthreads <= 4; nthreads += 3) {
+    gmod::num_threads = nthreads;
+    gmod::Model model;
+    gmod::set_current_model(&model);
+    auto copies = gmod::linear_pattern(new_part(), step, n);
+    CHECK(copies.size() == std::size_t(n - 1));
+    CHECK(geo_of(group_of(copies)) == serial_geo);
+    gmod::set_current_model(nullptr);
+  }
+  gmod::num_threads = 4;
+  {
+    auto copies = gmod::circular_pattern(new_part(),
+        gmod::Vector{0,0,0}, gmod::Vector{0,0,2}, 4);
+    CHECK(copies.size() == 3);
+    auto points = gmod::filter_points(gmod::get_closure(copies[1], false));
+    for (auto const& p : points) {
+      CHECK(p->pos.x < -1.999);
+      CHECK(p->pos.y < 1e-9);
+    }
+  }
+  {
+    auto copies = gmod::grid_pattern(new_part(),
+        gmod::Vector{2,0,0}, 3, gmod::Vector{0,0,2}, 2);
+    CHECK(copies.size() == 5);
+    auto points = gmod::filter_points(gmod::get_closure(copies[4], false));
+    for (auto const& p : points) {
+      CHECK(p->pos.x > 5.999);
+      CHECK(p->pos.z > 1.999);
+    }
+  }
+  gmod::num_threads = 1;
+}
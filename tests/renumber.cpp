@@ -0,0 +1,38 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <thread>
+
+static gmod::ObjPtr build(int nscrap)
+{
+  for (int i = 0; i < nscrap; ++i) gmod::new_point2(gmod::Vector{0,0,0});
+  return gmod::new_cube(
+      gmod::Vector{0,0,0},
+      gmod::Vector{1,0,0},
+      gmod::Vector{0,1,0},
+      gmod::Vector{0,0,1});
+}
+
+int main()
+{
+  gmod::Model model_a;
+  gmod::Model model_b;
+  gmod::ObjPtr a;
+  gmod::ObjPtr b;
+  std::thread thread_a([&]() {
+    gmod::set_current_model(&model_a);
+    a = build(0);
+    gmod::set_current_model(nullptr);
+  });
+  std::thread thread_b([&]() {
+    gmod::set_current_model(&model_b);
+    b = build(7);
+    gmod::set_current_model(nullptr);
+  });
+  thread_a.join();
+  thread_b.join();
+  CHECK(model_a.objects.front()->id == 0);
+  CHECK(model_b.objects.front()->id == 0);
+  CHECK(a->id != b->id);
+  prevent_regression(a, "renumber_a", "renumber_gold", true);
+  prevent_regression(b, "renumber_b", "renumber_gold", true);
+}
@@ -0,0 +1,42 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <cstdlib>
+
+/* a model that grows with the scale given on the command line:
+   scale^3 cubes and balls inside one box, next to a row of
+   extruded spline sections */
+int main(int argc, char** argv)
+{
+  int scale = argc > 1 ? atoi(argv[1]) : 2;
+  gmod::Model model;
+  gmod::set_current_model(&model);
+  auto x = gmod::Vector{1, 0, 0};
+  auto y = gmod::Vector{0, 1, 0};
+  auto z = gmod::Vector{0, 0, 1};
+  auto box = gmod::new_cube(gmod::Vector{0, 0, 0}, 2 * scale * x,
+      2 * scale * y, 2 * scale * z);
+  for (int i = 0; i < scale; ++i)
+  for (int j = 0; j < scale; ++j)
+  for (int k = 0; k < scale; ++k) {
+    auto corner = gmod::Vector{2.0 * i + .5, 2.0 * j + .5, 2.0 * k + .5};
+    if ((i + j + k) % 2) {
+      gmod::insert_into(box, gmod::new_cube(corner, x, y, z));
+    } else {
+      gmod::insert_into(box, gmod::new_ball(corner + .5 * (x + y + z), z,
+          .4 * x));
+    }
+  }
+  auto section = gmod::new_loop();
+  auto low = gmod::new_point2(gmod::Vector{0, -1, 0});
+  auto high = gmod::new_point2(gmod::Vector{0, -1, 1});
+  gmod::add_use(section, gmod::FORWARD, gmod::new_spline2({low,
+      gmod::new_point2(gmod::Vector{.5, -1.2, .5}), high}));
+  gmod::add_use(section, gmod::FORWARD, gmod::new_line2(high, low));
+  auto wing = gmod::extrude_face(gmod::new_plane2(section), -1 * y).middle;
+  auto model_group = gmod::new_group();
+  gmod::add_to_group(model_group, box);
+  for (auto const& copy : gmod::linear_pattern(wing, x, scale * scale))
+    gmod::add_to_group(model_group, copy);
+  prevent_round_trip_regression(model_group, "scaled_regression");
+  gmod::set_current_model(nullptr);
+}
@@ -0,0 +1,70 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <cstring>
+
+static std::vector<gmod::Point*> points_of(gmod::ObjPtr root)
+{
+  std::vector<gmod::Point*> points;
+  for (auto const& co : gmod::get_closure(root, true, true))
+    if (co->type == gmod::POINT) points.push_back(gmod::as_point(co));
+  return points;
+}
+
+int main()
+{
+  auto cube = gmod::new_cube(gmod::Vector{0, 0, 0},
+      gmod::Vector{1, 0, 0}, gmod::Vector{0, 1, 0}, gmod::Vector{0, 0, 1});
+  gmod::set_sizes(cube, [](gmod::Vector p) { return 0.1 + p.x; });
+  for (auto p : points_of(cube)) CHECK(p->size == 0.1 + p->pos.x);
+  gmod::set_sizes_batch(cube, [](double const* x, double const* y,
+      double const*, std::size_t n, double* sizes) {
+    for (std::size_t i = 0; i < n; ++i) sizes[i] = 0.5 * x[i] + y[i];
+  });
+  for (auto p : points_of(cube))
+    CHECK(p->size == 0.5 * p->pos.x + p->pos.y);
+  {
+    /* a 2 x 2 x 2 grid interpolates linearly in between */
+    gmod::SizeGrid grid;
+    grid.origin = gmod::Vector{0, 0, 0};
+    grid.spacing = gmod::Vector{1, 1, 1};
+    grid.counts[0] = grid.counts[1] = grid.counts[2] = 2;
+    for (int k = 0; k < 2; ++k)
+    for (int j = 0; j < 2; ++j)
+    for (int i = 0; i < 2; ++i)
+      grid.sizes.push_back(1 + i + 2 * j + 4 * k);
+    auto mid = gmod::sample_size_grid(grid, gmod::Vector{.5, .5, .5});
+    CHECK(std::fabs(mid - 4.5) < 1e-12);
+    auto clamped = gmod::sample_size_grid(grid, gmod::Vector{9, -9, 9});
+    CHECK(std::fabs(clamped - 6) < 1e-12);
+    gmod::set_sizes(cube, grid);
+    for (auto p : points_of(cube))
+      CHECK(p->size == 1 + p->pos.x + 2 * p->pos.y + 4 * p->pos.z);
+  }
+  gmod::BufferSink plain;
+  {
+    gmod::Writer w(plain);
+    gmod::print_closure(w, cube);
+  }
+  CHECK(!strstr(plain.buffer.c_str(), "Field"));
+  gmod::size_fields.push_back(gmod::box_size_field(
+      gmod::Box{gmod::Vector{0, 0, 0}, gmod::Vector{.5, .5, .5}}, .01, .1));
+  gmod::SizeField math;
+  math.type = "MathEval";
+  math.options.push_back({"F", "\"0.1 + x; y\""});
+  gmod::size_fields.push_back(math);
+  gmod::BufferSink with_fields;
+  {
+    gmod::Writer w(with_fields);
+    gmod::print_closure(w, cube);
+  }
+  auto text = with_fields.buffer.c_str();
+  CHECK(strstr(text, "Field[1] = Box;\nField[1].VIn = 0.01;\n"));
+  CHECK(strstr(text, "Field[2].F = \"0.1 + x; y\";\n"));
+  CHECK(strstr(text, "Field[3] = Min;\nField[3].FieldsList = {1, 2};\n"));
+  CHECK(strstr(text, "Background Field = 3;\n"));
+  /* fields after the entities, and the reader skips them */
+  CHECK(with_fields.buffer.compare(0, plain.buffer.size(), plain.buffer) == 0);
+  auto back = gmod::read_closure_from_geo(with_fields.buffer.data(),
+      with_fields.buffer.size());
+  CHECK(back->id == cube->id);
+}
@@ -0,0 +1,70 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+#include <cstring>
+#include <string>
+
+int main()
+{
+  auto x = gmod::Vector{1, 0, 0};
+  auto y = gmod::Vector{0, 1, 0};
+  auto z = gmod::Vector{0, 0, 1};
+  gmod::reset_stats();
+  auto before = gmod::get_stats();
+  gmod::ObjPtr copy;
+  {
+    auto square = gmod::new_square(gmod::Vector{0, 0, 0}, x, y);
+    auto cube = gmod::extrude_face(square, z).middle;
+    copy = gmod::copy_closure(cube);
+    gmod::BufferSink geo;
+    gmod::write_closure_to_geo(copy, geo);
+    auto after = gmod::get_stats();
+    if (gmod::stats_enabled) {
+      /* two cubes of 8 points, 12 lines, 6 planes, 6 loops, a shell
+         and a volume, each line using 2 points and so on */
+      CHECK(after.live[gmod::POINT] - before.live[gmod::POINT] == 16);
+      CHECK(after.live[gmod::LINE] - before.live[gmod::LINE] == 24);
+      CHECK(after.live[gmod::PLANE] - before.live[gmod::PLANE] == 12);
+      CHECK(after.live[gmod::VOLUME] - before.live[gmod::VOLUME] == 2);
+      long long uses = 0;
+      for (auto const& o : gmod::get_closure(cube, true, true))
+        uses += static_cast<long long>(o->used.size());
+      CHECK(after.uses - before.uses == 2 * uses);
+      CHECK(after.helpers == before.helpers);
+      CHECK(after.bytes_allocated > 0);
+      CHECK(after.closure_traversals > 0);
+      CHECK(after.seconds[gmod::STATS_EXTRUDE] > 0);
+      CHECK(after.seconds[gmod::STATS_COPY] > 0);
+      CHECK(after.seconds[gmod::STATS_WRITE] > 0);
+      CHECK(after.seconds[gmod::STATS_WELD] == 0);
+    } else {
+      CHECK(after.uses == 0);
+      CHECK(after.closure_traversals == 0);
+      CHECK(after.seconds[gmod::STATS_EXTRUDE] == 0);
+    }
+  }
+  auto kept = gmod::get_stats();
+  if (gmod::stats_enabled) {
+    CHECK(kept.live[gmod::VOLUME] - before.live[gmod::VOLUME] == 1);
+    long long uses = 0;
+    for (auto const& o : gmod::get_closure(copy, true, true))
+      uses += static_cast<long long>(o->used.size());
+    CHECK(kept.uses - before.uses == uses);
+    gmod::reset_stats();
+    auto reset = gmod::get_stats();
+    CHECK(reset.live[gmod::VOLUME] == kept.live[gmod::VOLUME]);
+    CHECK(reset.uses == kept.uses);
+    CHECK(reset.closure_traversals == 0);
+    CHECK(reset.seconds[gmod::STATS_WRITE] == 0);
+  }
+  gmod::BufferSink json;
+  gmod::write_stats_to_json(kept, json);
+  auto const& text = json.buffer;
+  CHECK(text.front() == '{');
+  CHECK(text.find(gmod::stats_enabled ? "\"enabled\": true"
+                                       : "\"enabled\": false") !=
+        std::string::npos);
+  CHECK(text.find("\"Volume\": ") != std::string::npos);
+  CHECK(text.find("\"closure_traversals\": ") != std::string::npos);
+  CHECK(text.find("\"write\": ") != std::string::npos);
+  CHECK(text.compare(text.size() - 2, 2, "}\n") == 0);
+}
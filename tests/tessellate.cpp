@@ -0,0 +1,85 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+static double area(gmod::Tessellation const& t)
+{
+  double total = 0;
+  for (std::size_t k = 0; k < t.triangles.size(); k += 3) {
+    auto a = t.vertices[std::size_t(t.triangles[k])];
+    auto b = t.vertices[std::size_t(t.triangles[k + 1])];
+    auto c = t.vertices[std::size_t(t.triangles[k + 2])];
+    total += gmod::vector_norm(gmod::cross_product(b - a, c - a)) / 2;
+  }
+  return total;
+}
+
+static double closure_area(gmod::ObjPtr root, int segments)
+{
+  double total = 0;
+  gmod::tessellate_closure(root, segments,
+      [&](gmod::ObjPtr const&, gmod::Tessellation const& t) {
+        total += area(t);
+      });
+  return total;
+}
+
+int main()
+{
+  auto x = gmod::Vector{1, 0, 0};
+  auto y = gmod::Vector{0, 1, 0};
+  auto z = gmod::Vector{0, 0, 1};
+  {
+    /* a 4 by 4 square with nine square holes of side 1/2 */
+    auto square = gmod::new_square(gmod::Vector{0, 0, 0}, 4 * x, 4 * y);
+    for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j) {
+      auto hole = gmod::new_square(gmod::Vector{i + .75, j + .75, 0},
+          .5 * x, .5 * y);
+      gmod::add_hole_to_face(square, gmod::face_loop(hole));
+    }
+    auto t = gmod::tessellate_face(square, 8);
+    CHECK(std::fabs(area(t) - (16 - 9 * .25)) < 1e-9);
+  }
+  {
+    /* rows of round holes bridge through each other's vertices */
+    auto hole = area(gmod::tessellate_face(
+        gmod::new_disk(gmod::Vector{0, 0, 0}, z, .3 * x), 16));
+    auto plate = gmod::new_square(gmod::Vector{0, 0, 0}, 20 * x, 3 * y);
+    for (int i = 0; i < 20; ++i)
+    for (int j = 0; j < 3; ++j)
+      gmod::add_hole_to_face(plate, gmod::face_loop(gmod::new_disk(
+          gmod::Vector{i + .5, j + .5, 0}, z, .3 * x)));
+    auto t = gmod::tessellate_face(plate, 16);
+    CHECK(std::fabs(area(t) - 60 * (1 - hole)) < 1e-9);
+  }
+  {
+    /* curved boundaries converge to the true area */
+    auto disk = gmod::new_disk(gmod::Vector{0, 0, 0}, z, 2 * x);
+    auto coarse = area(gmod::tessellate_face(disk, 4));
+    auto fine = area(gmod::tessellate_face(disk, 64));
+    CHECK(coarse < fine && fine < 4 * gmod::PI);
+    CHECK(std::fabs(fine - 4 * gmod::PI) < 1e-2);
+  }
+  {
+    auto cube = gmod::new_cube(gmod::Vector{0, 0, 0}, x, y, z);
+    CHECK(std::fabs(closure_area(cube, 8) - 6) < 1e-9);
+    gmod::BufferSink sink;
+    gmod::write_closure_to_stl(cube, 8, sink);
+    CHECK(sink.buffer.size() == 84 + 50 * 12);
+  }
+  {
+    /* an instance tessellates like the copy it stands for */
+    auto cube = gmod::new_cube(gmod::Vector{0, 0, 0}, x, y, z);
+    auto group = gmod::new_group();
+    gmod::add_to_group(group, cube);
+    gmod::add_to_group(group, gmod::new_instance(cube,
+        gmod::Matrix{2 * x, 2 * y, 2 * z}, gmod::Vector{5, 0, 0}));
+    CHECK(std::fabs(closure_area(group, 8) - 6 * 5) < 1e-9);
+  }
+  {
+    /* the ruled octants of a ball close up around it */
+    auto ball = gmod::new_ball(gmod::Vector{0, 0, 0}, z, x);
+    auto total = closure_area(ball, 16);
+    CHECK(total > 0.9 * 4 * gmod::PI && total < 1.1 * 4 * gmod::PI);
+  }
+}
@@ -0,0 +1,43 @@
+#include <gmodel.hpp>
+#include <minidiff.hpp>
+
+/* the compile-time transforms must build exactly what the same
+   transform does through a std::function */
+
+template <class T>
+static std::string build(T const& tr)
+{
+  gmod::Model model;
+  gmod::set_current_model(&model);
+  auto disk = gmod::new_disk(
+      gmod::Vector{2,0,0},
+      gmod::Vector{0,0,1},
+      gmod::Vector{0.5,0,0});
+  auto group = gmod::new_group();
+  gmod::add_to_group(group, gmod::extrude_face2(disk, tr).middle);
+  auto square = gmod::new_square(
+      gmod::Vector{4,0,0},
+      gmod::Vector{1,0,0},
+      gmod::Vector{0,1,0});
+  auto face_group = gmod::new_group();
+  gmod::add_to_group(face_group, square);
+  gmod::add_to_group(group, gmod::extrude_face_group(face_group, tr).middle);
+  auto geo = geo_of(group);
+  gmod::set_current_model(nullptr);
+  return geo;
+}
+
+int main()
+{
+  gmod::Vector v{0.1, 0.2, 1.0};
+  auto translated = build(gmod::Translation{v});
+  CHECK(translated == build(gmod::Transform(gmod::Translation{v})));
+  gmod::Vector axis{1,0,0};
+  gmod::Vector center{0,-1,0};
+  gmod::Rotation rotation(center, axis, gmod::PI / 4);
+  auto rotated = build(rotation);
+  CHECK(rotated == build(gmod::Transform(rotation)));
+  CHECK(rotated != translated);
+  gmod::Affine affine{gmod::rotation_matrix(axis, gmod::PI / 4), v};
+  CHECK(build(affine) == build(gmod::Transform(affine)));
+}